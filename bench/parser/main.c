@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memutils.h"
+#include "parser.h"
+#include "printerr.h"
+#include "readfile.h"
+#include "tokenizer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycle"
+uint64_t cycles(void) {
+    return __rdtsc();
+}
+#else
+#define CYCLE_UNIT "clock tick"
+uint64_t cycles(void) {
+    return clock();
+}
+#endif
+
+#define REPEATS 5
+#define THREADS 4
+
+// Generate a program of roughly size bytes, freed by unmap_file like a file that was read.
+// Functions of declarations, loops and branches over expressions with most kinds of operators.
+char* generate_program(size_t size) {
+    char* program = mem_alloc(size + 512, SOURCE_MEM);
+    if (program == NULL) return NULL;
+
+    size_t len = 0;
+    for (size_t i = 0; len < size; i++) {
+        len += sprintf(
+            program + len,
+            "fn function_%zu(a: i32, b: i32): i32 {\n"
+            "    var x = a * %zu + b / (a - %zu) << 2 & table[a + b];\n"
+            "    if (x < b && !flag || x >= %zu) x = f(a, b, -x) ? 1 : 2;\n"
+            "    while (x != 0) x = point.x[x - 1] + (y) => y * %zu;\n"
+            "    return s { x, b | 0x%zx, [1, 2, x++] };\n"
+            "}\n",
+            i, i, i % 7, i, i, i
+        );
+    }
+    return program;
+}
+
+// Print the throughput of the fastest of REPEATS runs of parse and parse_parallel.
+void run(const TokenStream* tokens, size_t len) {
+    uint64_t best_parse = UINT64_MAX, best_parallel = UINT64_MAX;
+    for (size_t i = 0; i < REPEATS; i++) {
+        uint64_t start = cycles();
+        AST* ast = parse(tokens);
+        uint64_t elapsed = cycles() - start;
+        if (ast == NULL) exit(EXIT_FAILURE);
+        free_ast_p(ast);
+        if (elapsed < best_parse) best_parse = elapsed;
+
+        start = cycles();
+        ast = parse_parallel(tokens, THREADS);
+        elapsed = cycles() - start;
+        if (ast == NULL) exit(EXIT_FAILURE);
+        free_ast_p(ast);
+        if (elapsed < best_parallel) best_parallel = elapsed;
+    }
+
+    printf(
+        "%10.3f %10.3f   bytes/" CYCLE_UNIT "\n%10.2f %10.2f   " CYCLE_UNIT "s/token\n",
+        (double)len / (double)(best_parse ? best_parse : 1),
+        (double)len / (double)(best_parallel ? best_parallel : 1),
+        (double)best_parse / (double)tokens->len, (double)best_parallel / (double)tokens->len
+    );
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "error: wrong number of command-line arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    // benchmark a file if given, or a generated program otherwise
+    FileText file;
+    if (argc == 2) {
+        error_filename = argv[1];
+        file = map_file(argv[1], true);
+    } else {
+        error_filename = "<generated>";
+        char* program = generate_program(16 << 20);
+        file = (FileText) { program, program ? strlen(program) : 0, false };
+    }
+    if (file.text == NULL) return EXIT_FAILURE;
+
+    // only parsing is timed
+    TokenStream* tokens = tokenize(file.text, file.len);
+    if (tokens == NULL) {
+        unmap_file(&file);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu bytes, %zu tokens\n%10s %10s\n", file.len, tokens->len, "parse", "parallel");
+    run(tokens, file.len);
+
+    free_token_stream(tokens);
+    unmap_file(&file);
+    free_interner();
+    return EXIT_SUCCESS;
+}
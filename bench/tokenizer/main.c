@@ -0,0 +1,157 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memutils.h"
+#include "printerr.h"
+#include "readfile.h"
+#include "scan.h"
+#include "tokenizer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycle"
+uint64_t cycles(void) {
+    return __rdtsc();
+}
+#else
+#define CYCLE_UNIT "clock tick"
+uint64_t cycles(void) {
+    return clock();
+}
+#endif
+
+#define REPEATS 5
+#define THREADS 4
+
+// Generate a program of roughly size bytes, freed by unmap_file like a file that was read.
+// Mostly indentation, comments and long names, like machine generated sources.
+char* generate_program(size_t size) {
+    char* program = mem_alloc(size + 256, SOURCE_MEM);
+    if (program == NULL) return NULL;
+
+    size_t len = 0;
+    for (size_t i = 0; len < size; i++) {
+        size_t depth = i % 5;
+        len += sprintf(program + len, "%*s", (int)(depth * 4), "");
+        switch (i % 4) {
+            case 0:
+                len += sprintf(
+                    program + len, "# generated_table_entry_%zu: keep this entry in sync\n", i
+                );
+                break;
+            case 1:
+                len += sprintf(
+                    program + len, "const generated_value_%zu: u32 = 0x%zx + generated_offset;\n",
+                    i, i * 2654435761u
+                );
+                break;
+            case 2:
+                len += sprintf(
+                    program + len, "var generated_index_%zu = lookup_table_%zu[%zu];\n", i,
+                    i % 97, i
+                );
+                break;
+            case 3:
+                len += sprintf(
+                    program + len, "\tgenerated_index_%zu += generated_value_%zu * 1000000;\n",
+                    i - 1, i - 2
+                );
+                break;
+        }
+    }
+    return program;
+}
+
+// Check whether chr begins a variable name or integer literal.
+bool is_word_start(char chr) {
+    return ('a' <= chr && chr <= 'z') || ('A' <= chr && chr <= 'Z') || ('0' <= chr && chr <= '9') ||
+           chr == '_';
+}
+
+// Skip the runs the scanning kernels handle and step over everything else.
+// Returns the number of runs to keep the loop from being optimized out.
+size_t skip_runs(const char* program, size_t len) {
+    const ScanKernels* scan = scan_kernels();
+    const char* it = program;
+    const char* end = program + len;
+
+    size_t runs = 0;
+    while (it < end) {
+        if (*it == ' ') it = scan->skip_spaces(it + 1, end);
+        else if (*it == '#') it = scan->find_line_end(it + 1, end);
+        else if (is_word_start(*it)) it = scan->find_word_end(it + 1, end);
+        else it++;
+        runs++;
+    }
+    return runs;
+}
+
+// Print the throughput of the fastest of REPEATS runs of skip_runs, tokenize and
+// tokenize_parallel.
+void run(const char* program, size_t len) {
+    uint64_t best_skip = UINT64_MAX, best_tokenize = UINT64_MAX, best_parallel = UINT64_MAX;
+    for (size_t i = 0; i < REPEATS; i++) {
+        uint64_t start = cycles();
+        volatile size_t runs = skip_runs(program, len);
+        uint64_t elapsed = cycles() - start;
+        (void)runs;
+        if (elapsed < best_skip) best_skip = elapsed;
+
+        start = cycles();
+        TokenStream* tokens = tokenize(program, len);
+        elapsed = cycles() - start;
+        if (tokens == NULL) exit(EXIT_FAILURE);
+        free_token_stream(tokens);
+        if (elapsed < best_tokenize) best_tokenize = elapsed;
+
+        start = cycles();
+        tokens = tokenize_parallel(program, len, THREADS);
+        elapsed = cycles() - start;
+        if (tokens == NULL) exit(EXIT_FAILURE);
+        free_token_stream(tokens);
+        if (elapsed < best_parallel) best_parallel = elapsed;
+    }
+
+    printf(
+        "%10.3f %10.3f %10.3f   bytes/" CYCLE_UNIT "\n",
+        (double)len / (double)(best_skip ? best_skip : 1),
+        (double)len / (double)(best_tokenize ? best_tokenize : 1),
+        (double)len / (double)(best_parallel ? best_parallel : 1)
+    );
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "error: wrong number of command-line arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    // benchmark a file if given, or a generated program otherwise
+    FileText file;
+    if (argc == 2) {
+        error_filename = argv[1];
+        // read ahead so page faults are not timed
+        file = map_file(argv[1], true);
+    } else {
+        error_filename = "<generated>";
+        char* program = generate_program(16 << 20);
+        file = (FileText) { program, program ? strlen(program) : 0, false };
+    }
+    if (file.text == NULL) return EXIT_FAILURE;
+
+    printf("%zu bytes\n%-8s %10s %10s %10s\n", file.len, "", "runs", "tokenize", "parallel");
+    ScanLevel levels[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+    for (size_t i = 0; i < sizeof(levels) / sizeof(ScanLevel); i++) {
+        if (scan_select(levels[i]) != levels[i]) continue;
+        printf("%-8s", scan_level_name(levels[i]));
+        run(file.text, file.len);
+    }
+
+    unmap_file(&file);
+    free_interner();
+    return EXIT_SUCCESS;
+}
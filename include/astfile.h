@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "parser.h"
+
+// Version of the AST file format, increased whenever the layout of the nodes changes.
+#define AST_FILE_VERSION 1
+
+bool emit_ast(const AST* ast, const char* filename);
+AST* load_ast(const char* filename);
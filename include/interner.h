@@ -0,0 +1,40 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memutils.h"
+
+// Dense id of an interned string, equal ids mean equal strings.
+typedef uint32_t symbol_t;
+#define PRIsymbol PRIu32
+#define NO_SYMBOL 0
+
+typedef struct Interner Interner;
+
+// Hash table of strings numbered in the order they were first interned.
+struct Interner {
+    Arena strings;     // null terminated copies of the strings
+    DynArr entries;    // indexed by symbol - 1
+    symbol_t* slots;   // open addressing hash table of symbols
+    size_t slot_mask;  // number of slots - 1
+};
+
+Interner interner_create(void);
+void interner_destroy(Interner* interner);
+
+symbol_t interner_intern(Interner* interner, const char* str, size_t len);
+symbol_t interner_find(const Interner* interner, const char* str, size_t len);
+StrView interner_name(const Interner* interner, symbol_t symbol);
+size_t interner_count(const Interner* interner);
+
+symbol_t intern(const char* str, size_t len);
+symbol_t find_symbol(const char* str, size_t len);
+StrView symbol_name(symbol_t symbol);
+size_t symbol_count(void);
+
+unsigned symbol_tag(symbol_t symbol);
+void set_symbol_tag(symbol_t symbol, unsigned tag);
+
+void free_interner(void);
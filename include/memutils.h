@@ -2,8 +2,75 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
-void* malloc_struct(void* elem, size_t size);
+// printf format and arguments of a StrView
+#define PRIstrview ".*s"
+#define STRVIEW_ARG(view) (int)(view).len, (view).ptr
+
+typedef struct StrView StrView;
+
+// Non-owning string of length len, not necessarily null terminated.
+struct StrView {
+    const char* ptr;
+    size_t len;
+};
+
+bool strview_eq(StrView a, StrView b);
+
+typedef struct MemStats MemStats;
+
+// What allocations are for, which memory statistics are broken down by.
+enum MemTag {
+    ARRAY_MEM,       // dynamic arrays and vectors without a more specific tag
+    SOURCE_MEM,      // source text read into memory and its line index
+    LEXER_MEM,       // buffers of lexers
+    TOKEN_MEM,       // token streams
+    STRING_MEM,      // copies of token strings and decoded literals
+    SYMBOL_MEM,      // interned names
+    AST_MEM,         // node pools
+    TYPE_MEM,        // types cloned by the typechecker
+    ANNOTATION_MEM,  // types of the expressions
+    SCOPE_MEM,       // symbol tables of the typechecker
+    ASTFILE_MEM,     // AST files being written or loaded
+    MEM_TAG_COUNT,
+};
+
+typedef enum MemTag MemTag;
+
+// Phase of the compiler that allocations are made in.
+enum MemPhase {
+    START_PHASE,
+    READ_PHASE,
+    TOKENIZE_PHASE,
+    PARSE_PHASE,
+    TYPECHECK_PHASE,
+    LOAD_PHASE,
+    EMIT_PHASE,
+    FREE_PHASE,
+    MEM_PHASE_COUNT,
+};
+
+typedef enum MemPhase MemPhase;
+
+// Allocations of a tag or phase.
+struct MemStats {
+    size_t allocs;  // number of blocks allocated or resized
+    size_t bytes;   // bytes requested by them
+    size_t live;    // bytes not freed yet, at the end of a phase
+    size_t peak;    // maximum of live
+};
+
+void mem_stats_enable(void);
+void mem_phase(MemPhase phase);
+MemStats mem_tag_stats(MemTag tag);
+MemStats mem_phase_stats(MemPhase phase);
+void print_mem_stats(FILE* fp);
+
+void* mem_alloc(size_t size, MemTag tag);
+void* mem_calloc(size_t count, size_t size, MemTag tag);
+void* mem_realloc(void* ptr, size_t size, MemTag tag);
+void mem_free(void* ptr);
 
 typedef struct DynArr DynArr;
 struct DynArr {
@@ -11,10 +78,76 @@ struct DynArr {
     size_t elem_size;
     size_t length;
     size_t capacity;
+    MemTag tag;
 };
 
-DynArr dynarr_create(size_t elem_size);
+DynArr dynarr_create(size_t elem_size, MemTag tag);
 void dynarr_destroy(DynArr* arr);
 
 void* dynarr_get(DynArr* arr, size_t i);
-bool dynarr_append(DynArr* arr, void* elem);
+bool dynarr_reserve(DynArr* arr, size_t capacity);
+bool dynarr_append(DynArr* arr, const void* elem);
+
+// Declare vector type name of elements of type type, with functions prefixed by prefix.
+// The first n elements are stored inline, so short vectors on the stack never allocate.
+#define SMALLVEC_DECLARE(name, prefix, type, n)              \
+    typedef struct name name;                                \
+    struct name {                                            \
+        size_t length;                                       \
+        size_t capacity;                                     \
+        type* heap; /* NULL while the elements are inline */ \
+        type inline_elems[n];                                \
+    };                                                       \
+    name prefix##_create(void);                              \
+    void prefix##_destroy(name* vec);                        \
+    type* prefix##_elems(name* vec);                         \
+    bool prefix##_append(name* vec, type elem);
+
+// Define the functions declared by SMALLVEC_DECLARE with the same arguments.
+// Requires <string.h> and printerr.h.
+#define SMALLVEC_DEFINE(name, prefix, type, n)                                          \
+    name prefix##_create(void) {                                                        \
+        return (name) { .length = 0, .capacity = (n), .heap = NULL };                   \
+    }                                                                                   \
+                                                                                        \
+    void prefix##_destroy(name* vec) {                                                  \
+        mem_free(vec->heap);                                                            \
+        *vec = prefix##_create();                                                       \
+    }                                                                                   \
+                                                                                        \
+    type* prefix##_elems(name* vec) {                                                   \
+        return vec->heap ? vec->heap : vec->inline_elems;                               \
+    }                                                                                   \
+                                                                                        \
+    bool prefix##_append(name* vec, type elem) {                                        \
+        if (vec->length == vec->capacity) {                                             \
+            size_t capacity = vec->capacity * 2;                                        \
+            type* heap = mem_realloc(vec->heap, capacity * sizeof(type), ARRAY_MEM);    \
+            if (heap == NULL) {                                                         \
+                malloc_error();                                                         \
+                return true;                                                            \
+            }                                                                           \
+            /* the inline elements are copied out on the first growth */                \
+            if (vec->heap == NULL) memcpy(heap, vec->inline_elems, sizeof(type) * (n)); \
+            vec->heap = heap;                                                           \
+            vec->capacity = capacity;                                                   \
+        }                                                                               \
+        prefix##_elems(vec)[vec->length++] = elem;                                      \
+        return false;                                                                   \
+    }
+
+typedef struct ArenaChunk ArenaChunk;
+typedef struct Arena Arena;
+
+// Append-only allocator, everything in it is freed at once.
+struct Arena {
+    ArenaChunk* chunks;  // newest first
+    MemTag tag;          // of its chunks
+};
+
+Arena arena_create(MemTag tag);
+void arena_destroy(Arena* arena);
+
+void* arena_alloc(Arena* arena, size_t size, size_t align);
+void* arena_dup(Arena* arena, const void* src, size_t size, size_t align);
+void arena_merge(Arena* dst, Arena* src);
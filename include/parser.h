@@ -1,7 +1,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "readfile.h"
 #include "tokenizer.h"
 
 struct Type;
@@ -10,7 +12,19 @@ typedef struct Type Type;
 typedef struct TypeSpec TypeSpec;
 typedef struct Expr Expr;
 typedef struct Stmt Stmt;
-typedef Stmt AST;
+typedef struct Param Param;
+typedef struct AST AST;
+
+// Nodes refer to each other by their 32-bit indexes in the pools of their AST.
+typedef uint32_t spec_t;   // index of a TypeSpec
+typedef uint32_t expr_t;   // index of an Expr
+typedef uint32_t stmt_t;   // index of a Stmt
+typedef uint32_t token_t;  // index of a Token
+typedef uint32_t param_t;  // index of the first Param of a parameter list
+typedef uint32_t list_t;   // index of the first node of a list of children
+
+// index of no node
+#define NO_NODE UINT32_MAX
 
 enum TypeSpecEnum {
     ERROR_SPEC,
@@ -24,22 +38,22 @@ enum TypeSpecEnum {
 };
 
 struct PtrTypeSpecData {
-    TypeSpec* spec;
+    spec_t spec;
     bool mutable;
 };
 
 struct FunTypeSpecData {
-    size_t paramc, optc;
-    TypeSpec* paramt;
-    TypeSpec* ret;
+    uint32_t paramc, optc;
+    list_t paramt;
+    spec_t ret;
 };
 
 typedef struct PtrTypeSpecData PtrTypeSpecData;
 typedef struct FunTypeSpecData FunTypeSpecData;
 
 union TypeSpecData {
-    TypeSpec* group;
-    Token atom;
+    spec_t group;
+    token_t atom;
     PtrTypeSpecData ptr;
     FunTypeSpecData fun;
 };
@@ -49,7 +63,7 @@ typedef union TypeSpecData TypeSpecData;
 
 struct TypeSpec {
     TypeSpecEnum type;
-    size_t line, col;
+    pos_t pos;  // byte offset in the source
     TypeSpecData data;
 };
 
@@ -115,42 +129,39 @@ enum OpEnum {
 };
 
 struct ArrExprData {
-    size_t len;
-    Expr* items;
+    uint32_t len;
+    list_t items;
 };
 
 struct LambdaExprData {
-    size_t paramc, optc;
-    Token* paramv;
-    TypeSpec* paramt;
-    Expr* paramd;
-    Expr* expr;
+    uint32_t paramc, optc;
+    param_t params;
+    expr_t expr;
 };
 
 struct SubscriptData {
-    Expr* arr;
-    Expr* idx;
+    expr_t arr;
+    expr_t idx;
 };
 
 struct CallData {
-    Expr* fun;
-    size_t argc;
-    Expr* argv;
+    expr_t fun;
+    uint32_t argc;
+    list_t argv;
 };
 
 struct AccessData {
-    Expr* obj;
-    Token memeber;
+    expr_t obj;
+    token_t memeber;
 };
 
 typedef enum OpEnum OpEnum;
 
 struct OpExprData {
     OpEnum type;
-    Token token;
-    Expr* first;
-    Expr* second;
-    Expr* third;
+    expr_t first;
+    expr_t second;
+    expr_t third;
 };
 
 typedef struct ArrExprData ArrExprData;
@@ -162,8 +173,8 @@ typedef struct ConstructorData ConstructorData;
 typedef struct AccessData AccessData;
 
 union ExprData {
-    Expr* group;
-    Token atom;
+    expr_t group;
+    token_t atom;
     ArrExprData arr;
     LambdaExprData lambda;
     OpExprData op;
@@ -177,10 +188,15 @@ typedef union ExprData ExprData;
 
 struct Expr {
     ExprEnum type;
-    size_t line, col;
+    pos_t pos;  // byte offset in the source
     ExprData data;
+};
 
-    Type* annotation;
+// Parameter of a function, struct or lambda.
+struct Param {
+    token_t name;
+    spec_t type;
+    expr_t def;  // empty expression if not optional
 };
 
 enum StmtEnum {
@@ -208,70 +224,66 @@ enum StmtEnum {
 };
 
 struct BlockStmtData {
-    size_t len;
-    Stmt* stmts;
+    uint32_t len;
+    list_t stmts;
 };
 
 struct DeclData {
-    Token name;
-    Expr val;
-    TypeSpec spec;
+    token_t name;
+    expr_t val;
+    spec_t spec;
     bool mutable;
 };
 
 struct TypedefData {
-    Token name;
-    TypeSpec val;
+    token_t name;
+    spec_t val;
 };
 
 struct IfElseData {
-    Expr condition;
-    Stmt* on_true;
-    Stmt* on_false;
+    expr_t condition;
+    stmt_t on_true;
+    stmt_t on_false;  // NO_NODE if there is no else branch
 };
 
 struct SwitchData {
-    Expr expr;
-    size_t casec;
-    Expr* casev;
-    Stmt* branchv;
-    size_t defaulti;
+    expr_t expr;
+    uint32_t casec;
+    list_t casev;
+    list_t branchv;
+    uint32_t defaulti;
 };
 
 struct WhileData {
-    Expr condition;
-    Stmt* body;
+    expr_t condition;
+    stmt_t body;
 };
 
 struct ForData {
-    Stmt* init;
-    Expr condition;
-    Expr expr;
-    Stmt* body;
+    stmt_t init;
+    expr_t condition;
+    expr_t expr;
+    stmt_t body;
 };
 
 struct FunData {
-    Token name;
-    size_t paramc, optc;
-    Token* paramv;
-    TypeSpec* paramt;
-    Expr* paramd;
-    TypeSpec ret;
-    Stmt* body;
+    token_t name;
+    uint32_t paramc, optc;
+    param_t params;
+    spec_t ret;
+    stmt_t body;
 };
 
 struct StructData {
-    Token name;
-    size_t paramc, optc;
-    Token* paramv;
-    TypeSpec* paramt;
-    Expr* paramd;
+    token_t name;
+    uint32_t paramc, optc;
+    param_t params;
 };
 
 struct EnumData {
-    Token name;
-    size_t len;
-    Token* items;
+    token_t name;
+    uint32_t len;
+    list_t items;
 };
 
 typedef struct BlockStmtData BlockStmtData;
@@ -287,7 +299,7 @@ typedef struct EnumData EnumData;
 
 union StmtData {
     BlockStmtData block;
-    Expr expr;
+    expr_t expr;
     DeclData decl;
     TypedefData type;
     IfElseData ifelse;
@@ -304,9 +316,36 @@ typedef union StmtData StmtData;
 
 struct Stmt {
     StmtEnum type;
-    size_t line, col;
+    pos_t pos;  // byte offset in the source
     StmtData data;
 };
 
-AST* parse(const Token* program);
+// Parsed program with its nodes in pools of their own type, in the order they were parsed.
+// The children of a node come before it, and lists of children are stored contiguously.
+// Literals are owned by the AST, and other token strings point into the program or the interner,
+// so the AST outlives the tokens of its program.
+struct AST {
+    stmt_t block;  // the root BLOCK
+
+    TypeSpec* specs;
+    Expr* exprs;
+    Stmt* stmts;
+    Token* tokens;    // names, literals and atomic type specifiers
+    Param* params;    // parameter lists
+    uint32_t* lists;  // lists of children, indexes into the pool of their type
+    size_t specc, exprc, stmtc, tokenc, paramc, listc;
+
+    Type** annotations;  // types of the expressions, NULL until typechecked
+    Arena arena;         // literals and annotations of the typechecker
+
+    FileText file;  // read-only file the pools other than tokens are in, if loaded by load_ast
+};
+
+// Number of syntax errors after which parsing stops instead of recovering to report more.
+extern size_t max_syntax_errors;
+
+AST* parse(const TokenStream* program);
+AST* parse_stream(Lexer* lexer);
+AST* parse_parallel(const TokenStream* program, size_t threads);
+bool reparse(TokenStream** tokens, AST** ast, const char* program, size_t len, TextEdit edit);
 void free_ast_p(AST* ast);
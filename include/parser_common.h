@@ -6,30 +6,72 @@
 // initial precedence for parse_expr
 #define MAX_PRECEDENCE 12
 
-TypeSpec parse_type_spec(const Token** it);
-Expr parse_expr(const Token** it, size_t precedence);
-Stmt parse_stmt(const Token** it);
-Stmt parse_block(const Token** it);
+typedef struct NodePools NodePools;
+typedef struct NodeBases NodeBases;
+typedef struct Reuse Reuse;
+
+// Growing pools of the AST being parsed.
+struct NodePools {
+    DynArr specs;
+    DynArr exprs;
+    DynArr stmts;
+    DynArr tokens;
+    DynArr params;
+    DynArr lists;
+    Arena strings;  // strings of the literal tokens
+};
+
+// Offsets of nodes moved from other pools to the ones of an AST, which wrap around if negative.
+struct NodeBases {
+    uint32_t spec, expr, stmt, token, param, list;
+};
+
+extern _Thread_local NodePools* node_pools;
+extern _Thread_local const Reuse* reused;
+
+// Lists of children and parameters built on the stack, most have at most a few items.
+SMALLVEC_DECLARE(NodeVec, node_vec, uint32_t, 8)
+SMALLVEC_DECLARE(ParamVec, param_vec, Param, 4)
+
+void* place_node(DynArr* pool, uint32_t* dst);
+uint32_t push_nodes(DynArr* pool, const void* nodes, size_t len);
+TypeSpec* place_spec(spec_t* dst);
+Expr* place_expr(expr_t* dst);
+Stmt* place_stmt(stmt_t* dst);
+spec_t new_spec(const TypeSpec* spec);
+expr_t new_expr(const Expr* expr);
+stmt_t new_stmt(const Stmt* stmt);
+bool own_token_strings(Token* token);
+token_t new_token(const Token* token);
+token_t new_next_token(Lexer* lexer);
+token_t new_expected_token(Lexer* lexer, TokenEnum type);
+param_t new_params(ParamVec* params);
+list_t new_list(NodeVec* nodes);
+
+void rebase_spec(TypeSpec* spec, const NodeBases* bases, uint32_t* lists);
+void rebase_expr(Expr* expr, const NodeBases* bases, uint32_t* lists);
+void rebase_stmt(Stmt* stmt, const NodeBases* bases, uint32_t* lists);
+
+TypeSpec* get_spec(spec_t spec);
+Expr* get_expr(expr_t expr);
+Stmt* get_stmt(stmt_t stmt);
+Token* get_token(token_t token);
+
+spec_t parse_type_spec(Lexer* lexer);
+expr_t parse_expr(Lexer* lexer, size_t precedence);
+stmt_t parse_stmt(Lexer* lexer);
+stmt_t parse_block(Lexer* lexer);
 
 void unexpected_token(Token token);
-bool consume_expected_token(const Token** it, TokenEnum type);
-
-bool is_expr(const Token* const* it);
-bool is_statement(const Token* const* it);
-bool is_lambda(const Token* const* it);
-
-bool parse_params(
-    const Token** it, size_t* len_dst, size_t* opt_dst, Token** names_dst, TypeSpec** types_dst,
-    Expr** defs_dst
-);
-bool parse_args(const Token** it, size_t* len_dst, Expr** vals_dst);
-
-void free_spec(TypeSpec spec);
-void free_spec_arrn(TypeSpec* arr, size_t n);
-void free_spec_dynarr(DynArr* arr);
-void free_expr(Expr expr);
-void free_expr_arrn(Expr* arr, size_t n);
-void free_expr_dynarr(DynArr* arr);
-void free_stmt(Stmt stmt);
-void free_stmt_arrn(Stmt* arr, size_t n);
-void free_stmt_dynarr(DynArr* arr);
+bool consume_expected_token(Lexer* lexer, TokenEnum type);
+
+bool is_expr(Lexer* lexer);
+bool is_statement(Lexer* lexer);
+bool is_lambda(Lexer* lexer);
+bool ends_block(TokenEnum type, size_t depth);
+void synchronize(Lexer* lexer, size_t depth);
+
+bool reuse_next_stmt(Lexer* lexer, stmt_t* dst);
+
+bool parse_params(Lexer* lexer, uint32_t* len_dst, uint32_t* opt_dst, param_t* params_dst);
+bool parse_args(Lexer* lexer, uint32_t* len_dst, list_t* vals_dst);
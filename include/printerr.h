@@ -3,10 +3,19 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "source.h"
+
 extern const char* error_filename;
-extern size_t error_line, error_col;
+extern _Thread_local pos_t error_pos;
+extern _Thread_local bool errors_muted;
+extern _Thread_local size_t syntax_errors;
+extern _Thread_local bool errors_deferred;
+extern _Thread_local char* deferred_error;
 
 void syntax_error(const char* format, ...);
 void type_error(const char* format, ...);
 void malloc_error(void);
 void fread_error(void);
+void fsize_error(void);
+void fwrite_error(void);
+void fformat_error(void);
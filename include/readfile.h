@@ -1,3 +1,16 @@
 #pragma once
 
-char* readfile(const char* filename);
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct FileText FileText;
+
+// Contents of a file, not null terminated.
+struct FileText {
+    const char* text;  // NULL if the file could not be read
+    size_t len;
+    bool mapped;  // memory mapped rather than read into an allocation
+};
+
+FileText map_file(const char* filename, bool populate);
+void unmap_file(FileText* file);
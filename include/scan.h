@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+// Instruction sets the scanning kernels can be built with.
+enum ScanLevel {
+    SCAN_DETECT,  // best level supported by the running cpu
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+typedef enum ScanLevel ScanLevel;
+
+// Kernels that find the end of long character runs.
+// Each one scans [it, end) and returns end if the run does not stop before it.
+typedef struct ScanKernels ScanKernels;
+struct ScanKernels {
+    ScanLevel level;
+    // Find the first character that is not a space.
+    const char* (*skip_spaces)(const char* it, const char* end);
+    // Find the first line feed.
+    const char* (*find_line_end)(const char* it, const char* end);
+    // Find the first character that is not a letter, digit or underscore.
+    const char* (*find_word_end)(const char* it, const char* end);
+    // Find the first backslash, quote, line feed or null character.
+    const char* (*find_literal_end)(const char* it, const char* end, char quote);
+};
+
+ScanLevel scan_select(ScanLevel level);
+const ScanKernels* scan_kernels(void);
+const char* scan_level_name(ScanLevel level);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte offset in the source, only converted to a line and column for diagnostics.
+typedef uint32_t pos_t;
+#define PRIpos PRIu32
+
+void set_source_text(const char* text, size_t len, size_t tabsize);
+void set_source_file(const char* filename, size_t tabsize);
+
+size_t source_line(pos_t pos);
+size_t source_col(pos_t pos);
+
+void free_source(void);
@@ -1,11 +1,16 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
-typedef int64_t literal_t;
-#define PRIliteral PRIi64
-#define LITERAL_TYPE I64_TYPE
+#include "interner.h"
+#include "source.h"
+
+typedef uint64_t literal_t;
+#define PRIliteral PRIu64
 
 typedef struct Token Token;
 
@@ -106,22 +111,151 @@ enum TokenEnum {
     U64_TOKEN,
 };
 
+typedef enum TokenEnum TokenEnum;
+typedef struct IntLiteral IntLiteral;
+
+// Value of an integer literal and the narrowest integer type that holds it.
+struct IntLiteral {
+    literal_t value;
+    TokenEnum width;  // I8_TOKEN through U64_TOKEN
+};
+
 union TokenData {
-    literal_t int_literal;
+    IntLiteral int_literal;
     char chr_literal;
-    char* str_literal;
-    char* var_name;
+    StrView str_literal;  // null terminated
+    symbol_t var_name;
 };
 
-typedef enum TokenEnum TokenEnum;
 typedef union TokenData TokenData;
 
 struct Token {
     TokenEnum type;
-    char* str;
-    size_t line, col;
+    pos_t pos;    // byte offset in the source
+    StrView str;  // points into the tokenized program, or lexer storage if read from a file
     TokenData data;
 };
 
-Token* tokenize(const char* program, size_t tabsize);
-void free_token_arr(Token* arr);
+typedef struct StrRef StrRef;
+typedef union TokenPayload TokenPayload;
+typedef struct TokenStream TokenStream;
+
+// String stored at offset in a buffer known from context.
+struct StrRef {
+    uint32_t offset;
+    uint32_t len;
+};
+
+// Compact TokenData of a literal or variable name in a TokenStream.
+union TokenPayload {
+    literal_t int_literal;  // width is implied by the value
+    char chr_literal;
+    StrRef str_literal;  // into the literal storage of the stream
+    symbol_t var_name;
+};
+
+// Tokenized program with the fields of its tokens in parallel arrays.
+// Only literals and variable names have a payload, in token order.
+struct TokenStream {
+    const char* program;  // the tokenized program, which must outlive the stream
+    size_t len;           // number of tokens including the final EOF_TOKEN
+    uint8_t* kinds;       // TokenEnum values
+    pos_t* offsets;       // offsets of the token strings in program
+    uint32_t* lens;       // lengths of the token strings
+    uint32_t* matches;    // indexes of the matching brackets of bracket tokens
+    TokenPayload* payloads;
+    char* literals;  // decoded string literals, null terminated
+};
+
+// index of no bracket
+#define NO_MATCH SIZE_MAX
+
+// flag of symbols in the local interner of a Lexer
+#define LOCAL_SYMBOL 0x80000000u
+
+typedef struct TextEdit TextEdit;
+typedef struct TokenDamage TokenDamage;
+
+// Replacement of the bytes [start, end) of a program by the len bytes at start of the edited one.
+struct TextEdit {
+    size_t start, end;
+    size_t len;
+};
+
+// Range of tokens of a program that were lexed again after an edit.
+// The tokens before begin are unchanged, and the ones after it are moved by the edit.
+struct TokenDamage {
+    size_t begin;    // index of the first token lexed again
+    size_t old_end;  // index of the first token kept after them before the edit
+    size_t new_end;  // index of that token after the edit
+    ptrdiff_t shift;          // change of the offsets of the tokens kept after them
+    ptrdiff_t literal_shift;  // change of the offsets of their string literals
+};
+
+typedef struct Lexer Lexer;
+
+// Pull-based tokenizer over an in-memory program, a file or a token stream.
+// Tokens are lexed on demand into a lookahead ring buffer.
+struct Lexer {
+    // source window [it, end)
+    FILE* fp;  // NULL unless reading the source from a file in chunks
+    char* buf;
+    size_t buf_size;
+    const char* it;
+    const char* end;
+    const char* start;  // source at offset base
+    size_t base;
+    bool exhausted;     // no source is left after end
+    bool failed;
+
+    // lookahead ring buffer
+    Token* ring;
+    size_t* distances;  // from opening brackets to their closing ones, 0 if not lexed yet
+    size_t ring_mask;   // capacity - 1
+    size_t head;        // index of the current token
+    size_t count;       // number of buffered tokens
+    bool done;          // the last buffered token is an EOF_TOKEN or ERROR_TOKEN
+
+    // bracket matching
+    DynArr brackets;    // stack of unclosed opening brackets
+    DynArr* unmatched;  // indexes of closing brackets without opening ones, reported if NULL
+    size_t lexed;       // number of tokens lexed
+    size_t closed;      // index of the bracket closed by the last token, or NO_MATCH
+    size_t depth;       // number of brackets left open by the consumed tokens, if ever closed
+    bool mismatched;    // a bracket error was reported without ending the tokens
+    DynArr errors;      // errors lexed while looking ahead, written once the parser reaches them
+
+    Interner* symbols;    // new names are interned here as LOCAL_SYMBOL unless NULL
+    DynArr* literal_buf;  // string literals are decoded to the end of this unless NULL
+    Arena literals;       // decoded literals, and token strings when reading from a file
+    DynArr scratch;       // character literal decoding
+
+    // replayed token stream, NULL unless created by lexer_from_stream
+    const TokenStream* stream;
+    size_t pos;          // index of the current token
+    size_t payload_pos;  // index of the next payload
+    Token peeked;        // storage of the last token returned by peek
+};
+
+Lexer lexer_create(const char* program, size_t len);
+Lexer lexer_open(FILE* fp);
+Lexer lexer_from_stream(const TokenStream* stream);
+void lexer_destroy(Lexer* lexer);
+
+const Token* peek(Lexer* lexer, size_t n);
+TokenEnum peek_type(Lexer* lexer, size_t n);
+size_t peek_match(Lexer* lexer, size_t n);
+Token next_token(Lexer* lexer);
+void report_lexer_errors(Lexer* lexer);
+void settle_depth(Lexer* lexer);
+
+TokenEnum literal_width(literal_t value);
+bool has_payload(TokenEnum type);
+
+TokenStream* tokenize(const char* program, size_t len);
+size_t online_cpus(void);
+TokenStream* tokenize_parallel(const char* program, size_t len, size_t threads);
+TokenStream* retokenize(
+    const TokenStream* stream, const char* program, size_t len, TextEdit edit, TokenDamage* damage
+);
+void free_token_stream(TokenStream* stream);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "memutils.h"
 #include "parser.h"
 
 enum TypeEnum {
@@ -91,6 +92,44 @@ struct Type {
     TypeData data;
 };
 
+typedef struct Binding Binding;
+typedef struct SymbolSlot SymbolSlot;
+typedef struct SymbolTable SymbolTable;
+
+#define NO_BINDING UINT32_MAX
+
+// Declaration of a name in an open scope.
+struct Binding {
+    symbol_t symbol;
+    uint32_t shadowed;  // binding of the same name in an outer scope, or NO_BINDING
+    Type type;
+};
+
+// Name in the hash table of a SymbolTable.
+struct SymbolSlot {
+    symbol_t symbol;   // NO_SYMBOL if the slot is empty
+    uint32_t binding;  // innermost binding of the name, or NO_BINDING if it is out of scope
+};
+
+// Names declared by the open scopes, in a single hash table so that looking one up does not
+// depend on the number and size of the scopes.
+// Bindings are pushed as scopes are opened, so closing the innermost scope pops its bindings and
+// restores the ones they shadowed.
+struct SymbolTable {
+    DynArr bindings;    // innermost last
+    DynArr scopes;      // number of bindings when each open scope was opened
+    SymbolSlot* slots;  // open addressing hash table of names, which are never removed
+    size_t slot_mask;   // number of slots - 1
+    size_t names;       // number of used slots
+};
+
+SymbolTable symbol_table_create(void);
+void free_symbol_table(SymbolTable* table);
+
+bool push_scope(SymbolTable* table);
+bool declare_symbol(SymbolTable* table, symbol_t symbol);
+void close_scope(SymbolTable* table);
+Binding* find_binding(const SymbolTable* table, symbol_t symbol);
+
 bool typecheck(AST* ast);
-void free_typed_ast_p(AST* ast);
-Type clone_type(Type type);
+Type clone_type(Type type, Arena* arena);
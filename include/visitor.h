@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memutils.h"
+#include "parser.h"
+
+typedef struct Visit Visit;
+typedef struct Visitor Visitor;
+
+// Pools of the nodes a Visitor reaches.
+enum NodeKind {
+    SPEC_NODE,
+    EXPR_NODE,
+    STMT_NODE,
+    PARAM_NODE,
+};
+
+typedef enum NodeKind NodeKind;
+
+// Node reached by a Visitor, before or after its children.
+struct Visit {
+    NodeKind kind;
+    uint32_t id;  // index of the node in the pool of its kind
+    bool post;    // the children were visited
+    size_t depth;  // number of ancestors below the root of the traversal
+    size_t index;  // position among the children of the parent
+    NodeKind parent_kind;
+    uint32_t parent;  // NO_NODE at the root
+};
+
+// Depth-first traversal of a subtree of an AST on an explicit stack, so that the depth of the
+// tree is only limited by memory.
+// Children are visited in the order of their fields, except that the value of a declaration
+// comes before its type specifier, and the cases of a switch alternate with their branches.
+struct Visitor {
+    const AST* ast;
+    DynArr stack;  // nodes whose children are being visited
+    bool failed;
+};
+
+Visitor visitor_create(const AST* ast, NodeKind kind, uint32_t root);
+void visitor_destroy(Visitor* visitor);
+
+bool visit_next(Visitor* visitor, Visit* dst);
+void visit_skip(Visitor* visitor);
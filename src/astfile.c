@@ -0,0 +1,352 @@
+#include "astfile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "printerr.h"
+
+// An AST file is a header followed by sections of records. The pools of nodes refer to each other
+// by index, so they are stored as they are in memory and used in place after mapping the file.
+// Tokens are the only records with pointers and symbols, which are stored as references into the
+// string and name sections and relocated in one pass when loading.
+// Records are in the byte order and layout of the compiler that wrote them, which the header
+// records so that files of other builds are rejected rather than misread.
+
+#define AST_FILE_MAGIC "SMLAST\0"
+
+// written in native byte order to detect files of the other one
+#define AST_FILE_BYTE_ORDER 0x01020304u
+
+// alignment of the sections in the file
+#define AST_FILE_ALIGN 8
+
+typedef struct AstSection AstSection;
+typedef struct AstFileHeader AstFileHeader;
+typedef struct TokenRecord TokenRecord;
+
+enum AstSectionEnum {
+    SPEC_SECTION,
+    EXPR_SECTION,
+    STMT_SECTION,
+    PARAM_SECTION,
+    LIST_SECTION,
+    TOKEN_SECTION,
+    NAME_SECTION,    // StrRef of every name, referred to from 1
+    STRING_SECTION,  // token strings, literals and null terminated names
+
+    SECTION_COUNT,
+};
+
+typedef enum AstSectionEnum AstSectionEnum;
+
+// Range of records of a section in the file.
+struct AstSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct AstFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t sizes[SECTION_COUNT];  // record sizes, which differ between builds
+    stmt_t block;
+    AstSection sections[SECTION_COUNT];
+};
+
+// Token of an AST file, with references into the string section instead of pointers.
+struct TokenRecord {
+    TokenEnum type;
+    pos_t pos;
+    StrRef str;
+    union {
+        IntLiteral int_literal;
+        char chr_literal;
+        StrRef str_literal;  // null terminated
+        uint32_t var_name;   // index of the name in the name section, from 1
+    } data;
+};
+
+const uint32_t record_sizes[SECTION_COUNT] = {
+    sizeof(TypeSpec), sizeof(Expr),        sizeof(Stmt), sizeof(Param),
+    sizeof(uint32_t), sizeof(TokenRecord), sizeof(StrRef), 1,
+};
+
+// Append the len bytes of str to the string section strings.
+// The reference to the copy is stored in dst.
+// Returns whether an error occurred.
+bool append_string(DynArr* strings, const char* str, size_t len, StrRef* dst) {
+    if (strings->length + len > UINT32_MAX) {
+        fsize_error();
+        return true;
+    }
+    if (dynarr_reserve(strings, strings->length + len)) return true;
+
+    // empty strings may have no pointer
+    if (len) memcpy((char*)strings->c_arr + strings->length, str, len);
+    *dst = (StrRef) { strings->length, len };
+    strings->length += len;
+    return false;
+}
+
+// Find the record of token, adding its strings and name to the sections strings and names.
+// names maps symbols to their indexes in the name section, 0 until added.
+// Returns whether an error occurred.
+bool token_record(
+    const Token* token, uint32_t* names, DynArr* name_refs, DynArr* strings, TokenRecord* dst
+) {
+    dst->type = token->type;
+    dst->pos = token->pos;
+    switch (token->type) {
+        case VAR_NAME:
+            // the string of a name is its null terminated copy in the name section
+            symbol_t symbol = token->data.var_name;
+            if (symbol == NO_SYMBOL || symbol > symbol_count()) return true;
+            if (names[symbol] == 0) {
+                StrView name = symbol_name(symbol);
+                StrRef ref;
+                if (append_string(strings, name.ptr, name.len + 1, &ref)) return true;
+                ref.len--;
+                if (dynarr_append(name_refs, &ref)) return true;
+                names[symbol] = name_refs->length;
+            }
+            dst->data.var_name = names[symbol];
+            dst->str = ((const StrRef*)name_refs->c_arr)[names[symbol] - 1];
+            return false;
+        case STR_LITERAL:
+            StrView literal = token->data.str_literal;
+            if (append_string(strings, literal.ptr, literal.len + 1, &dst->data.str_literal)) {
+                return true;
+            }
+            dst->data.str_literal.len--;
+            break;
+        case INT_LITERAL: dst->data.int_literal = token->data.int_literal; break;
+        case CHR_LITERAL: dst->data.chr_literal = token->data.chr_literal; break;
+
+        default: break;
+    }
+    return append_string(strings, token->str.ptr, token->str.len, &dst->str);
+}
+
+// Write count records of size to fp, padded to the alignment of the sections.
+// Returns whether an error occurred.
+bool write_section(FILE* fp, const void* records, size_t size, size_t count) {
+    const char padding[AST_FILE_ALIGN] = { 0 };
+    size_t bytes = size * count;
+    if (bytes && fwrite(records, size, count, fp) != count) return true;
+    size_t pad = -bytes % AST_FILE_ALIGN;
+    return pad && fwrite(padding, 1, pad, fp) != pad;
+}
+
+// Write ast to the file filename, which can be mapped back with load_ast.
+// Returns whether an error occurred.
+bool emit_ast(const AST* ast, const char* filename) {
+    if (ast == NULL) return true;
+
+    // zeroed so that padding bytes are the same in every file, like the padding and unused union
+    // members of the nodes in the other pools, which are written byte for byte
+    TokenRecord* records =
+        mem_calloc(ast->tokenc ? ast->tokenc : 1, sizeof(TokenRecord), ASTFILE_MEM);
+    uint32_t* names = mem_calloc(symbol_count() + 1, sizeof(uint32_t), ASTFILE_MEM);
+    if (records == NULL || names == NULL) {
+        malloc_error();
+        goto err_free_arrays;
+    }
+    DynArr name_refs = dynarr_create(sizeof(StrRef), ASTFILE_MEM);
+    DynArr strings = dynarr_create(1, ASTFILE_MEM);
+
+    for (size_t i = 0; i < ast->tokenc; i++) {
+        if (token_record(&ast->tokens[i], names, &name_refs, &strings, &records[i])) {
+            goto err_free_sections;
+        }
+    }
+
+    AstFileHeader header = { .version = AST_FILE_VERSION, .byte_order = AST_FILE_BYTE_ORDER };
+    memcpy(header.magic, AST_FILE_MAGIC, sizeof(header.magic));
+    memcpy(header.sizes, record_sizes, sizeof(header.sizes));
+    header.block = ast->block;
+
+    const void* sections[SECTION_COUNT] = {
+        ast->specs, ast->exprs, ast->stmts,      ast->params,
+        ast->lists, records,    name_refs.c_arr, strings.c_arr,
+    };
+    size_t counts[SECTION_COUNT] = {
+        ast->specc, ast->exprc, ast->stmtc,        ast->paramc,
+        ast->listc, ast->tokenc, name_refs.length, strings.length,
+    };
+    uint64_t offset = sizeof(AstFileHeader) + -sizeof(AstFileHeader) % AST_FILE_ALIGN;
+    for (size_t i = 0; i < SECTION_COUNT; i++) {
+        header.sections[i] = (AstSection) { offset, counts[i] };
+        offset += record_sizes[i] * counts[i];
+        offset += -offset % AST_FILE_ALIGN;
+    }
+
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fwrite_error();
+        goto err_free_sections;
+    }
+    bool failed = write_section(fp, &header, sizeof(AstFileHeader), 1);
+    for (size_t i = 0; i < SECTION_COUNT && !failed; i++) {
+        failed = write_section(fp, sections[i], record_sizes[i], counts[i]);
+    }
+    if (fclose(fp)) failed = true;
+    if (failed) {
+        fwrite_error();
+        goto err_free_sections;
+    }
+
+    dynarr_destroy(&strings);
+    dynarr_destroy(&name_refs);
+    mem_free(names);
+    mem_free(records);
+    return false;
+
+err_free_sections:
+    dynarr_destroy(&strings);
+    dynarr_destroy(&name_refs);
+err_free_arrays:
+    mem_free(names);
+    mem_free(records);
+    return true;
+}
+
+// Check whether the header of the AST file of length len is of this build, with its sections in
+// bounds.
+bool is_valid_header(const AstFileHeader* header, size_t len) {
+    if (memcmp(header->magic, AST_FILE_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != AST_FILE_VERSION) return false;
+    if (header->byte_order != AST_FILE_BYTE_ORDER) return false;
+    if (memcmp(header->sizes, record_sizes, sizeof(record_sizes)) != 0) return false;
+
+    for (size_t i = 0; i < SECTION_COUNT; i++) {
+        const AstSection* section = &header->sections[i];
+        if (section->offset % AST_FILE_ALIGN || section->offset > len) return false;
+        if (section->count > (len - section->offset) / record_sizes[i]) return false;
+        // pools are indexed by 32-bit indexes, and names by StrRef offsets
+        if (section->count >= NO_NODE) return false;
+    }
+    return header->block < header->sections[STMT_SECTION].count;
+}
+
+// Check whether ref is in the string section strings of length len, followed by a null
+// terminator if terminated.
+bool is_valid_ref(StrRef ref, const char* strings, size_t len, bool terminated) {
+    if (ref.offset > len || ref.len > len - ref.offset) return false;
+    return !terminated || (ref.len < len - ref.offset && strings[ref.offset + ref.len] == '\0');
+}
+
+// Find the token of record, relocating its strings into strings of length len and its name
+// through symbols of the namec names.
+// Returns whether the record is invalid.
+bool load_token(
+    const TokenRecord* record, const char* strings, size_t len, const symbol_t* symbols,
+    size_t namec, Token* dst
+) {
+    if (!is_valid_ref(record->str, strings, len, false)) return true;
+    dst->type = record->type;
+    dst->pos = record->pos;
+    dst->str = (StrView) { strings + record->str.offset, record->str.len };
+    switch (record->type) {
+        case VAR_NAME:
+            if (record->data.var_name == 0 || record->data.var_name > namec) return true;
+            dst->data.var_name = symbols[record->data.var_name - 1];
+            break;
+        case STR_LITERAL:
+            StrRef literal = record->data.str_literal;
+            if (!is_valid_ref(literal, strings, len, true)) return true;
+            dst->data.str_literal = (StrView) { strings + literal.offset, literal.len };
+            break;
+        case INT_LITERAL: dst->data.int_literal = record->data.int_literal; break;
+        case CHR_LITERAL: dst->data.chr_literal = record->data.chr_literal; break;
+
+        default: break;
+    }
+    return false;
+}
+
+// Map the AST file filename written by emit_ast.
+// The nodes are used in place, only tokens are copied to relocate their strings and names.
+// Nodes are trusted to refer to each other within their pools, as emit_ast writes them.
+// Result is not tagged.
+// Returns NULL if an error occurred.
+AST* load_ast(const char* filename) {
+    FileText file = map_file(filename, true);
+    if (file.text == NULL) return NULL;
+
+    const AstFileHeader* header = (const AstFileHeader*)file.text;
+    if (file.len < sizeof(AstFileHeader) || !is_valid_header(header, file.len)) {
+        fformat_error();
+        goto err_unmap;
+    }
+    const AstSection* sections = header->sections;
+    const char* strings = file.text + sections[STRING_SECTION].offset;
+    size_t len = sections[STRING_SECTION].count;
+
+    // every name is interned once, and its tokens take the symbol from here
+    size_t namec = sections[NAME_SECTION].count;
+    const StrRef* names = (const StrRef*)(file.text + sections[NAME_SECTION].offset);
+    symbol_t* symbols = mem_alloc(sizeof(symbol_t) * (namec ? namec : 1), ASTFILE_MEM);
+    if (symbols == NULL) {
+        malloc_error();
+        goto err_unmap;
+    }
+    for (size_t i = 0; i < namec; i++) {
+        if (!is_valid_ref(names[i], strings, len, true)) {
+            fformat_error();
+            goto err_free_symbols;
+        }
+        symbols[i] = intern(strings + names[i].offset, names[i].len);
+        if (symbols[i] == NO_SYMBOL) goto err_free_symbols;
+    }
+
+    size_t tokenc = sections[TOKEN_SECTION].count;
+    const TokenRecord* records = (const TokenRecord*)(file.text + sections[TOKEN_SECTION].offset);
+    Token* tokens = mem_alloc(sizeof(Token) * (tokenc ? tokenc : 1), AST_MEM);
+    if (tokens == NULL) {
+        malloc_error();
+        goto err_free_symbols;
+    }
+    for (size_t i = 0; i < tokenc; i++) {
+        if (load_token(&records[i], strings, len, symbols, namec, &tokens[i])) {
+            fformat_error();
+            goto err_free_tokens;
+        }
+    }
+
+    AST* ast = mem_alloc(sizeof(AST), AST_MEM);
+    if (ast == NULL) {
+        malloc_error();
+        goto err_free_tokens;
+    }
+    // the pools are read-only, like the AST is to every pass after parsing
+    ast->block = header->block;
+    ast->specs = (TypeSpec*)(file.text + sections[SPEC_SECTION].offset);
+    ast->exprs = (Expr*)(file.text + sections[EXPR_SECTION].offset);
+    ast->stmts = (Stmt*)(file.text + sections[STMT_SECTION].offset);
+    ast->tokens = tokens;
+    ast->params = (Param*)(file.text + sections[PARAM_SECTION].offset);
+    ast->lists = (uint32_t*)(file.text + sections[LIST_SECTION].offset);
+    ast->specc = sections[SPEC_SECTION].count;
+    ast->exprc = sections[EXPR_SECTION].count;
+    ast->stmtc = sections[STMT_SECTION].count;
+    ast->tokenc = tokenc;
+    ast->paramc = sections[PARAM_SECTION].count;
+    ast->listc = sections[LIST_SECTION].count;
+    ast->annotations = NULL;
+    ast->arena = arena_create(STRING_MEM);
+    ast->file = file;
+
+    mem_free(symbols);
+    return ast;
+
+err_free_tokens:
+    mem_free(tokens);
+err_free_symbols:
+    mem_free(symbols);
+err_unmap:
+    unmap_file(&file);
+    return NULL;
+}
@@ -0,0 +1,170 @@
+#include "interner.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "printerr.h"
+
+typedef struct InternEntry InternEntry;
+struct InternEntry {
+    const char* str;
+    uint32_t len;
+    uint32_t hash;
+    unsigned tag;
+};
+
+// the interner of the whole program
+Interner interner = {
+    { NULL, SYMBOL_MEM }, { NULL, sizeof(InternEntry), 0, 0, SYMBOL_MEM }, NULL, 0
+};
+
+// Find the 32-bit FNV-1a hash of str of length len.
+uint32_t hash_str(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Interner interner_create(void) {
+    return (Interner) {
+        .strings = arena_create(SYMBOL_MEM),
+        .entries = dynarr_create(sizeof(InternEntry), SYMBOL_MEM),
+        .slots = NULL,
+        .slot_mask = 0,
+    };
+}
+
+// Free all symbols of interner.
+// Previously returned symbols and names become invalid.
+void interner_destroy(Interner* interner) {
+    arena_destroy(&interner->strings);
+    dynarr_destroy(&interner->entries);
+    mem_free(interner->slots);
+    interner->slots = NULL;
+    interner->slot_mask = 0;
+}
+
+// Double the hash table size of interner and reinsert all symbols.
+// Returns whether an error occurred.
+bool grow_slots(Interner* interner) {
+    size_t count = interner->slot_mask ? (interner->slot_mask + 1) * 2 : 1024;
+    symbol_t* slots = mem_calloc(count, sizeof(symbol_t), SYMBOL_MEM);
+    if (slots == NULL) {
+        malloc_error();
+        return true;
+    }
+
+    InternEntry* entries = interner->entries.c_arr;
+    for (size_t i = 0; i < interner->entries.length; i++) {
+        size_t slot = entries[i].hash & (count - 1);
+        while (slots[slot] != NO_SYMBOL) slot = (slot + 1) & (count - 1);
+        slots[slot] = i + 1;
+    }
+
+    mem_free(interner->slots);
+    interner->slots = slots;
+    interner->slot_mask = count - 1;
+    return false;
+}
+
+// Find the slot of str of length len with the given hash in interner.
+// The slot is empty if str is not interned.
+size_t find_slot(const Interner* interner, const char* str, size_t len, uint32_t hash) {
+    const InternEntry* entries = interner->entries.c_arr;
+    size_t slot = hash & interner->slot_mask;
+    for (symbol_t symbol; (symbol = interner->slots[slot]) != NO_SYMBOL;) {
+        const InternEntry* entry = &entries[symbol - 1];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0) break;
+        slot = (slot + 1) & interner->slot_mask;
+    }
+    return slot;
+}
+
+// Find the symbol of str of length len in interner, adding it if it is new.
+// Returns NO_SYMBOL if an error occurred.
+symbol_t interner_intern(Interner* interner, const char* str, size_t len) {
+    // keep the load factor at most one half
+    if (interner->entries.length * 2 >= interner->slot_mask && grow_slots(interner)) {
+        return NO_SYMBOL;
+    }
+
+    uint32_t hash = hash_str(str, len);
+    size_t slot = find_slot(interner, str, len, hash);
+    if (interner->slots[slot] != NO_SYMBOL) return interner->slots[slot];
+
+    // new symbol, copied with a null terminator
+    char* copy = arena_alloc(&interner->strings, len + 1, 1);
+    if (copy == NULL) return NO_SYMBOL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    InternEntry entry = { copy, len, hash, 0 };
+    if (dynarr_append(&interner->entries, &entry)) return NO_SYMBOL;
+    interner->slots[slot] = interner->entries.length;
+    return interner->slots[slot];
+}
+
+// Find the symbol of str of length len in interner without adding it.
+// Never modifies interner, so concurrent lookups are safe.
+// Returns NO_SYMBOL if str is not interned.
+symbol_t interner_find(const Interner* interner, const char* str, size_t len) {
+    if (interner->slots == NULL) return NO_SYMBOL;
+    return interner->slots[find_slot(interner, str, len, hash_str(str, len))];
+}
+
+// Find the null terminated string of symbol in interner.
+StrView interner_name(const Interner* interner, symbol_t symbol) {
+    if (symbol == NO_SYMBOL || symbol > interner->entries.length) return (StrView) { NULL, 0 };
+    const InternEntry* entry = (const InternEntry*)interner->entries.c_arr + (symbol - 1);
+    return (StrView) { entry->str, entry->len };
+}
+
+// Get the number of symbols in interner.
+// Symbols are numbered from 1 up to and including this.
+size_t interner_count(const Interner* interner) {
+    return interner->entries.length;
+}
+
+// Find the symbol of str of length len, adding it if it is new.
+// Returns NO_SYMBOL if an error occurred.
+symbol_t intern(const char* str, size_t len) {
+    return interner_intern(&interner, str, len);
+}
+
+// Find the symbol of str of length len without adding it.
+// Returns NO_SYMBOL if str is not interned.
+symbol_t find_symbol(const char* str, size_t len) {
+    return interner_find(&interner, str, len);
+}
+
+// Find the null terminated string of symbol.
+StrView symbol_name(symbol_t symbol) {
+    return interner_name(&interner, symbol);
+}
+
+// Get the number of interned symbols.
+// Symbols are numbered from 1 up to and including this.
+size_t symbol_count(void) {
+    return interner_count(&interner);
+}
+
+// Get the tag set for symbol, 0 by default.
+unsigned symbol_tag(symbol_t symbol) {
+    InternEntry* entry = dynarr_get(&interner.entries, symbol - 1);
+    return entry ? entry->tag : 0;
+}
+
+// Attach tag to symbol, used to mark reserved words.
+void set_symbol_tag(symbol_t symbol, unsigned tag) {
+    InternEntry* entry = dynarr_get(&interner.entries, symbol - 1);
+    if (entry) entry->tag = tag;
+}
+
+// Free all symbols.
+// Previously returned symbols and names become invalid.
+void free_interner(void) {
+    interner_destroy(&interner);
+}
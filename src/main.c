@@ -1,53 +1,107 @@
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "astfile.h"
+#include "memutils.h"
 #include "parser.h"
 #include "printerr.h"
 #include "readfile.h"
 #include "tokenizer.h"
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
+    // smlc [--emit-ast output] [--load-ast] [--max-errors n] [--mem-stats] file
+    const char* filename = NULL;
+    const char* emit = NULL;
+    bool load = false;
+    bool mem_stats = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--emit-ast") == 0 && i + 1 < argc) {
+            emit = argv[++i];
+        } else if (strcmp(argv[i], "--load-ast") == 0) {
+            load = true;
+        } else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc) {
+            const char* count = argv[++i];
+            char* end;
+            errno = 0;
+            max_syntax_errors = strtoul(count, &end, 10);
+            // strtoul would skip leading spaces and negate after a minus sign
+            if (!isdigit((unsigned char)*count) || *end != '\0' || errno == ERANGE ||
+                max_syntax_errors == 0)
+            {
+                fprintf(stderr, "error: invalid number of errors\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--mem-stats") == 0) {
+            mem_stats = true;
+        } else if (filename == NULL) {
+            filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+    if (filename == NULL) {
         fprintf(stderr, "error: wrong number of command-line arguments\n");
         return EXIT_FAILURE;
     }
 
-    const char* filename = argv[1];
     error_filename = filename;
+    if (mem_stats) mem_stats_enable();
 
-    char* program = readfile(filename);
-    Token* tokens = tokenize(program, 4);
-    AST* ast = parse(tokens);
-    if (tokens == NULL) {
-        free(program);
-        free_token_arr(tokens);
-        free_ast_p(ast);
-        return EXIT_FAILURE;
+    FileText file = { NULL, 0, false };
+    AST* ast = NULL;
+    if (load) {
+        mem_phase(LOAD_PHASE);
+        ast = load_ast(filename);
+    } else {
+        // the program is mapped rather than copied, and tokens point into it
+        mem_phase(READ_PHASE);
+        file = map_file(filename, false);
+        if (file.text == NULL) goto err;
+
+        set_source_text(file.text, file.len, 4);
+        size_t threads = online_cpus();
+        // lexing errors are reported by parsing while lexing, in source order with syntax errors
+        mem_phase(TOKENIZE_PHASE);
+        errors_muted = true;
+        TokenStream* tokens = tokenize_parallel(file.text, file.len, threads);
+        errors_muted = false;
+        mem_phase(PARSE_PHASE);
+        if (tokens) {
+            // the AST owns its strings, so the tokens are not needed after parsing
+            ast = parse_parallel(tokens, threads);
+            free_token_stream(tokens);
+        } else {
+            Lexer lexer = lexer_create(file.text, file.len);
+            ast = parse_stream(&lexer);
+            lexer_destroy(&lexer);
+        }
     }
+    if (ast == NULL) goto err;
 
-    // for (Token* it = tokens; it->type != EOF_TOKEN; it++) {
-    //     printf("(%d)\t%s", it->type, it->str);
-    //     switch (it->type) {
-    //         case INT_LITERAL:
-    //             printf("\t%" PRIliteral "\n", it->data.int_literal);
-    //             break;
-    //         case CHR_LITERAL:
-    //             printf("\t%c\n", it->data.chr_literal);
-    //             break;
-    //         case STR_LITERAL:
-    //             printf("\t%s\n", it->data.str_literal);
-    //             break;
-    //         case VAR_NAME:
-    //             printf("\t%s\n", it->data.var_name);
-    //             break;
-    //         default:
-    //             printf("\n");
-    //             break;
-    //     }
-    // }
-
-    free(program);
-    free_token_arr(tokens);
+    if (emit) {
+        mem_phase(EMIT_PHASE);
+        error_filename = emit;
+        if (emit_ast(ast, emit)) goto err;
+    }
+
+    mem_phase(FREE_PHASE);
     free_ast_p(ast);
+    unmap_file(&file);
+    free_interner();
+    free_source();
+    if (mem_stats) print_mem_stats(stderr);
     return EXIT_SUCCESS;
+
+err:
+    mem_phase(FREE_PHASE);
+    free_ast_p(ast);
+    unmap_file(&file);
+    free_interner();
+    free_source();
+    if (mem_stats) print_mem_stats(stderr);
+    return EXIT_FAILURE;
 }
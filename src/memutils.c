@@ -1,26 +1,225 @@
 #include "memutils.h"
 
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "printerr.h"
 
-void* malloc_struct(void* elem, size_t size) {
-    void* ptr = malloc(size);
-    if (ptr == NULL) {
-        malloc_error();
-        return NULL;
+bool strview_eq(StrView a, StrView b) {
+    return a.len == b.len && memcmp(a.ptr, b.ptr, a.len) == 0;
+}
+
+typedef struct MemCounters MemCounters;
+typedef struct MemBlock MemBlock;
+
+// MemStats updated by any thread.
+struct MemCounters {
+    atomic_size_t allocs, bytes, live, peak;
+};
+
+// Allocation from mem_alloc, preceded by its size so that it can be freed without it.
+struct MemBlock {
+    size_t size;
+    MemTag tag;
+    bool counted;  // allocated while statistics were enabled
+    alignas(max_align_t) char data[];
+};
+
+atomic_bool mem_stats_enabled = false;
+atomic_int current_phase = START_PHASE;
+atomic_size_t live_bytes = 0;  // of every tag
+MemCounters tag_counters[MEM_TAG_COUNT];
+MemCounters phase_counters[MEM_PHASE_COUNT];
+
+const char* const mem_tag_names[MEM_TAG_COUNT] = {
+    [ARRAY_MEM] = "arrays",
+    [SOURCE_MEM] = "source",
+    [LEXER_MEM] = "lexer",
+    [TOKEN_MEM] = "tokens",
+    [STRING_MEM] = "strings",
+    [SYMBOL_MEM] = "symbols",
+    [AST_MEM] = "ast",
+    [TYPE_MEM] = "types",
+    [ANNOTATION_MEM] = "annotations",
+    [SCOPE_MEM] = "scopes",
+    [ASTFILE_MEM] = "ast file",
+};
+
+const char* const mem_phase_names[MEM_PHASE_COUNT] = {
+    [START_PHASE] = "start",
+    [READ_PHASE] = "read",
+    [TOKENIZE_PHASE] = "tokenize",
+    [PARSE_PHASE] = "parse",
+    [TYPECHECK_PHASE] = "typecheck",
+    [LOAD_PHASE] = "load",
+    [EMIT_PHASE] = "emit",
+    [FREE_PHASE] = "free",
+};
+
+// Count allocations made from now on.
+// Blocks allocated before are not counted when they are freed either.
+void mem_stats_enable(void) {
+    atomic_store(&mem_stats_enabled, true);
+}
+
+// Raise the peak of counters to live if it is higher.
+void raise_peak(MemCounters* counters, size_t live) {
+    size_t peak = atomic_load_explicit(&counters->peak, memory_order_relaxed);
+    while (peak < live) {
+        // peak is reloaded on failure
+        if (atomic_compare_exchange_weak_explicit(
+                &counters->peak, &peak, live, memory_order_relaxed, memory_order_relaxed
+            ))
+        {
+            return;
+        }
     }
-    memcpy(ptr, elem, size);
+}
+
+// Count an allocation of size bytes of tag, replacing old bytes of a block that was resized.
+void count_alloc(MemTag tag, size_t size, size_t old) {
+    MemCounters* by_tag = &tag_counters[tag];
+    int phase = atomic_load_explicit(&current_phase, memory_order_relaxed);
+    MemCounters* by_phase = &phase_counters[phase];
+
+    atomic_fetch_add_explicit(&by_tag->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&by_tag->bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&by_phase->allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&by_phase->bytes, size, memory_order_relaxed);
+
+    // live bytes wrap around while shrinking
+    size_t live = atomic_fetch_add_explicit(&by_tag->live, size - old, memory_order_relaxed);
+    raise_peak(by_tag, live + size - old);
+    live = atomic_fetch_add_explicit(&live_bytes, size - old, memory_order_relaxed);
+    raise_peak(by_phase, live + size - old);
+}
+
+// Count a block of size bytes of tag being freed.
+void count_free(MemTag tag, size_t size) {
+    atomic_fetch_sub_explicit(&tag_counters[tag].live, size, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&live_bytes, size, memory_order_relaxed);
+}
+
+// Enter phase, which the allocations made from now on are counted in.
+void mem_phase(MemPhase phase) {
+    size_t live = atomic_load(&live_bytes);
+    atomic_store(&phase_counters[atomic_load(&current_phase)].live, live);
+    atomic_store(&current_phase, phase);
+    atomic_store(&phase_counters[phase].live, live);
+    raise_peak(&phase_counters[phase], live);
+}
+
+// Read counters into MemStats.
+MemStats load_stats(MemCounters* counters) {
+    return (MemStats) {
+        .allocs = atomic_load(&counters->allocs),
+        .bytes = atomic_load(&counters->bytes),
+        .live = atomic_load(&counters->live),
+        .peak = atomic_load(&counters->peak),
+    };
+}
+
+MemStats mem_tag_stats(MemTag tag) {
+    return load_stats(&tag_counters[tag]);
+}
+
+// Live bytes are those of the current phase so far, or when it was left.
+MemStats mem_phase_stats(MemPhase phase) {
+    if (phase == (MemPhase)atomic_load(&current_phase)) {
+        atomic_store(&phase_counters[phase].live, atomic_load(&live_bytes));
+    }
+    return load_stats(&phase_counters[phase]);
+}
+
+// Write a table of the statistics of every phase and tag with allocations to fp.
+void print_mem_stats(FILE* fp) {
+    fprintf(fp, "%-12s %12s %14s %14s %14s\n", "phase", "allocs", "bytes", "live", "peak");
+    for (size_t i = 0; i < MEM_PHASE_COUNT; i++) {
+        MemStats stats = mem_phase_stats(i);
+        if (stats.peak == 0 && stats.allocs == 0) continue;
+        fprintf(
+            fp, "%-12s %12zu %14zu %14zu %14zu\n", mem_phase_names[i], stats.allocs, stats.bytes,
+            stats.live, stats.peak
+        );
+    }
+
+    fprintf(fp, "\n%-12s %12s %14s %14s %14s\n", "tag", "allocs", "bytes", "live", "peak");
+    for (size_t i = 0; i < MEM_TAG_COUNT; i++) {
+        MemStats stats = mem_tag_stats(i);
+        if (stats.allocs == 0) continue;
+        fprintf(
+            fp, "%-12s %12zu %14zu %14zu %14zu\n", mem_tag_names[i], stats.allocs, stats.bytes,
+            stats.live, stats.peak
+        );
+    }
+}
+
+// Allocate size bytes for tag.
+// Returns NULL if an error occurred, which is not reported.
+void* mem_alloc(size_t size, MemTag tag) {
+    if (size > SIZE_MAX - sizeof(MemBlock)) return NULL;
+    MemBlock* block = malloc(sizeof(MemBlock) + size);
+    if (block == NULL) return NULL;
+
+    block->size = size;
+    block->tag = tag;
+    block->counted = atomic_load_explicit(&mem_stats_enabled, memory_order_relaxed);
+    if (block->counted) count_alloc(tag, size, 0);
+    return block->data;
+}
+
+// Allocate count zeroed items of size bytes for tag.
+// Returns NULL if an error occurred, which is not reported.
+void* mem_calloc(size_t count, size_t size, MemTag tag) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void* ptr = mem_alloc(count * size, tag);
+    if (ptr) memset(ptr, 0, count * size);
     return ptr;
 }
 
-DynArr dynarr_create(size_t elem_size) {
-    return (DynArr) { .c_arr = NULL, .elem_size = elem_size, .length = 0, .capacity = 0 };
+// Resize the block at ptr from mem_alloc, or allocate one if it is NULL, to size bytes for tag.
+// Returns NULL if an error occurred, which is not reported, and the block is left unchanged.
+void* mem_realloc(void* ptr, size_t size, MemTag tag) {
+    if (ptr == NULL) return mem_alloc(size, tag);
+    if (size > SIZE_MAX - sizeof(MemBlock)) return NULL;
+
+    MemBlock* block = (MemBlock*)((char*)ptr - offsetof(MemBlock, data));
+    size_t old = block->size;
+    MemTag old_tag = block->tag;
+    bool counted = block->counted;
+    block = realloc(block, sizeof(MemBlock) + size);
+    if (block == NULL) return NULL;
+
+    block->size = size;
+    block->tag = tag;
+    if (counted && old_tag != tag) {
+        count_free(old_tag, old);
+        old = 0;
+    }
+    if (counted) count_alloc(tag, size, old);
+    return block->data;
+}
+
+// Free the block at ptr from mem_alloc, if it is not NULL.
+void mem_free(void* ptr) {
+    if (ptr == NULL) return;
+
+    MemBlock* block = (MemBlock*)((char*)ptr - offsetof(MemBlock, data));
+    if (block->counted) count_free(block->tag, block->size);
+    free(block);
+}
+
+DynArr dynarr_create(size_t elem_size, MemTag tag) {
+    return (DynArr) {
+        .c_arr = NULL, .elem_size = elem_size, .length = 0, .capacity = 0, .tag = tag
+    };
 }
 
 void dynarr_destroy(DynArr* arr) {
-    free(arr->c_arr);
+    mem_free(arr->c_arr);
     arr->c_arr = NULL;
     arr->length = 0;
     arr->capacity = 0;
@@ -30,20 +229,95 @@ void* dynarr_get(DynArr* arr, size_t i) {
     return i < arr->length ? (char*)arr->c_arr + i * arr->elem_size : NULL;
 }
 
-bool dynarr_append(DynArr* arr, void* elem) {
-    if (arr->length >= arr->capacity) {
-        size_t cap = arr->capacity ? arr->capacity * 2 : 1;
+bool dynarr_reserve(DynArr* arr, size_t capacity) {
+    if (capacity <= arr->capacity) return false;
 
-        void* new = realloc(arr->c_arr, cap * arr->elem_size);
-        if (new == NULL) {
-            malloc_error();
-            return true;
-        }
+    size_t cap = arr->capacity ? arr->capacity * 2 : 1;
+    if (cap < capacity) cap = capacity;
 
-        arr->capacity = cap;
-        arr->c_arr = new;
+    void* new = mem_realloc(arr->c_arr, cap * arr->elem_size, arr->tag);
+    if (new == NULL) {
+        malloc_error();
+        return true;
     }
 
+    arr->capacity = cap;
+    arr->c_arr = new;
+    return false;
+}
+
+bool dynarr_append(DynArr* arr, const void* elem) {
+    if (dynarr_reserve(arr, arr->length + 1)) return true;
+
     memcpy((char*)arr->c_arr + arr->length++ * arr->elem_size, elem, arr->elem_size);
     return false;
 }
+
+// size of the first arena chunk, later chunks double in size so large arenas stay few chunks
+#define ARENA_CHUNK_SIZE 65536
+
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t used, size;
+    char data[];
+};
+
+Arena arena_create(MemTag tag) {
+    return (Arena) { .chunks = NULL, .tag = tag };
+}
+
+void arena_destroy(Arena* arena) {
+    while (arena->chunks) {
+        ArenaChunk* next = arena->chunks->next;
+        mem_free(arena->chunks);
+        arena->chunks = next;
+    }
+}
+
+void* arena_alloc(Arena* arena, size_t size, size_t align) {
+    ArenaChunk* chunk = arena->chunks;
+    size_t pad = chunk ? -(uintptr_t)(chunk->data + chunk->used) & (align - 1) : 0;
+
+    if (chunk == NULL || chunk->size - chunk->used < pad + size) {
+        size_t chunk_size = chunk ? chunk->size * 2 : ARENA_CHUNK_SIZE;
+        if (chunk_size < size + align) chunk_size = size + align;
+        chunk = mem_alloc(sizeof(ArenaChunk) + chunk_size, arena->tag);
+        if (chunk == NULL) {
+            malloc_error();
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        arena->chunks = chunk;
+        pad = -(uintptr_t)chunk->data & (align - 1);
+    }
+
+    void* ptr = chunk->data + chunk->used + pad;
+    chunk->used += pad + size;
+    return ptr;
+}
+
+void* arena_dup(Arena* arena, const void* src, size_t size, size_t align) {
+    void* ptr = arena_alloc(arena, size, align);
+    if (ptr && size) memcpy(ptr, src, size);
+    return ptr;
+}
+
+// Move the allocations of src to dst, which frees them with its own, and leave src empty.
+void arena_merge(Arena* dst, Arena* src) {
+    if (src->chunks == NULL) return;
+    if (dst->chunks == NULL) {
+        // the chunks keep their tag, dst keeps its own for new chunks
+        dst->chunks = src->chunks;
+        src->chunks = NULL;
+        return;
+    }
+
+    // dst keeps allocating from its newest chunk
+    ArenaChunk* last = src->chunks;
+    while (last->next) last = last->next;
+    last->next = dst->chunks->next;
+    dst->chunks->next = src->chunks;
+    src->chunks = NULL;
+}
@@ -1,36 +1,237 @@
 #include "parser_common.h"
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "printerr.h"
 
+#ifndef PARSE_MIN_CHUNK
+// fewest tokens worth parsing on their own thread
+#define PARSE_MIN_CHUNK 65536
+#endif
+
+size_t max_syntax_errors = 20;
+// pools of the AST being parsed on this thread
+_Thread_local NodePools* node_pools = NULL;
+// position of the last unexpected token reported, reset with syntax_errors
+_Thread_local pos_t unexpected_pos = UINT32_MAX;
+
+SMALLVEC_DEFINE(NodeVec, node_vec, uint32_t, 8)
+SMALLVEC_DEFINE(ParamVec, param_vec, Param, 4)
+
+// Add a zeroed node to pool, to be built in place.
+// Returns a pointer to the node that is only valid until the next one is added, or NULL if an
+// error occurred. The index of the node is stored in dst.
+void* place_node(DynArr* pool, uint32_t* dst) {
+    // indexes are 32-bit
+    if (pool->length >= NO_NODE) {
+        malloc_error();
+        return NULL;
+    }
+    if (pool->length == pool->capacity && dynarr_reserve(pool, pool->length + 1)) return NULL;
+
+    // padding and unused union members are written to AST files, so they must not be left over
+    *dst = pool->length++;
+    void* node = (char*)pool->c_arr + *dst * pool->elem_size;
+    memset(node, 0, pool->elem_size);
+    return node;
+}
+
+// Append the len nodes at nodes to pool.
+// Returns the index of the first node, or NO_NODE if an error occurred.
+uint32_t push_nodes(DynArr* pool, const void* nodes, size_t len) {
+    if (pool->length + len >= NO_NODE) {
+        malloc_error();
+        return NO_NODE;
+    }
+    if (dynarr_reserve(pool, pool->length + len)) return NO_NODE;
+
+    uint32_t first = pool->length;
+    if (len) memcpy((char*)pool->c_arr + first * pool->elem_size, nodes, len * pool->elem_size);
+    pool->length += len;
+    return first;
+}
+
+// Add a zeroed spec to the AST being parsed, see place_node.
+TypeSpec* place_spec(spec_t* dst) {
+    return place_node(&node_pools->specs, dst);
+}
+
+// Add a zeroed expr to the AST being parsed, see place_node.
+Expr* place_expr(expr_t* dst) {
+    return place_node(&node_pools->exprs, dst);
+}
+
+// Add a zeroed stmt to the AST being parsed, see place_node.
+Stmt* place_stmt(stmt_t* dst) {
+    return place_node(&node_pools->stmts, dst);
+}
+
+// Add spec to the AST being parsed, byte for byte so that its padding stays defined if it was
+// zero initialized.
+// Returns NO_NODE if an error occurred.
+spec_t new_spec(const TypeSpec* spec) {
+    spec_t id;
+    TypeSpec* node = place_spec(&id);
+    if (node == NULL) return NO_NODE;
+    memcpy(node, spec, sizeof(TypeSpec));
+    return id;
+}
+
+// Add expr to the AST being parsed, byte for byte so that its padding stays defined if it was
+// zero initialized.
+// Returns NO_NODE if an error occurred.
+expr_t new_expr(const Expr* expr) {
+    expr_t id;
+    Expr* node = place_expr(&id);
+    if (node == NULL) return NO_NODE;
+    memcpy(node, expr, sizeof(Expr));
+    return id;
+}
+
+// Add stmt to the AST being parsed, byte for byte so that its padding stays defined if it was
+// zero initialized.
+// Returns NO_NODE if an error occurred.
+stmt_t new_stmt(const Stmt* stmt) {
+    stmt_t id;
+    Stmt* node = place_stmt(&id);
+    if (node == NULL) return NO_NODE;
+    memcpy(node, stmt, sizeof(Stmt));
+    return id;
+}
+
+// Point the strings of the literal token to copies in the AST being parsed, so that they outlive
+// the token stream or lexer that decoded them.
+// Returns whether an error occurred.
+bool own_token_strings(Token* token) {
+    Arena* strings = &node_pools->strings;
+    switch (token->type) {
+        case STR_LITERAL:
+            StrView literal = token->data.str_literal;
+            token->data.str_literal.ptr = arena_dup(strings, literal.ptr, literal.len + 1, 1);
+            if (token->data.str_literal.ptr == NULL) return true;
+            // fallthrough
+        case INT_LITERAL:
+        case CHR_LITERAL:
+            // a lexer reading a file keeps the strings of literals in its own storage
+            token->str.ptr = arena_dup(strings, token->str.ptr, token->str.len, 1);
+            return token->str.ptr == NULL;
+
+        default: return false;
+    }
+}
+
+// Add token to the AST being parsed, with copies of the strings of literals.
+// Returns NO_NODE if an error occurred.
+token_t new_token(const Token* token) {
+    token_t id;
+    Token* node = place_node(&node_pools->tokens, &id);
+    if (node == NULL) return NO_NODE;
+    *node = *token;
+    if (own_token_strings(node)) return NO_NODE;
+    return id;
+}
+
+// Consume the next token of lexer into the AST being parsed, with copies of the strings of
+// literals.
+// Returns NO_NODE if an error occurred.
+token_t new_next_token(Lexer* lexer) {
+    token_t id;
+    Token* node = place_node(&node_pools->tokens, &id);
+    if (node == NULL) return NO_NODE;
+    *node = next_token(lexer);
+    if (own_token_strings(node)) return NO_NODE;
+    return id;
+}
+
+// Consume the next token of lexer into the AST being parsed like new_next_token, if it is of type.
+// Returns NO_NODE if it is not or an error occurred.
+token_t new_expected_token(Lexer* lexer, TokenEnum type) {
+    if (peek_type(lexer, 0) != type) {
+        unexpected_token(*peek(lexer, 0));
+        return NO_NODE;
+    }
+    return new_next_token(lexer);
+}
+
+// Move params to the AST being parsed, and free the vector.
+// Returns NO_NODE if an error occurred.
+param_t new_params(ParamVec* params) {
+    param_t first = push_nodes(&node_pools->params, param_vec_elems(params), params->length);
+    param_vec_destroy(params);
+    return first;
+}
+
+// Move the node indexes in nodes to the AST being parsed, and free the vector.
+// Returns NO_NODE if an error occurred.
+list_t new_list(NodeVec* nodes) {
+    list_t first = push_nodes(&node_pools->lists, node_vec_elems(nodes), nodes->length);
+    node_vec_destroy(nodes);
+    return first;
+}
+
+// Look spec up in the AST being parsed.
+// The pointer is only valid until the next node is added.
+TypeSpec* get_spec(spec_t spec) {
+    return dynarr_get(&node_pools->specs, spec);
+}
+
+// Look expr up in the AST being parsed.
+// The pointer is only valid until the next node is added.
+Expr* get_expr(expr_t expr) {
+    return dynarr_get(&node_pools->exprs, expr);
+}
+
+// Look stmt up in the AST being parsed.
+// The pointer is only valid until the next node is added.
+Stmt* get_stmt(stmt_t stmt) {
+    return dynarr_get(&node_pools->stmts, stmt);
+}
+
+// Look token up in the AST being parsed.
+// The pointer is only valid until the next token is added.
+Token* get_token(token_t token) {
+    return dynarr_get(&node_pools->tokens, token);
+}
+
 // Write error message to stderr.
 void unexpected_token(Token token) {
-    error_line = token.line;
-    error_col = token.col;
+    // already reported if a block recovering from an error ended at it and its parent failed on it
+    if (syntax_errors && unexpected_pos == token.pos) {
+        syntax_errors++;
+        return;
+    }
+    unexpected_pos = token.pos;
+    error_pos = token.pos;
     switch (token.type) {
-        case ERROR_TOKEN: syntax_error("unexpected error\n"); return;
+        case ERROR_TOKEN: return;  // already reported by the lexer
         case EOF_TOKEN:   syntax_error("unexpected end of file\n"); return;
         case CHR_LITERAL:
-        case STR_LITERAL: syntax_error("unexpected token %s\n", token.str); return;
-        default:          syntax_error("unexpected token '%s'\n", token.str); return;
+        case STR_LITERAL:
+            syntax_error("unexpected token %" PRIstrview "\n", STRVIEW_ARG(token.str));
+            return;
+        default:
+            syntax_error("unexpected token '%" PRIstrview "'\n", STRVIEW_ARG(token.str));
+            return;
     }
 }
 
-bool consume_expected_token(const Token** it, TokenEnum type) {
-    if ((*it)->type != type) {
-        unexpected_token(**it);
+bool consume_expected_token(Lexer* lexer, TokenEnum type) {
+    if (peek_type(lexer, 0) != type) {
+        unexpected_token(*peek(lexer, 0));
         return true;
     }
 
-    (*it)++;
+    next_token(lexer);
     return false;
 }
 
 // Checks the next token to see if it could be an expression.
-// Preserves the it position.
-bool is_expr(const Token* const* it) {
-    switch ((*it)->type) {
+// Preserves the lexer position.
+bool is_expr(Lexer* lexer) {
+    switch (peek_type(lexer, 0)) {
         case INT_LITERAL:
         case CHR_LITERAL:
         case STR_LITERAL:
@@ -51,9 +252,9 @@ bool is_expr(const Token* const* it) {
 }
 
 // Checks the next token to see if it could be a statement.
-// Preserves the it position.
-bool is_statement(const Token* const* it) {
-    switch ((*it)->type) {
+// Preserves the lexer position.
+bool is_statement(Lexer* lexer) {
+    switch (peek_type(lexer, 0)) {
         case SEMICOLON:
         case VAR_TOKEN:
         case CONST_TOKEN:
@@ -70,353 +271,681 @@ bool is_statement(const Token* const* it) {
         case BREAK_TOKEN:
         case CONTINUE_TOKEN: return true;
 
-        default: return is_expr(it);
+        default: return is_expr(lexer);
     }
 }
 
-// Looks ahead and checks whether the token after the
-// matching closing parenthesis is a double arrow.
-// Preserves the it position.
-bool is_lambda(const Token* const* it) {
-    const Token* i = *it;
+// Checks whether a token of type ends a block whose statements begin after depth open brackets.
+// Only switch branches end before a label, and they are in braces.
+bool ends_block(TokenEnum type, size_t depth) {
+    switch (type) {
+        case EOF_TOKEN:
+        case ERROR_TOKEN:
+        case RBRACE:        return true;
+        case CASE_TOKEN:
+        case DEFAULT_TOKEN: return depth > 0;
 
-    if (i->type != LPAREN) return false;
-    i++;
-    size_t level = 1;
+        default: return false;
+    }
+}
 
-    while (level > 0) {
-        switch (i->type) {
-            case EOF_TOKEN: return false;
-            case LPAREN:    level++; break;
-            case RPAREN:    level--; break;
-            default:        break;
+// Skip the rest of a statement that failed to parse in a block whose statements begin after depth
+// open brackets, up to where the next statement can begin: after a semicolon or before a keyword
+// that begins a statement or a token that ends the block.
+// Tokens in the brackets opened by the statement are skipped, except in brackets that are never
+// closed.
+void synchronize(Lexer* lexer, size_t depth) {
+    settle_depth(lexer);
+    for (;;) {
+        TokenEnum type = peek_type(lexer, 0);
+        if (type == EOF_TOKEN || type == ERROR_TOKEN) return;
+        if (lexer->depth <= depth) {
+            switch (type) {
+                case SEMICOLON: next_token(lexer); return;
+
+                case VAR_TOKEN:
+                case CONST_TOKEN:
+                case TYPE_TOKEN:
+                case IF_TOKEN:
+                case SWITCH_TOKEN:
+                case WHILE_TOKEN:
+                case DO_TOKEN:
+                case FOR_TOKEN:
+                case FN_TOKEN:
+                case STRUCT_TOKEN:
+                case ENUM_TOKEN:
+                case RETURN_TOKEN:
+                case BREAK_TOKEN:
+                case CONTINUE_TOKEN: return;
+
+                default: if (ends_block(type, depth)) return;
+            }
         }
-        i++;
+
+        // opening brackets are looked up for their closing one before they count, and so is the
+        // bracket left innermost by a closing one
+        size_t open = lexer->depth;
+        peek_match(lexer, 0);
+        next_token(lexer);
+        if (lexer->depth < open) settle_depth(lexer);
     }
+}
 
-    return i->type == DARROW;
+// Checks whether the token after the matching closing parenthesis is a double arrow.
+// Preserves the lexer position.
+bool is_lambda(Lexer* lexer) {
+    if (peek_type(lexer, 0) != LPAREN) return false;
+    size_t match = peek_match(lexer, 0);
+    return match && peek_type(lexer, match + 1) == DARROW;
 }
 
 // Parse parameter list without surrounding parentheses.
 // Results are stored in dst parameters unless they are NULL.
 // Returns whether an error occurred.
-bool parse_params(
-    const Token** it, size_t* len_dst, size_t* opt_dst, Token** names_dst, TypeSpec** types_dst,
-    Expr** defs_dst
-) {
+bool parse_params(Lexer* lexer, uint32_t* len_dst, uint32_t* opt_dst, param_t* params_dst) {
     // x: a, y = 1
 
-    TypeSpec spec;
-    Expr def;
+    ParamVec vec = param_vec_create();
 
-    DynArr name_array = dynarr_create(sizeof(Token));
-    DynArr type_array = dynarr_create(sizeof(TypeSpec));
-    DynArr def_array = dynarr_create(sizeof(Expr));
-
-    size_t optional = 0;
-    if ((*it)->type == VAR_NAME) {
+    uint32_t optional = 0;
+    if (peek_type(lexer, 0) == VAR_NAME) {
         for (;;) {
             // next parameter name
-            Token name = **it;
-            if (consume_expected_token(it, VAR_NAME)) goto err_free_arrs;
+            Token name = *peek(lexer, 0);
+            if (consume_expected_token(lexer, VAR_NAME)) goto err_free_vec;
+
+            Param param;
+            param.name = new_token(&name);
+            if (param.name == NO_NODE) goto err_free_vec;
 
             // optional parameter type specifier
-            spec = (TypeSpec) { .type = INFERRED_SPEC, .line = name.line, .col = name.col };
-            if ((*it)->type == COLON) {
-                (*it)++;
+            if (peek_type(lexer, 0) == COLON) {
+                next_token(lexer);
 
-                spec = parse_type_spec(it);
-                if (spec.type == ERROR_SPEC) goto err_free_arrs;
+                param.type = parse_type_spec(lexer);
+            } else {
+                param.type = new_spec(&(TypeSpec) { .type = INFERRED_SPEC, .pos = name.pos });
             }
+            if (param.type == NO_NODE) goto err_free_vec;
 
             // optional default parameter
-            def = (Expr) { .type = NO_EXPR, .line = name.line, .col = name.col };
-            if ((*it)->type == EQ_TOKEN) {
-                (*it)++;
-
-                def = parse_expr(it, MAX_PRECEDENCE);
-                if (def.type == ERROR_EXPR) goto err_free_spec;
+            if (peek_type(lexer, 0) == EQ_TOKEN) {
+                next_token(lexer);
 
+                param.def = parse_expr(lexer, MAX_PRECEDENCE);
                 optional++;
             } else if (optional) {
-                error_line = name.line;
-                error_col = name.col;
+                error_pos = name.pos;
                 syntax_error("non-optional parameter after optional parameter\n");
-                goto err_free_spec;
+                goto err_free_vec;
+            } else {
+                param.def = new_expr(&(Expr) { .type = NO_EXPR, .pos = name.pos });
             }
+            if (param.def == NO_NODE) goto err_free_vec;
 
-            // push to arrays
-            if (dynarr_append(&name_array, &name) || dynarr_append(&type_array, &spec) ||
-                dynarr_append(&def_array, &def))
-            {
-                goto err_free_def;
-            }
+            // push to vector
+            if (param_vec_append(&vec, param)) goto err_free_vec;
 
             // comma or end of list
-            if ((*it)->type == COMMA) (*it)++;
+            if (peek_type(lexer, 0) == COMMA) next_token(lexer);
             else break;
         }
     }
 
-    if (len_dst) *len_dst = name_array.length;
+    if (len_dst) *len_dst = vec.length;
     if (opt_dst) *opt_dst = optional;
-    if (names_dst) *names_dst = name_array.c_arr;
-    if (types_dst) *types_dst = type_array.c_arr;
-    if (defs_dst) *defs_dst = def_array.c_arr;
+
+    // allocations
+    param_t params = new_params(&vec);
+    if (params == NO_NODE) return true;
+    if (params_dst) *params_dst = params;
 
     return false;
-err_free_def:
-    free_expr(def);
-err_free_spec:
-    free_spec(spec);
-err_free_arrs:
-    dynarr_destroy(&name_array);
-    free_spec_dynarr(&type_array);
-    free_expr_dynarr(&def_array);
+err_free_vec:
+    param_vec_destroy(&vec);
     return true;
 }
 
 // Parse argument list without surrounding parentheses.
 // Results are stored in dst parameters unless they are NULL.
 // Returns whether an error occurred.
-bool parse_args(const Token** it, size_t* len_dst, Expr** vals_dst) {
+bool parse_args(Lexer* lexer, uint32_t* len_dst, list_t* vals_dst) {
     // x, y, z
 
-    Expr item;
-
-    DynArr array = dynarr_create(sizeof(Expr));
-    if (is_expr(it)) {
+    NodeVec vec = node_vec_create();
+    if (is_expr(lexer)) {
         for (;;) {
             // next argument
-            item = parse_expr(it, MAX_PRECEDENCE);
-            if (item.type == ERROR_EXPR) goto err_free_arr;
+            expr_t item = parse_expr(lexer, MAX_PRECEDENCE);
+            if (item == NO_NODE) goto err_free_vec;
 
-            if (dynarr_append(&array, &item)) goto err_free_item;
+            if (node_vec_append(&vec, item)) goto err_free_vec;
 
             // comma or end of list
-            if ((*it)->type == COMMA) (*it)++;
+            if (peek_type(lexer, 0) == COMMA) next_token(lexer);
             else break;
         }
     }
 
-    if (len_dst) *len_dst = array.length;
-    if (vals_dst) *vals_dst = array.c_arr;
+    if (len_dst) *len_dst = vec.length;
+
+    // allocations
+    list_t vals = new_list(&vec);
+    if (vals == NO_NODE) return true;
+    if (vals_dst) *vals_dst = vals;
 
     return false;
-err_free_item:
-    free_expr(item);
-err_free_arr:
-    free_expr_dynarr(&array);
+err_free_vec:
+    node_vec_destroy(&vec);
     return true;
 }
 
-// Parse EOF_TOKEN terminated token array.
+// Free the nodes in pools.
+void free_node_pools(NodePools* pools) {
+    dynarr_destroy(&pools->specs);
+    dynarr_destroy(&pools->exprs);
+    dynarr_destroy(&pools->stmts);
+    dynarr_destroy(&pools->tokens);
+    dynarr_destroy(&pools->params);
+    dynarr_destroy(&pools->lists);
+    arena_destroy(&pools->strings);
+}
+
+// Create pools for the nodes of an AST.
+NodePools node_pools_create(void) {
+    return (NodePools) {
+        .specs = dynarr_create(sizeof(TypeSpec), AST_MEM),
+        .exprs = dynarr_create(sizeof(Expr), AST_MEM),
+        .stmts = dynarr_create(sizeof(Stmt), AST_MEM),
+        .tokens = dynarr_create(sizeof(Token), AST_MEM),
+        .params = dynarr_create(sizeof(Param), AST_MEM),
+        .lists = dynarr_create(sizeof(uint32_t), AST_MEM),
+        .strings = arena_create(STRING_MEM),
+    };
+}
+
+// Move the nodes in pools to a new AST with the root BLOCK block.
+// Pools are not freed on failure.
+// Returns NULL if an error occurred.
+AST* ast_from_pools(NodePools* pools, stmt_t block) {
+    AST* ast = mem_alloc(sizeof(AST), AST_MEM);
+    if (ast == NULL) {
+        malloc_error();
+        return NULL;
+    }
+    ast->block = block;
+    ast->specs = pools->specs.c_arr;
+    ast->exprs = pools->exprs.c_arr;
+    ast->stmts = pools->stmts.c_arr;
+    ast->tokens = pools->tokens.c_arr;
+    ast->params = pools->params.c_arr;
+    ast->lists = pools->lists.c_arr;
+    ast->specc = pools->specs.length;
+    ast->exprc = pools->exprs.length;
+    ast->stmtc = pools->stmts.length;
+    ast->tokenc = pools->tokens.length;
+    ast->paramc = pools->params.length;
+    ast->listc = pools->lists.length;
+    ast->annotations = NULL;
+    ast->arena = pools->strings;
+    ast->file = (FileText) { NULL, 0, false };
+    return ast;
+}
+
+// Parse tokens from lexer until EOF_TOKEN.
+// Nodes are added to pools that are moved into the result, and discarded on failure.
 // Result is not tagged.
 // Returns NULL if an error occurred.
-AST* parse(const Token* program) {
-    if (program == NULL) goto err;
+AST* parse_stream(Lexer* lexer) {
+    NodePools pools = node_pools_create();
+    node_pools = &pools;
+    syntax_errors = 0;
+    unexpected_pos = UINT32_MAX;
 
-    const Token** it = &program;
-    Stmt stmt = parse_block(it);
-    if (stmt.type == ERROR_STMT) goto err;
+    stmt_t block = parse_block(lexer);
+    if (block == NO_NODE) goto err;
 
-    if (consume_expected_token(it, EOF_TOKEN)) goto err_free_stmt;
+    if (consume_expected_token(lexer, EOF_TOKEN)) goto err;
+    // the block parsed past the syntax errors it recovered from
+    if (syntax_errors) goto err;
 
-    Stmt* ast = malloc_struct(&stmt, sizeof(Stmt));
-    if (ast == NULL) goto err_free_stmt;
+    AST* ast = ast_from_pools(&pools, block);
+    if (ast == NULL) goto err;
 
+    node_pools = NULL;
     return ast;
-err_free_stmt:
-    free_stmt(stmt);
 err:
+    // the parser may have stopped before reaching the lexing error that ends the tokens
+    report_lexer_errors(lexer);
+    node_pools = NULL;
+    free_node_pools(&pools);
     return NULL;
 }
 
-// Free all data inside type specifier.
-void free_spec(TypeSpec spec) {
-    switch (spec.type) {
-        case ERROR_SPEC:    break;
-        case INFERRED_SPEC: break;
+// Parse token stream.
+// Result is not tagged.
+// Returns NULL if an error occurred.
+AST* parse(const TokenStream* program) {
+    if (program == NULL) return NULL;
 
-        case GROUPED_SPEC:
-            free_spec(*spec.data.group);
-            free(spec.data.group);
-            break;
-        case ATOMIC_SPEC: break;
-        case ARR_SPEC:
-        case PTR_SPEC:
-            free_spec(*spec.data.ptr.spec);
-            free(spec.data.ptr.spec);
-            break;
-        case FUN_SPEC:
-            free_spec_arrn(spec.data.fun.paramt, spec.data.fun.paramc);
-            free_spec(*spec.data.fun.ret);
-            free(spec.data.fun.ret);
-            break;
+    Lexer lexer = lexer_from_stream(program);
+    AST* ast = parse_stream(&lexer);
+    lexer_destroy(&lexer);
+    return ast;
+}
+
+typedef struct ParseChunk ParseChunk;
+
+// Top-level items of a program parsed on their own thread by parse_parallel.
+struct ParseChunk {
+    pthread_t thread;
+    bool joinable;
+    bool failed;
+
+    const TokenStream* stream;
+    size_t begin, end;  // indexes of the first token and the token after the last item
+    size_t payload_pos;  // index of the payload of the first token with one
+    NodePools pools;
+    NodeVec items;  // top-level statements
+
+    // place of the chunk in the stitched pools
+    NodePools* dst;
+    NodeBases bases;
+};
+
+// Check whether a token of type starts a declaration that can be a top-level item.
+bool starts_item(TokenEnum type) {
+    switch (type) {
+        case VAR_TOKEN:
+        case CONST_TOKEN:
+        case TYPE_TOKEN:
+        case FN_TOKEN:
+        case STRUCT_TOKEN:
+        case ENUM_TOKEN:   return true;
+
+        default: return false;
     }
 }
 
-// Free type specifier array of length n all all data inside it.
-void free_spec_arrn(TypeSpec* arr, size_t n) {
-    for (size_t i = 0; i < n; i++) free_spec(arr[i]);
-    free(arr);
+// Parse the items of a chunk, with errors reported later by parsing sequentially.
+// The chunk fails unless its items end exactly at its end, where the next chunk begins.
+void* parse_chunk(void* arg) {
+    ParseChunk* chunk = arg;
+    errors_muted = true;
+    syntax_errors = 0;
+    unexpected_pos = UINT32_MAX;
+    node_pools = &chunk->pools;
+
+    Lexer lexer = lexer_from_stream(chunk->stream);
+    lexer.pos = chunk->begin;
+    lexer.payload_pos = chunk->payload_pos;
+    while (lexer.pos < chunk->end) {
+        if (!is_statement(&lexer)) goto err;
+
+        stmt_t item = parse_stmt(&lexer);
+        if (item == NO_NODE || node_vec_append(&chunk->items, item)) goto err;
+    }
+    chunk->failed = lexer.pos != chunk->end || syntax_errors;
+
+    lexer_destroy(&lexer);
+    node_pools = NULL;
+    return NULL;
+err:
+    chunk->failed = true;
+    lexer_destroy(&lexer);
+    node_pools = NULL;
+    return NULL;
 }
 
-// Free dynamic type specifier array all data inside it.
-void free_spec_dynarr(DynArr* arr) {
-    for (size_t i = 0; i < arr->length; i++) free_spec(*(TypeSpec*)dynarr_get(arr, i));
-    dynarr_destroy(arr);
+// Add base to the len node indexes in list.
+void rebase_list(uint32_t* list, size_t len, uint32_t base) {
+    for (size_t i = 0; i < len; i++) list[i] += base;
 }
 
-// Free all data inside expression.
-void free_expr(Expr expr) {
-    switch (expr.type) {
-        case ERROR_EXPR: break;
-        case NO_EXPR:    break;
+// Move the indexes in spec by bases, along with its list of children in lists.
+void rebase_spec(TypeSpec* spec, const NodeBases* bases, uint32_t* lists) {
+    switch (spec->type) {
+        case ERROR_SPEC:
+        case INFERRED_SPEC: break;
+        case GROUPED_SPEC:  spec->data.group += bases->spec; break;
+        case ATOMIC_SPEC:   spec->data.atom += bases->token; break;
+        case ARR_SPEC:
+        case PTR_SPEC:      spec->data.ptr.spec += bases->spec; break;
+        case FUN_SPEC:
+            spec->data.fun.paramt += bases->list;
+            rebase_list(lists + spec->data.fun.paramt, spec->data.fun.paramc, bases->spec);
+            spec->data.fun.ret += bases->spec;
+            break;
+    }
+}
 
-        case GROUPED_EXPR:
-            free_expr(*expr.data.group);
-            free(expr.data.group);
+// Move the indexes in expr by bases, along with its list of children in lists.
+void rebase_expr(Expr* expr, const NodeBases* bases, uint32_t* lists) {
+    switch (expr->type) {
+        case ERROR_EXPR:
+        case NO_EXPR:      break;
+        case GROUPED_EXPR: expr->data.group += bases->expr; break;
+        case ATOMIC_EXPR:  expr->data.atom += bases->token; break;
+        case ARR_EXPR:
+            expr->data.arr.items += bases->list;
+            rebase_list(lists + expr->data.arr.items, expr->data.arr.len, bases->expr);
             break;
-        case ATOMIC_EXPR: break;
-        case ARR_EXPR:    free_expr_arrn(expr.data.arr.items, expr.data.arr.len); break;
         case LAMBDA_EXPR:
-            free(expr.data.lambda.paramv);
-            free_spec_arrn(expr.data.lambda.paramt, expr.data.lambda.paramc);
-            free_expr_arrn(expr.data.lambda.paramd, expr.data.lambda.paramc);
-            free_expr(*expr.data.lambda.expr);
-            free(expr.data.lambda.expr);
-            break;
-
-        case UNOP_EXPR:
-            free_expr(*expr.data.op.first);
-            free(expr.data.op.first);
+            expr->data.lambda.params += bases->param;
+            expr->data.lambda.expr += bases->expr;
             break;
+        case UNOP_EXPR: expr->data.op.first += bases->expr; break;
         case BINOP_EXPR:
-            free_expr(*expr.data.op.first);
-            free(expr.data.op.first);
-            free_expr(*expr.data.op.second);
-            free(expr.data.op.second);
+            expr->data.op.first += bases->expr;
+            expr->data.op.second += bases->expr;
             break;
         case TERNOP_EXPR:
-            free_expr(*expr.data.op.first);
-            free(expr.data.op.first);
-            free_expr(*expr.data.op.second);
-            free(expr.data.op.second);
-            free_expr(*expr.data.op.third);
-            free(expr.data.op.third);
+            expr->data.op.first += bases->expr;
+            expr->data.op.second += bases->expr;
+            expr->data.op.third += bases->expr;
             break;
-
         case SUBSRIPT_EXPR:
-            free_expr(*expr.data.subscript.arr);
-            free(expr.data.subscript.arr);
-            free_expr(*expr.data.subscript.idx);
-            free(expr.data.subscript.idx);
+            expr->data.subscript.arr += bases->expr;
+            expr->data.subscript.idx += bases->expr;
             break;
         case CALL_EXPR:
         case CONSTRUCTOR_EXPR:
-            free_expr(*expr.data.call.fun);
-            free(expr.data.call.fun);
-            free_expr_arrn(expr.data.call.argv, expr.data.call.argc);
+            expr->data.call.fun += bases->expr;
+            expr->data.call.argv += bases->list;
+            rebase_list(lists + expr->data.call.argv, expr->data.call.argc, bases->expr);
             break;
         case ACCESS_EXPR:
-            free_expr(*expr.data.access.obj);
-            free(expr.data.access.obj);
+            expr->data.access.obj += bases->expr;
+            expr->data.access.memeber += bases->token;
             break;
     }
 }
 
-// Free expression array of length n all all data inside it.
-void free_expr_arrn(Expr* arr, size_t n) {
-    for (size_t i = 0; i < n; i++) free_expr(arr[i]);
-    free(arr);
-}
-
-// Free dynamic expression array all data inside it.
-void free_expr_dynarr(DynArr* arr) {
-    for (size_t i = 0; i < arr->length; i++) free_expr(*(Expr*)dynarr_get(arr, i));
-    dynarr_destroy(arr);
-}
-
-// Free all data inside statement.
-void free_stmt(Stmt stmt) {
-    switch (stmt.type) {
-        case ERROR_STMT: break;
-        case NOP:        break;
-
-        case BLOCK:     free_stmt_arrn(stmt.data.block.stmts, stmt.data.block.len); break;
-        case EXPR_STMT: free_expr(stmt.data.expr); break;
+// Move the indexes in stmt by bases, along with its lists of children in lists.
+void rebase_stmt(Stmt* stmt, const NodeBases* bases, uint32_t* lists) {
+    switch (stmt->type) {
+        case ERROR_STMT:
+        case NOP:
+        case BREAK_STMT:
+        case CONTINUE_STMT: break;
+        case BLOCK:
+            stmt->data.block.stmts += bases->list;
+            rebase_list(lists + stmt->data.block.stmts, stmt->data.block.len, bases->stmt);
+            break;
+        case EXPR_STMT:
+        case RETURN_STMT: stmt->data.expr += bases->expr; break;
         case DECL:
-            free_expr(stmt.data.decl.val);
-            free_spec(stmt.data.decl.spec);
+            stmt->data.decl.name += bases->token;
+            stmt->data.decl.val += bases->expr;
+            stmt->data.decl.spec += bases->spec;
+            break;
+        case TYPEDEF:
+            stmt->data.type.name += bases->token;
+            stmt->data.type.val += bases->spec;
             break;
-        case TYPEDEF: free_spec(stmt.data.type.val); break;
-
         case IFELSE_STMT:
-            free_expr(stmt.data.ifelse.condition);
-            free_stmt(*stmt.data.ifelse.on_true);
-            free(stmt.data.ifelse.on_true);
-            if (stmt.data.ifelse.on_false) {
-                free_stmt(*stmt.data.ifelse.on_false);
-                free(stmt.data.ifelse.on_false);
-            }
+            stmt->data.ifelse.condition += bases->expr;
+            stmt->data.ifelse.on_true += bases->stmt;
+            if (stmt->data.ifelse.on_false != NO_NODE) stmt->data.ifelse.on_false += bases->stmt;
             break;
         case SWITCH_STMT:
-            free_expr(stmt.data.switchcase.expr);
-            free_expr_arrn(stmt.data.switchcase.casev, stmt.data.switchcase.casec);
-            free_stmt_arrn(stmt.data.switchcase.branchv, stmt.data.switchcase.casec);
+            stmt->data.switchcase.expr += bases->expr;
+            stmt->data.switchcase.casev += bases->list;
+            stmt->data.switchcase.branchv += bases->list;
+            rebase_list(
+                lists + stmt->data.switchcase.casev, stmt->data.switchcase.casec, bases->expr
+            );
+            rebase_list(
+                lists + stmt->data.switchcase.branchv, stmt->data.switchcase.casec, bases->stmt
+            );
             break;
         case WHILE_STMT:
         case DOWHILE_STMT:
-            free_expr(stmt.data.whileloop.condition);
-            free_stmt(*stmt.data.whileloop.body);
-            free(stmt.data.whileloop.body);
+            stmt->data.whileloop.condition += bases->expr;
+            stmt->data.whileloop.body += bases->stmt;
             break;
         case FOR_STMT:
-            free_stmt(*stmt.data.forloop.init);
-            free(stmt.data.forloop.init);
-            free_expr(stmt.data.forloop.condition);
-            free_expr(stmt.data.forloop.expr);
-            free_stmt(*stmt.data.forloop.body);
-            free(stmt.data.forloop.body);
+            stmt->data.forloop.init += bases->stmt;
+            stmt->data.forloop.condition += bases->expr;
+            stmt->data.forloop.expr += bases->expr;
+            stmt->data.forloop.body += bases->stmt;
             break;
-
         case FUNCTION_STMT:
-            free(stmt.data.fun.paramv);
-            free_spec_arrn(stmt.data.fun.paramt, stmt.data.fun.paramc);
-            free_expr_arrn(stmt.data.fun.paramd, stmt.data.fun.paramc);
-            free_spec(stmt.data.fun.ret);
-            free_stmt(*stmt.data.fun.body);
-            free(stmt.data.fun.body);
+            stmt->data.fun.name += bases->token;
+            stmt->data.fun.params += bases->param;
+            stmt->data.fun.ret += bases->spec;
+            stmt->data.fun.body += bases->stmt;
             break;
         case STRUCT_STMT:
-            free(stmt.data.structdef.paramv);
-            free_spec_arrn(stmt.data.structdef.paramt, stmt.data.structdef.paramc);
-            free_expr_arrn(stmt.data.structdef.paramd, stmt.data.structdef.paramc);
+            stmt->data.structdef.name += bases->token;
+            stmt->data.structdef.params += bases->param;
+            break;
+        case ENUM_STMT:
+            stmt->data.enumdef.name += bases->token;
+            stmt->data.enumdef.items += bases->list;
+            rebase_list(lists + stmt->data.enumdef.items, stmt->data.enumdef.len, bases->token);
             break;
-        case ENUM_STMT: free(stmt.data.enumdef.items); break;
+    }
+}
 
-        case RETURN_STMT:   free_expr(stmt.data.expr); break;
-        case BREAK_STMT:    break;
-        case CONTINUE_STMT: break;
+// Copy the nodes in src to the end of dst, which has room for them.
+// Returns a pointer to the first copied node.
+void* copy_pool(DynArr* dst, size_t base, const DynArr* src) {
+    void* first = (char*)dst->c_arr + base * dst->elem_size;
+    if (src->length) memcpy(first, src->c_arr, src->length * src->elem_size);
+    return first;
+}
+
+// Copy the nodes of a chunk to their place in the stitched pools, and free them.
+// Lists are copied first, so that each node can rebase its own lists.
+void* copy_chunk_nodes(void* arg) {
+    ParseChunk* chunk = arg;
+    if (chunk->dst == &chunk->pools) return NULL;
+    NodePools* dst = chunk->dst;
+    const NodeBases* bases = &chunk->bases;
+
+    uint32_t* lists = dst->lists.c_arr;
+    copy_pool(&dst->lists, bases->list, &chunk->pools.lists);
+
+    TypeSpec* specs = copy_pool(&dst->specs, bases->spec, &chunk->pools.specs);
+    for (size_t i = 0; i < chunk->pools.specs.length; i++) rebase_spec(&specs[i], bases, lists);
+
+    Expr* exprs = copy_pool(&dst->exprs, bases->expr, &chunk->pools.exprs);
+    for (size_t i = 0; i < chunk->pools.exprs.length; i++) rebase_expr(&exprs[i], bases, lists);
+
+    Stmt* stmts = copy_pool(&dst->stmts, bases->stmt, &chunk->pools.stmts);
+    for (size_t i = 0; i < chunk->pools.stmts.length; i++) rebase_stmt(&stmts[i], bases, lists);
+
+    Param* params = copy_pool(&dst->params, bases->param, &chunk->pools.params);
+    for (size_t i = 0; i < chunk->pools.params.length; i++) {
+        params[i].name += bases->token;
+        params[i].type += bases->spec;
+        params[i].def += bases->expr;
     }
+
+    copy_pool(&dst->tokens, bases->token, &chunk->pools.tokens);
+
+    rebase_list(node_vec_elems(&chunk->items), chunk->items.length, bases->stmt);
+    free_node_pools(&chunk->pools);
+    return NULL;
 }
 
-// Free statement array of length n all all data inside it.
-void free_stmt_arrn(Stmt* arr, size_t n) {
-    for (size_t i = 0; i < n; i++) free_stmt(arr[i]);
-    free(arr);
+// Run fn on every chunk, each on its own thread if one can be started.
+void run_parse_chunks(ParseChunk* chunks, size_t count, void* (*fn)(void*)) {
+    for (size_t i = 0; i < count; i++) {
+        chunks[i].joinable = pthread_create(&chunks[i].thread, NULL, fn, &chunks[i]) == 0;
+        if (!chunks[i].joinable) fn(&chunks[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].joinable) pthread_join(chunks[i].thread, NULL);
+    }
 }
 
-// Free dynamic statement array all all data inside it.
-void free_stmt_dynarr(DynArr* arr) {
-    for (size_t i = 0; i < arr->length; i++) free_stmt(*(Stmt*)dynarr_get(arr, i));
-    dynarr_destroy(arr);
+// Free all nodes of count chunks, and the chunks themselves.
+void free_parse_chunks(ParseChunk* chunks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free_node_pools(&chunks[i].pools);
+        node_vec_destroy(&chunks[i].items);
+    }
+    mem_free(chunks);
 }
 
-// Free non-tagged abstract syntax tree token and all data inside it.
+// Split the top-level items of program into at most threads chunks of similar token counts.
+// Items are found by scanning the tokens outside of brackets: one begins at every declaration
+// keyword after a ';' or '}'.
+// Returns the number of chunks.
+size_t split_items(const TokenStream* program, ParseChunk* chunks, size_t threads) {
+    const uint8_t* kinds = program->kinds;
+    size_t last = program->len - 1;  // the EOF_TOKEN
+
+    size_t count = 0, begin = 0, payload_pos = 0;
+    size_t target = last / threads;
+    for (size_t i = 0; i < last && count + 1 < threads; i++) {
+        if (kinds[i] == LPAREN || kinds[i] == LBRACKET || kinds[i] == LBRACE) {
+            i = program->matches[i];
+            continue;
+        }
+        if (i < target || i == 0 || !starts_item(kinds[i])) continue;
+        if (kinds[i - 1] != SEMICOLON && kinds[i - 1] != RBRACE) continue;
+
+        chunks[count] = (ParseChunk) { .begin = begin, .end = i };
+        count++;
+        begin = i;
+        target = (count + 1) * last / threads;
+    }
+    chunks[count] = (ParseChunk) { .begin = begin, .end = last };
+    count++;
+
+    for (size_t i = 0, pos = 0; i < count; i++) {
+        for (; pos < chunks[i].begin; pos++) payload_pos += has_payload(kinds[pos]);
+        chunks[i].stream = program;
+        chunks[i].payload_pos = payload_pos;
+        chunks[i].pools = node_pools_create();
+        chunks[i].items = node_vec_create();
+    }
+    return count;
+}
+
+// Grow the pools of the first chunk to hold the nodes of all count chunks, and set the place
+// of every chunk in them.
+// Returns whether an error occurred.
+bool place_chunks(ParseChunk* chunks, size_t count) {
+    NodePools* dst = &chunks[0].pools;
+    NodeBases total = { 0 };
+    for (size_t i = 0; i < count; i++) {
+        const NodePools* pools = &chunks[i].pools;
+        chunks[i].dst = dst;
+        chunks[i].bases = total;
+        if ((uint64_t)total.spec + pools->specs.length >= NO_NODE ||
+            (uint64_t)total.expr + pools->exprs.length >= NO_NODE ||
+            (uint64_t)total.stmt + pools->stmts.length >= NO_NODE ||
+            (uint64_t)total.token + pools->tokens.length >= NO_NODE ||
+            (uint64_t)total.param + pools->params.length >= NO_NODE ||
+            (uint64_t)total.list + pools->lists.length >= NO_NODE)
+        {
+            malloc_error();
+            return true;
+        }
+        total.spec += pools->specs.length;
+        total.expr += pools->exprs.length;
+        total.stmt += pools->stmts.length;
+        total.token += pools->tokens.length;
+        total.param += pools->params.length;
+        total.list += pools->lists.length;
+    }
+
+    if (dynarr_reserve(&dst->specs, total.spec) || dynarr_reserve(&dst->exprs, total.expr) ||
+        dynarr_reserve(&dst->stmts, total.stmt) || dynarr_reserve(&dst->tokens, total.token) ||
+        dynarr_reserve(&dst->params, total.param) || dynarr_reserve(&dst->lists, total.list))
+    {
+        return true;
+    }
+    dst->specs.length = total.spec;
+    dst->exprs.length = total.expr;
+    dst->stmts.length = total.stmt;
+    dst->tokens.length = total.token;
+    dst->params.length = total.param;
+    dst->lists.length = total.list;
+    return false;
+}
+
+// Parse token stream with its top-level items split among up to threads threads.
+// The nodes of the items are stitched into the same pools, in the same order, as parse produces.
+// Errors are reported by parsing sequentially, so they are the same as well.
+// Result is not tagged.
+// Returns NULL if an error occurred.
+AST* parse_parallel(const TokenStream* program, size_t threads) {
+    if (program == NULL) return NULL;
+    if (threads > program->len / PARSE_MIN_CHUNK) threads = program->len / PARSE_MIN_CHUNK;
+    if (threads <= 1) return parse(program);
+
+    ParseChunk* chunks = mem_calloc(threads, sizeof(ParseChunk), AST_MEM);
+    if (chunks == NULL) {
+        malloc_error();
+        return NULL;
+    }
+    size_t count = split_items(program, chunks, threads);
+
+    run_parse_chunks(chunks, count, parse_chunk);
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].failed) {
+            free_parse_chunks(chunks, count);
+            return parse(program);
+        }
+    }
+
+    if (place_chunks(chunks, count)) goto err_free_chunks;
+    // the strings of the tokens are not copied, their chunk arenas are moved instead
+    for (size_t i = 1; i < count; i++) {
+        arena_merge(&chunks[0].pools.strings, &chunks[i].pools.strings);
+    }
+    run_parse_chunks(chunks, count, copy_chunk_nodes);
+
+    // the root block comes after all other nodes, as it does when parsing sequentially
+    node_pools = &chunks[0].pools;
+    NodeVec items = node_vec_create();
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t* elems = node_vec_elems(&chunks[i].items);
+        for (size_t j = 0; j < chunks[i].items.length; j++) {
+            if (node_vec_append(&items, elems[j])) goto err_free_items;
+        }
+    }
+    Stmt stmt = { .type = BLOCK, .pos = program->offsets[0], .data.block.len = items.length };
+    stmt.data.block.stmts = new_list(&items);
+    if (stmt.data.block.stmts == NO_NODE) goto err_reset_pools;
+    stmt_t block = new_stmt(&stmt);
+    if (block == NO_NODE) goto err_reset_pools;
+
+    AST* ast = ast_from_pools(&chunks[0].pools, block);
+    if (ast == NULL) goto err_reset_pools;
+    node_pools = NULL;
+
+    // the pools were moved into the AST
+    chunks[0].pools = node_pools_create();
+    free_parse_chunks(chunks, count);
+    return ast;
+err_free_items:
+    node_vec_destroy(&items);
+err_reset_pools:
+    node_pools = NULL;
+err_free_chunks:
+    free_parse_chunks(chunks, count);
+    return NULL;
+}
+
+// Free non-tagged or tagged abstract syntax tree and all data inside it.
 void free_ast_p(AST* ast) {
     if (ast == NULL) return;
-    free_stmt(*ast);
-    free(ast);
+    mem_free(ast->tokens);
+    if (ast->file.text) {
+        unmap_file(&ast->file);
+    } else {
+        mem_free(ast->specs);
+        mem_free(ast->exprs);
+        mem_free(ast->stmts);
+        mem_free(ast->params);
+        mem_free(ast->lists);
+    }
+    arena_destroy(&ast->arena);
+    mem_free(ast);
 }
@@ -1,532 +1,384 @@
-#include <stdlib.h>
-
 #include "parser_common.h"
 #include "printerr.h"
 
-Expr parse_postfix(const Token** it, Expr term);
-Expr parse_term(const Token** it);
-
-// Find the binary or ternary operation based on token.
-OpEnum infix_op_from_token(Token token) {
-    switch (token.type) {
-        case STAR:      return MULTIPLICATION;
-        case SLASH:     return DIVISION;
-        case PERCENT:   return MODULO;
-        case PLUS:      return ADDITION;
-        case MINUS:     return SUBTRACTION;
-        case DLT_TOKEN: return LEFT_SHIFT;
-        case DGT_TOKEN: return RIGHT_SHIFT;
-
-        case AND:   return BITWISE_AND;
-        case CARET: return BITWISE_XOR;
-        case PIPE:  return BITWISE_OR;
-
-        case LT_TOKEN:  return LESS_THAN;
-        case LEQ_TOKEN: return LESS_OR_EQUAL;
-        case GT_TOKEN:  return GREATER_THAN;
-        case GEQ_TOKEN: return GREATER_OR_EQUAL;
-        case DEQ_TOKEN: return EQUAL;
-        case NEQ_TOKEN: return NOT_EQUAL;
-
-        case DAND:  return LOGICAL_AND;
-        case DPIPE: return LOGICAL_OR;
-
-        case QMARK: return TERNARY;
-
-        case EQ_TOKEN: return ASSIGNMENT;
-
-        default: return ERROR_OP;
-    }
-}
-
-// Get the operator precedence of op.
-size_t operator_precedence(OpEnum op) {
-    switch (op) {
-        case ERROR_OP: return 0;
-
-        case POSTFIX_INC:
-        case POSTFIX_DEC:
-        case PREFIX_INC:
-        case PREFIX_DEC:
-        case UNARY_PLUS:
-        case UNARY_MINUS:
-        case LOGICAL_NOT:
-        case BINARY_NOT:
-        case DEREFERENCE:
-        case ADDRESS_OF:  return 0;
-
-        case MULTIPLICATION:
-        case DIVISION:
-        case MODULO:         return 1;
-        case ADDITION:
-        case SUBTRACTION:    return 2;
-        case LEFT_SHIFT:
-        case RIGHT_SHIFT:    return 3;
-
-        case BITWISE_AND: return 4;
-        case BITWISE_XOR: return 5;
-        case BITWISE_OR:  return 6;
-
-        case LESS_THAN:
-        case LESS_OR_EQUAL:
-        case GREATER_THAN:
-        case GREATER_OR_EQUAL: return 7;
-        case EQUAL:
-        case NOT_EQUAL:        return 8;
-
-        case LOGICAL_AND: return 9;
-        case LOGICAL_OR:  return 10;
-
-        case TERNARY: return 11;
-
-        case ASSIGNMENT: return 12;
-    }
-
-    // unreachable
-    return 0;
-}
-
-// Whether precedence is right-to-left associative.
-bool operator_rtl_associative(size_t precedence) {
-    return precedence == 11 || precedence == 12;
-}
-
-Expr parse_expr_group(const Token** it) {
+expr_t parse_term(Lexer* lexer);
+
+typedef struct OpInfo OpInfo;
+
+// Binding of an operator.
+struct OpInfo {
+    unsigned char precedence;  // lower binds tighter, prefix and postfix operators bind tightest
+    bool right_to_left;        // whether operands of equal precedence group to the right
+};
+
+const OpInfo op_info[ASSIGNMENT + 1] = {
+    [MULTIPLICATION] = { 1, false },
+    [DIVISION] = { 1, false },
+    [MODULO] = { 1, false },
+    [ADDITION] = { 2, false },
+    [SUBTRACTION] = { 2, false },
+    [LEFT_SHIFT] = { 3, false },
+    [RIGHT_SHIFT] = { 3, false },
+
+    [BITWISE_AND] = { 4, false },
+    [BITWISE_XOR] = { 5, false },
+    [BITWISE_OR] = { 6, false },
+
+    [LESS_THAN] = { 7, false },
+    [LESS_OR_EQUAL] = { 7, false },
+    [GREATER_THAN] = { 7, false },
+    [GREATER_OR_EQUAL] = { 7, false },
+    [EQUAL] = { 8, false },
+    [NOT_EQUAL] = { 8, false },
+
+    [LOGICAL_AND] = { 9, false },
+    [LOGICAL_OR] = { 10, false },
+
+    [TERNARY] = { 11, true },
+
+    [ASSIGNMENT] = { 12, true },
+};
+
+// Operators by the token that starts them in prefix, infix and postfix position.
+// Tokens that start no such operator map to ERROR_OP.
+
+const unsigned char prefix_ops[U64_TOKEN + 1] = {
+    [PLUS] = UNARY_PLUS,
+    [DPLUS] = PREFIX_INC,
+    [MINUS] = UNARY_MINUS,
+    [DMINUS] = PREFIX_DEC,
+    [TILDE] = BINARY_NOT,
+    [EXCLMARK] = LOGICAL_NOT,
+    [STAR] = DEREFERENCE,
+    [AND] = ADDRESS_OF,
+};
+
+const unsigned char infix_ops[U64_TOKEN + 1] = {
+    [STAR] = MULTIPLICATION,
+    [SLASH] = DIVISION,
+    [PERCENT] = MODULO,
+    [PLUS] = ADDITION,
+    [MINUS] = SUBTRACTION,
+    [DLT_TOKEN] = LEFT_SHIFT,
+    [DGT_TOKEN] = RIGHT_SHIFT,
+
+    [AND] = BITWISE_AND,
+    [CARET] = BITWISE_XOR,
+    [PIPE] = BITWISE_OR,
+
+    [LT_TOKEN] = LESS_THAN,
+    [LEQ_TOKEN] = LESS_OR_EQUAL,
+    [GT_TOKEN] = GREATER_THAN,
+    [GEQ_TOKEN] = GREATER_OR_EQUAL,
+    [DEQ_TOKEN] = EQUAL,
+    [NEQ_TOKEN] = NOT_EQUAL,
+
+    [DAND] = LOGICAL_AND,
+    [DPIPE] = LOGICAL_OR,
+
+    [QMARK] = TERNARY,
+
+    [EQ_TOKEN] = ASSIGNMENT,
+};
+
+const unsigned char postfix_ops[U64_TOKEN + 1] = {
+    [DPLUS] = POSTFIX_INC,
+    [DMINUS] = POSTFIX_DEC,
+};
+
+expr_t parse_expr_group(Lexer* lexer) {
     // (
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // inner expression
-    Expr group = parse_expr(it, MAX_PRECEDENCE);
-    if (group.type == ERROR_EXPR) goto err;
+    expr_t group = parse_expr(lexer, MAX_PRECEDENCE);
+    if (group == NO_NODE) return NO_NODE;
 
     // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_group;
-
-    Expr expr;
-    expr.type = GROUPED_EXPR;
-    expr.line = start.line;
-    expr.col = start.col;
-    expr.annotation = NULL;
-
-    // allocations
-    expr.data.group = malloc_struct(&group, sizeof(Expr));
-    if (expr.data.group == NULL) goto err_free_group;
-
-    return expr;
-err_free_group:
-    free_expr(group);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    if (consume_expected_token(lexer, RPAREN)) return NO_NODE;
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = GROUPED_EXPR;
+    expr->pos = start.pos;
+    expr->data.group = group;
+
+    return id;
 }
 
-Expr parse_array_literal(const Token** it) {
+expr_t parse_array_literal(Lexer* lexer) {
     // [x, y, z]
 
     // [
-    Token start = *(*it)++;
-
-    Expr expr;
-    expr.type = ARR_EXPR;
-    expr.line = start.line;
-    expr.col = start.col;
-    expr.annotation = NULL;
+    Token start = next_token(lexer);
 
     // items
-    if (parse_args(it, &expr.data.arr.len, &expr.data.arr.items)) goto err;
+    uint32_t len;
+    list_t items;
+    if (parse_args(lexer, &len, &items)) return NO_NODE;
 
     // ]
-    if (consume_expected_token(it, RBRACKET)) goto err_free_args;
+    if (consume_expected_token(lexer, RBRACKET)) return NO_NODE;
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = ARR_EXPR;
+    expr->pos = start.pos;
+    expr->data.arr.len = len;
+    expr->data.arr.items = items;
 
-    return expr;
-err_free_args:
-    free_expr_arrn(expr.data.arr.items, expr.data.arr.len);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    return id;
 }
 
-Expr parse_lambda(const Token** it) {
+expr_t parse_lambda(Lexer* lexer) {
     // (x, y: a): b => z
 
     // (
-    Token start = *(*it)++;
-
-    Expr expr;
-    expr.type = LAMBDA_EXPR;
-    expr.line = start.line;
-    expr.col = start.col;
-    expr.annotation = NULL;
+    Token start = next_token(lexer);
 
     // parameters
-    if (parse_params(
-            it, &expr.data.lambda.paramc, &expr.data.lambda.optc, &expr.data.lambda.paramv,
-            &expr.data.lambda.paramt, &expr.data.lambda.paramd
-        ))
-    {
-        goto err;
-    }
+    uint32_t paramc, optc;
+    param_t params;
+    if (parse_params(lexer, &paramc, &optc, &params)) return NO_NODE;
 
     // ) =>
-    if (consume_expected_token(it, RPAREN) || consume_expected_token(it, DARROW)) {
-        goto err_free_params;
+    if (consume_expected_token(lexer, RPAREN) || consume_expected_token(lexer, DARROW)) {
+        return NO_NODE;
     }
 
     // lambda body
-    Expr body = parse_expr(it, MAX_PRECEDENCE);
-    if (body.type == ERROR_EXPR) goto err_free_params;
-
-    // allocations
-    expr.data.lambda.expr = malloc_struct(&body, sizeof(Expr));
-    if (expr.data.lambda.expr == NULL) goto err_free_body;
-
-    return expr;
-err_free_body:
-    free_expr(body);
-err_free_params:
-    free(expr.data.lambda.paramv);
-    free_spec_arrn(expr.data.lambda.paramt, expr.data.lambda.paramc);
-    free_expr_arrn(expr.data.lambda.paramd, expr.data.lambda.paramc);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    expr_t body = parse_expr(lexer, MAX_PRECEDENCE);
+    if (body == NO_NODE) return NO_NODE;
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = LAMBDA_EXPR;
+    expr->pos = start.pos;
+    expr->data.lambda.paramc = paramc;
+    expr->data.lambda.optc = optc;
+    expr->data.lambda.params = params;
+    expr->data.lambda.expr = body;
+
+    return id;
 }
 
-Expr parse_subscript(const Token** it, Expr term) {
+expr_t parse_subscript(Lexer* lexer, expr_t term) {
     // x[y]
 
     // [
-    (*it)++;
+    next_token(lexer);
 
     // index
-    Expr idx = parse_expr(it, MAX_PRECEDENCE);
-    if (idx.type == ERROR_EXPR) goto err;
+    expr_t idx = parse_expr(lexer, MAX_PRECEDENCE);
+    if (idx == NO_NODE) return NO_NODE;
 
     // ]
-    if (consume_expected_token(it, RBRACKET)) goto err_free_idx;
-
-    Expr expr;
-    expr.type = SUBSRIPT_EXPR;
-    expr.line = term.line;
-    expr.col = term.col;
-    expr.annotation = NULL;
-
-    // allocations
-    expr.data.subscript.arr = malloc_struct(&term, sizeof(Expr));
-    expr.data.subscript.idx = malloc_struct(&idx, sizeof(Expr));
-    if (expr.data.subscript.arr == NULL || expr.data.subscript.idx == NULL) goto err_free_allocs;
-
-    // may have another postfix operator
-    Expr next = parse_postfix(it, expr);
-    if (next.type == ERROR_EXPR) goto err_free_allocs;
-
-    return next;
-err_free_allocs:
-    free(expr.data.subscript.arr);
-    free(expr.data.subscript.idx);
-err_free_idx:
-    free_expr(idx);
-err:
-    return (Expr) { .type = ERROR_EXPR };
-}
+    if (consume_expected_token(lexer, RBRACKET)) return NO_NODE;
 
-Expr parse_call(const Token** it, Expr term) {
-    // x(y, z)
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = SUBSRIPT_EXPR;
+    expr->pos = get_expr(term)->pos;
+    expr->data.subscript.arr = term;
+    expr->data.subscript.idx = idx;
 
-    // (
-    (*it)++;
+    return id;
+}
 
-    Expr expr;
-    expr.type = CALL_EXPR;
-    expr.line = term.line;
-    expr.col = term.col;
-    expr.annotation = NULL;
+// Parse the arguments of a call or constructor of term, closed by end.
+expr_t parse_call_args(Lexer* lexer, ExprEnum type, expr_t term, TokenEnum end) {
+    // ( or {
+    next_token(lexer);
 
     // arguments
-    if (parse_args(it, &expr.data.call.argc, &expr.data.call.argv)) goto err;
+    uint32_t argc;
+    list_t argv;
+    if (parse_args(lexer, &argc, &argv)) return NO_NODE;
+
+    // ) or }
+    if (consume_expected_token(lexer, end)) return NO_NODE;
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = type;
+    expr->pos = get_expr(term)->pos;
+    expr->data.call.fun = term;
+    expr->data.call.argc = argc;
+    expr->data.call.argv = argv;
+
+    return id;
+}
 
-    // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_args;
-
-    // allocations
-    expr.data.call.fun = malloc_struct(&term, sizeof(Expr));
-    if (expr.data.call.fun == NULL) goto err_free_args;
-
-    // may have another postfix operator
-    Expr next = parse_postfix(it, expr);
-    if (next.type == ERROR_EXPR) goto err_free_alloc;
-
-    return next;
-err_free_alloc:
-    free(expr.data.call.fun);
-err_free_args:
-    free_expr_arrn(expr.data.call.argv, expr.data.call.argc);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+expr_t parse_call(Lexer* lexer, expr_t term) {
+    // x(y, z)
+    return parse_call_args(lexer, CALL_EXPR, term, RPAREN);
 }
 
-Expr parse_constructor(const Token** it, Expr term) {
+expr_t parse_constructor(Lexer* lexer, expr_t term) {
     // x { y, z }
-
-    // {
-    (*it)++;
-
-    Expr expr;
-    expr.type = CONSTRUCTOR_EXPR;
-    expr.line = term.line;
-    expr.col = term.col;
-    expr.annotation = NULL;
-
-    // arguments
-    if (parse_args(it, &expr.data.call.argc, &expr.data.call.argv)) goto err;
-
-    // }
-    if (consume_expected_token(it, RBRACE)) goto err_free_args;
-
-    // allocations
-    expr.data.call.fun = malloc_struct(&term, sizeof(Expr));
-    if (expr.data.call.fun == NULL) goto err_free_args;
-
-    // may have another postfix operator
-    Expr next = parse_postfix(it, expr);
-    if (next.type == ERROR_EXPR) goto err_free_expr_alloc;
-
-    return next;
-err_free_expr_alloc:
-    free(expr.data.call.fun);
-err_free_args:
-    free_expr_arrn(expr.data.call.argv, expr.data.call.argc);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    return parse_call_args(lexer, CONSTRUCTOR_EXPR, term, RBRACE);
 }
 
-Expr parse_access(const Token** it, Expr term) {
+expr_t parse_access(Lexer* lexer, expr_t term) {
     // x.y
 
     // .
-    (*it)++;
+    next_token(lexer);
 
     // variable name
-    Token member = **it;
-    if (consume_expected_token(it, VAR_NAME)) goto err;
-
-    Expr expr;
-    expr.type = ACCESS_EXPR;
-    expr.line = term.line;
-    expr.col = term.col;
-    expr.annotation = NULL;
-    expr.data.access.memeber = member;
-
-    // allocations
-    expr.data.access.obj = malloc_struct(&term, sizeof(Expr));
-    if (expr.data.access.obj == NULL) goto err;
-
-    // may have another postfix operator
-    Expr next = parse_postfix(it, expr);
-    if (next.type == ERROR_EXPR) goto err_free_alloc;
-
-    return next;
-err_free_alloc:
-    free(expr.data.access.obj);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    token_t member = new_expected_token(lexer, VAR_NAME);
+    if (member == NO_NODE) return NO_NODE;
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = ACCESS_EXPR;
+    expr->pos = get_expr(term)->pos;
+    expr->data.access.obj = term;
+    expr->data.access.memeber = member;
+
+    return id;
 }
 
-Expr parse_unary_postfix(OpEnum type, const Token** it, Expr term) {
+expr_t parse_unary_postfix(OpEnum type, Lexer* lexer, expr_t term) {
     // operator
-    Token token = *(*it)++;
-
-    Expr expr;
-    expr.type = UNOP_EXPR;
-    expr.line = term.line;
-    expr.col = term.col;
-    expr.annotation = NULL;
-    expr.data.op.type = type;
-    expr.data.op.token = token;
-
-    // allocations
-    expr.data.op.first = malloc_struct(&term, sizeof(Expr));
-    if (expr.data.op.first == NULL) goto err;
-
-    // may have another postfix operator
-    Expr next = parse_postfix(it, expr);
-    if (next.type == ERROR_EXPR) goto err_free_alloc;
-
-    return next;
-err_free_alloc:
-    free(expr.data.op.first);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    next_token(lexer);
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = UNOP_EXPR;
+    expr->pos = get_expr(term)->pos;
+    expr->data.op.type = type;
+    expr->data.op.first = term;
+
+    return id;
 }
 
-Expr parse_unary_prefix(OpEnum type, const Token** it) {
+expr_t parse_unary_prefix(OpEnum type, Lexer* lexer) {
     // operator
-    Token token = *(*it)++;
+    Token token = next_token(lexer);
 
     // operand
-    Expr term = parse_term(it);
-    if (term.type == ERROR_EXPR) goto err;
-
-    Expr expr;
-    expr.type = UNOP_EXPR;
-    expr.line = token.line;
-    expr.col = token.col;
-    expr.annotation = NULL;
-    expr.data.op.type = type;
-    expr.data.op.token = token;
-
-    // allocations
-    expr.data.op.first = malloc_struct(&term, sizeof(Expr));
-    if (expr.data.op.first == NULL) goto err_free_term;
-
-    return expr;
-err_free_term:
-    free_expr(term);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+    expr_t term = parse_term(lexer);
+    if (term == NO_NODE) return NO_NODE;
+
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = UNOP_EXPR;
+    expr->pos = token.pos;
+    expr->data.op.type = type;
+    expr->data.op.first = term;
+
+    return id;
 }
 
-Expr parse_atomic_term(const Token** it) {
-    // value
-    Token token = *(*it)++;
+expr_t parse_atomic_term(Lexer* lexer) {
+    // value, decoded straight into the AST
+    token_t atom = new_next_token(lexer);
+    if (atom == NO_NODE) return NO_NODE;
 
-    Expr expr;
-    expr.type = ATOMIC_EXPR;
-    expr.line = token.line;
-    expr.col = token.col;
-    expr.annotation = NULL;
-    expr.data.atom = token;
+    expr_t id;
+    Expr* expr = place_expr(&id);
+    if (expr == NULL) return NO_NODE;
+    expr->type = ATOMIC_EXPR;
+    expr->pos = get_token(atom)->pos;
+    expr->data.atom = atom;
 
-    return parse_postfix(it, expr);
+    return id;
 }
 
-Expr parse_postfix(const Token** it, Expr term) {
-    switch ((*it)->type) {
-        case DPLUS:  return parse_unary_postfix(POSTFIX_INC, it, term);
-        case DMINUS: return parse_unary_postfix(POSTFIX_DEC, it, term);
-
-        case LBRACKET: return parse_subscript(it, term);
-        case LPAREN:   return parse_call(it, term);
-        case LBRACE:   return parse_constructor(it, term);
-        case DOT:      return parse_access(it, term);
-
-        default: return term;
+// Apply the postfix operators after term to it.
+expr_t parse_postfix(Lexer* lexer, expr_t term) {
+    while (term != NO_NODE) {
+        TokenEnum type = peek_type(lexer, 0);
+        switch (type) {
+            case LBRACKET: term = parse_subscript(lexer, term); break;
+            case LPAREN:   term = parse_call(lexer, term); break;
+            case LBRACE:   term = parse_constructor(lexer, term); break;
+            case DOT:      term = parse_access(lexer, term); break;
+
+            default:
+                if (postfix_ops[type] == ERROR_OP) return term;
+                term = parse_unary_postfix(postfix_ops[type], lexer, term);
+                break;
+        }
     }
+    return NO_NODE;
 }
 
-Expr parse_term(const Token** it) {
-    Expr expr;
-    Expr next;
+expr_t parse_term(Lexer* lexer) {
+    TokenEnum type = peek_type(lexer, 0);
+    if (prefix_ops[type] != ERROR_OP) return parse_unary_prefix(prefix_ops[type], lexer);
 
-    switch ((*it)->type) {
+    switch (type) {
         // atom
         case INT_LITERAL:
         case CHR_LITERAL:
         case STR_LITERAL:
-        case VAR_NAME:    return parse_atomic_term(it);
-
-        case PLUS:     return parse_unary_prefix(UNARY_PLUS, it);
-        case DPLUS:    return parse_unary_prefix(POSTFIX_INC, it);
-        case MINUS:    return parse_unary_prefix(UNARY_PLUS, it);
-        case DMINUS:   return parse_unary_prefix(POSTFIX_DEC, it);
-        case TILDE:    return parse_unary_prefix(BINARY_NOT, it);
-        case EXCLMARK: return parse_unary_prefix(LOGICAL_NOT, it);
-        case STAR:     return parse_unary_prefix(DEREFERENCE, it);
-        case AND:      return parse_unary_prefix(ADDRESS_OF, it);
-
-        case LBRACKET: return parse_array_literal(it);
+        case VAR_NAME:    return parse_postfix(lexer, parse_atomic_term(lexer));
+
+        case LBRACKET: return parse_array_literal(lexer);
         case LPAREN:
-            // check if lambda expression
-            expr = is_lambda(it) ? parse_lambda(it) : parse_expr_group(it);
-            // postfix operators
-            next = parse_postfix(it, expr);
-            if (next.type == ERROR_EXPR) goto err_free_expr;
-            break;
-
-        default: unexpected_token(**it); goto err;
-    }
+            // check if lambda expression, then postfix operators
+            return parse_postfix(
+                lexer, is_lambda(lexer) ? parse_lambda(lexer) : parse_expr_group(lexer)
+            );
 
-    return next;
-err_free_expr:
-    free_expr(expr);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+        default: unexpected_token(*peek(lexer, 0)); return NO_NODE;
+    }
 }
 
-Expr parse_expr(const Token** it, size_t precedence) {
-    // base case
-    if (precedence == 0) return parse_term(it);
-
-    bool ternary;
-    Expr middle;
-    Expr rhs;
-    Expr expr;
-
-    // whether current precedence is left-to-right associative
-    bool right_to_left = operator_rtl_associative(precedence);
-    // leftmost operand
-    // must only contain operators of lesser precedence
-    Expr lhs = parse_expr(it, precedence - 1);
-    if (lhs.type == ERROR_EXPR) goto err;
-
-    for (;;) {
-        Token token = **it;
-        OpEnum op = infix_op_from_token(token);
-        // check if operation should be handled in this recursive step
-        if (op == ERROR_OP || operator_precedence(op) > precedence) return lhs;
-        (*it)++;
-
-        // whether operation is ternary
-        ternary = op == TERNARY;
-        if (ternary) {
-            // middle operator is unaffected by precedence
-            middle = parse_expr(it, MAX_PRECEDENCE);
-            if (middle.type == ERROR_EXPR) goto err_free_lhs;
+// Parse expression whose operators have at most precedence.
+// Operators are parsed by precedence climbing, with one loop iteration per infix operator.
+expr_t parse_expr(Lexer* lexer, size_t precedence) {
+    expr_t lhs = parse_term(lexer);
+
+    while (lhs != NO_NODE) {
+        OpEnum op = infix_ops[peek_type(lexer, 0)];
+        // operators of higher precedence bind looser, so they are left to the caller
+        if (op == ERROR_OP || op_info[op].precedence > precedence) return lhs;
+        next_token(lexer);
+
+        // middle operand is unaffected by precedence
+        expr_t middle = NO_NODE;
+        if (op == TERNARY) {
+            middle = parse_expr(lexer, MAX_PRECEDENCE);
+            if (middle == NO_NODE) return NO_NODE;
 
             // :
-            if (consume_expected_token(it, COLON)) goto err_free_middle;
+            if (consume_expected_token(lexer, COLON)) return NO_NODE;
         }
 
         // rightmost operand
         // can contain the same precedence operator iff right-to-left associative
-        rhs = parse_expr(it, precedence - !right_to_left);
-        if (rhs.type == ERROR_EXPR) goto err_free_middle;
-
-        expr.type = ternary ? TERNOP_EXPR : BINOP_EXPR;
-        expr.line = lhs.line;
-        expr.col = lhs.col;
-        expr.annotation = NULL;
-        expr.data.op.type = op;
-        expr.data.op.token = token;
-
-        // allocations
-        expr.data.op.first = malloc_struct(&lhs, sizeof(Expr));
-        expr.data.op.second = malloc_struct(&rhs, sizeof(Expr));
-        if (expr.data.op.first == NULL || expr.data.op.second == NULL) goto err_free_allocs;
-
-        // rightmost operand is third and middle is second if ternary
-        if (ternary) {
-            expr.data.op.third = expr.data.op.second;
-            expr.data.op.second = malloc_struct(&middle, sizeof(Expr));
-            if (expr.data.op.second == NULL) goto err_free_ternary_alloc;
-        }
-
-        // right-to-left will be done here but left-to-right must loop
-        // to parse next term for this precedence level
-        if (right_to_left) {
-            return expr;
+        // it is third and the middle one is second if ternary
+        expr_t rhs = parse_expr(lexer, op_info[op].precedence - !op_info[op].right_to_left);
+        if (rhs == NO_NODE) return NO_NODE;
+
+        // built in place after its operands
+        pos_t pos = get_expr(lhs)->pos;
+        expr_t id;
+        Expr* expr = place_expr(&id);
+        if (expr == NULL) return NO_NODE;
+        expr->type = op == TERNARY ? TERNOP_EXPR : BINOP_EXPR;
+        expr->pos = pos;
+        expr->data.op.type = op;
+        expr->data.op.first = lhs;
+        if (op == TERNARY) {
+            expr->data.op.second = middle;
+            expr->data.op.third = rhs;
         } else {
-            lhs = expr;
+            expr->data.op.second = rhs;
         }
-    }
 
-err_free_ternary_alloc:
-    free(expr.data.op.third);
-err_free_allocs:
-    free(expr.data.op.second);
-    free(expr.data.op.first);
-    free_expr(rhs);
-err_free_middle:
-    if (ternary) free_expr(middle);
-err_free_lhs:
-    free_expr(lhs);
-err:
-    return (Expr) { .type = ERROR_EXPR };
+        lhs = id;
+    }
+    return NO_NODE;
 }
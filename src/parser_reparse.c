@@ -0,0 +1,369 @@
+#include "parser_common.h"
+
+#include <stddef.h>
+
+#include "visitor.h"
+
+// AST and tokens of a program before an edit, whose statements are reused after it.
+struct Reuse {
+    const AST* ast;
+    const TokenStream* old;     // tokens the AST was parsed from
+    const TokenStream* tokens;  // tokens after the edit
+    TokenDamage damage;
+};
+
+// statements of the AST being parsed on this thread are reused from here unless NULL
+_Thread_local const Reuse* reused = NULL;
+
+// Find the statement that starts at offset pos in ast, other than a BLOCK.
+// Statements are searched from the root by their positions, one level of nesting at a time.
+// Returns NO_NODE if there is none.
+stmt_t find_stmt(const AST* ast, pos_t pos) {
+    const Stmt* root = &ast->stmts[ast->block];
+    const uint32_t* list = ast->lists + root->data.block.stmts;
+    size_t count = root->data.block.len;
+
+    stmt_t children[2];
+    for (;;) {
+        // last statement of the list that starts at or before pos
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ast->stmts[list[mid]].pos <= pos) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == 0) return NO_NODE;
+
+        const Stmt* stmt = &ast->stmts[list[lo - 1]];
+        if (stmt->pos == pos && stmt->type != BLOCK) return list[lo - 1];
+
+        // statements nested in it
+        switch (stmt->type) {
+            case BLOCK:
+                list = ast->lists + stmt->data.block.stmts;
+                count = stmt->data.block.len;
+                break;
+            case FUNCTION_STMT:
+                children[0] = stmt->data.fun.body;
+                list = children;
+                count = 1;
+                break;
+            case SWITCH_STMT:
+                list = ast->lists + stmt->data.switchcase.branchv;
+                count = stmt->data.switchcase.casec;
+                break;
+            case IFELSE_STMT:
+                children[0] = stmt->data.ifelse.on_true;
+                children[1] = stmt->data.ifelse.on_false;
+                list = children;
+                count = stmt->data.ifelse.on_false == NO_NODE ? 1 : 2;
+                break;
+            case WHILE_STMT:
+            case DOWHILE_STMT:
+                children[0] = stmt->data.whileloop.body;
+                list = children;
+                count = 1;
+                break;
+            case FOR_STMT:
+                children[0] = stmt->data.forloop.init;
+                children[1] = stmt->data.forloop.body;
+                list = children;
+                count = 2;
+                break;
+
+            default: return NO_NODE;
+        }
+    }
+}
+
+// Find the first token of type at or after index i in stream outside of brackets.
+size_t skip_to(const TokenStream* stream, size_t i, TokenEnum type) {
+    for (; stream->kinds[i] != type; i++) {
+        if (stream->kinds[i] == LPAREN || stream->kinds[i] == LBRACKET) i = stream->matches[i];
+    }
+    return i;
+}
+
+// Find the first token after the parenthesized header of the conditional or loop at index first.
+size_t skip_header(const TokenStream* stream, size_t first) {
+    return stream->matches[first + 1] + 1;
+}
+
+// Find the index of the last token of stmt, which starts at index first of the tokens the AST
+// was parsed from.
+size_t last_token(const AST* ast, const TokenStream* stream, stmt_t id, size_t first) {
+    const Stmt* stmt = &ast->stmts[id];
+    size_t last;
+    switch (stmt->type) {
+        case ERROR_STMT:
+        case BLOCK:
+        case NOP:           return first;
+        case BREAK_STMT:
+        case CONTINUE_STMT: return first + 1;
+
+        case EXPR_STMT:
+        case RETURN_STMT:
+        case DECL:
+        case TYPEDEF:       return skip_to(stream, first, SEMICOLON);
+
+        case IFELSE_STMT:
+            // if (x) f else g
+            last = last_token(ast, stream, stmt->data.ifelse.on_true, skip_header(stream, first));
+            if (stmt->data.ifelse.on_false == NO_NODE) return last;
+            return last_token(ast, stream, stmt->data.ifelse.on_false, last + 2);
+        case WHILE_STMT:
+            // while (x) f
+            return last_token(ast, stream, stmt->data.whileloop.body, skip_header(stream, first));
+        case FOR_STMT:
+            // for (x; y; z) f
+            return last_token(ast, stream, stmt->data.forloop.body, skip_header(stream, first));
+        case DOWHILE_STMT:
+            // do f while (x);
+            last = last_token(ast, stream, stmt->data.whileloop.body, first + 1);
+            return stream->matches[last + 2] + 1;
+
+        case SWITCH_STMT:
+        case FUNCTION_STMT:
+        case STRUCT_STMT:
+        case ENUM_STMT:     return stream->matches[skip_to(stream, first, LBRACE)];
+    }
+
+    // unreachable
+    return first;
+}
+
+typedef struct PoolSpan PoolSpan;
+typedef struct NodeSpan NodeSpan;
+
+// Range of nodes in a pool, and the number of them in a subtree.
+struct PoolSpan {
+    uint32_t begin, end;
+    uint32_t count;
+};
+
+// Ranges of the nodes of a subtree in the pools of its AST.
+struct NodeSpan {
+    PoolSpan spec, expr, stmt, token, param, list;
+};
+
+// Add the len nodes from index to span.
+void span_add(PoolSpan* span, uint32_t index, uint32_t len) {
+    if (len == 0) return;
+    if (span->count == 0 || index < span->begin) span->begin = index;
+    if (span->count == 0 || index + len > span->end) span->end = index + len;
+    span->count += len;
+}
+
+// Add a node of ast to span with the tokens and list items it holds, without its children.
+void span_node(const AST* ast, NodeKind kind, uint32_t id, NodeSpan* span) {
+    switch (kind) {
+        case SPEC_NODE:
+            const TypeSpec* spec = &ast->specs[id];
+            span_add(&span->spec, id, 1);
+            if (spec->type == ATOMIC_SPEC) span_add(&span->token, spec->data.atom, 1);
+            if (spec->type == FUN_SPEC) {
+                span_add(&span->list, spec->data.fun.paramt, spec->data.fun.paramc);
+            }
+            break;
+        case EXPR_NODE:
+            const Expr* expr = &ast->exprs[id];
+            span_add(&span->expr, id, 1);
+            switch (expr->type) {
+                case ATOMIC_EXPR: span_add(&span->token, expr->data.atom, 1); break;
+                case ARR_EXPR:
+                    span_add(&span->list, expr->data.arr.items, expr->data.arr.len);
+                    break;
+                case CALL_EXPR:
+                case CONSTRUCTOR_EXPR:
+                    span_add(&span->list, expr->data.call.argv, expr->data.call.argc);
+                    break;
+                case ACCESS_EXPR: span_add(&span->token, expr->data.access.memeber, 1); break;
+
+                default: break;
+            }
+            break;
+        case STMT_NODE:
+            const Stmt* stmt = &ast->stmts[id];
+            span_add(&span->stmt, id, 1);
+            switch (stmt->type) {
+                case BLOCK:
+                    span_add(&span->list, stmt->data.block.stmts, stmt->data.block.len);
+                    break;
+                case DECL:          span_add(&span->token, stmt->data.decl.name, 1); break;
+                case TYPEDEF:       span_add(&span->token, stmt->data.type.name, 1); break;
+                case FUNCTION_STMT: span_add(&span->token, stmt->data.fun.name, 1); break;
+                case STRUCT_STMT:   span_add(&span->token, stmt->data.structdef.name, 1); break;
+                case SWITCH_STMT:
+                    span_add(&span->list, stmt->data.switchcase.casev, stmt->data.switchcase.casec);
+                    span_add(
+                        &span->list, stmt->data.switchcase.branchv, stmt->data.switchcase.casec
+                    );
+                    break;
+                case ENUM_STMT:
+                    span_add(&span->token, stmt->data.enumdef.name, 1);
+                    span_add(&span->list, stmt->data.enumdef.items, stmt->data.enumdef.len);
+                    for (size_t i = 0; i < stmt->data.enumdef.len; i++) {
+                        span_add(&span->token, ast->lists[stmt->data.enumdef.items + i], 1);
+                    }
+                    break;
+
+                default: break;
+            }
+            break;
+        case PARAM_NODE:
+            span_add(&span->param, id, 1);
+            span_add(&span->token, ast->params[id].name, 1);
+            break;
+    }
+}
+
+// Add the nodes of the subtree of stmt in ast to span.
+// Returns whether an error occurred.
+bool span_stmt(const AST* ast, stmt_t id, NodeSpan* span) {
+    Visitor visitor = visitor_create(ast, STMT_NODE, id);
+    for (Visit visit; visit_next(&visitor, &visit);) {
+        if (!visit.post) span_node(ast, visit.kind, visit.id, span);
+    }
+    bool failed = visitor.failed;
+    visitor_destroy(&visitor);
+    return failed;
+}
+
+// Check whether the nodes of a subtree fill their ranges, which they do unless the parser
+// dropped a node while building it.
+bool is_dense(const NodeSpan* span) {
+    const PoolSpan* pools[] = {
+        &span->spec, &span->expr, &span->stmt, &span->token, &span->param, &span->list,
+    };
+    for (size_t i = 0; i < sizeof(pools) / sizeof(PoolSpan*); i++) {
+        if (pools[i]->count != pools[i]->end - pools[i]->begin) return false;
+    }
+    return true;
+}
+
+// Copy the nodes in the range of span in pool src to the end of pool dst.
+// The offset of the copies is stored in base.
+// Returns whether an error occurred.
+bool copy_range(DynArr* dst, const void* src, const PoolSpan* span, uint32_t* base) {
+    const void* first = (const char*)src + (size_t)span->begin * dst->elem_size;
+    uint32_t index = push_nodes(dst, first, span->count);
+    if (index == NO_NODE) return true;
+    *base = index - span->begin;
+    return false;
+}
+
+// Copy the dense subtree of the reused AST in span to the AST being parsed, moved by the edit
+// if moved. Nodes are copied by their ranges and their indexes are rebased as parse_parallel
+// does when stitching.
+// The offsets of the copies are stored in bases.
+// Returns whether an error occurred.
+bool copy_span(const Reuse* reuse, const NodeSpan* span, bool moved, NodeBases* bases) {
+    const AST* ast = reuse->ast;
+    NodePools* pools = node_pools;
+    if (copy_range(&pools->lists, ast->lists, &span->list, &bases->list) ||
+        copy_range(&pools->specs, ast->specs, &span->spec, &bases->spec) ||
+        copy_range(&pools->exprs, ast->exprs, &span->expr, &bases->expr) ||
+        copy_range(&pools->stmts, ast->stmts, &span->stmt, &bases->stmt) ||
+        copy_range(&pools->params, ast->params, &span->param, &bases->param) ||
+        copy_range(&pools->tokens, ast->tokens, &span->token, &bases->token))
+    {
+        return true;
+    }
+
+    ptrdiff_t shift = moved ? reuse->damage.shift : 0;
+    uint32_t* lists = pools->lists.c_arr;
+
+    TypeSpec* specs = (TypeSpec*)pools->specs.c_arr + (span->spec.begin + bases->spec);
+    for (size_t i = 0; i < span->spec.count; i++) {
+        rebase_spec(&specs[i], bases, lists);
+        specs[i].pos += shift;
+    }
+    Expr* exprs = (Expr*)pools->exprs.c_arr + (span->expr.begin + bases->expr);
+    for (size_t i = 0; i < span->expr.count; i++) {
+        rebase_expr(&exprs[i], bases, lists);
+        exprs[i].pos += shift;
+    }
+    Stmt* stmts = (Stmt*)pools->stmts.c_arr + (span->stmt.begin + bases->stmt);
+    for (size_t i = 0; i < span->stmt.count; i++) {
+        rebase_stmt(&stmts[i], bases, lists);
+        stmts[i].pos += shift;
+    }
+    Param* params = (Param*)pools->params.c_arr + (span->param.begin + bases->param);
+    for (size_t i = 0; i < span->param.count; i++) {
+        params[i].name += bases->token;
+        params[i].type += bases->spec;
+        params[i].def += bases->expr;
+    }
+
+    // literals are owned by the AST before the edit, which is freed after it, and other strings
+    // point into the edited program
+    Token* tokens = (Token*)pools->tokens.c_arr + (span->token.begin + bases->token);
+    for (size_t i = 0; i < span->token.count; i++) {
+        tokens[i].pos += shift;
+        tokens[i].str.ptr = reuse->tokens->program + tokens[i].pos;
+        if (own_token_strings(&tokens[i])) return true;
+    }
+    return false;
+}
+
+// Copy the statement of the program before the edit that starts at the current token of lexer to
+// the AST being parsed, and skip its tokens, if its tokens and the one after it were not edited.
+// The statement is stored in dst, or NO_NODE if there is none.
+// Returns whether an error occurred.
+bool reuse_next_stmt(Lexer* lexer, stmt_t* dst) {
+    const Reuse* reuse = reused;
+    const TokenDamage* damage = &reuse->damage;
+    *dst = NO_NODE;
+
+    // index of the current token before the edit
+    size_t first = lexer->pos;
+    bool moved = first >= damage->new_end;
+    if (moved) first = first - damage->new_end + damage->old_end;
+    else if (first >= damage->begin) return false;
+
+    stmt_t stmt = find_stmt(reuse->ast, reuse->old->offsets[first]);
+    if (stmt == NO_NODE) return false;
+    // the parser looks one token past a statement for an else branch
+    size_t last = last_token(reuse->ast, reuse->old, stmt, first);
+    if (first < damage->begin && last + 1 >= damage->begin) return false;
+
+    NodeSpan span = { 0 };
+    if (span_stmt(reuse->ast, stmt, &span)) return true;
+    if (!is_dense(&span)) return false;
+
+    NodeBases bases;
+    if (copy_span(reuse, &span, moved, &bases)) return true;
+    *dst = stmt + bases.stmt;
+
+    // skip its tokens and their payloads
+    for (size_t i = first; i <= last; i++) lexer->payload_pos += has_payload(reuse->old->kinds[i]);
+    lexer->pos += last - first + 1;
+    return false;
+}
+
+// Replace tokens and ast of a program by the ones of program of length len, which is the program
+// after edit.
+// Tokens are lexed again only around the edit, and statements in blocks whose tokens were not
+// edited are copied from ast instead of being parsed again.
+// ast must have been parsed from tokens, which are both freed unless an error occurs.
+// Result is not tagged.
+// Returns whether an error occurred.
+bool reparse(TokenStream** tokens, AST** ast, const char* program, size_t len, TextEdit edit) {
+    Reuse reuse = { .ast = *ast, .old = *tokens };
+    reuse.tokens = retokenize(*tokens, program, len, edit, &reuse.damage);
+    if (reuse.tokens == NULL) return true;
+
+    reused = &reuse;
+    AST* result = parse(reuse.tokens);
+    reused = NULL;
+    if (result == NULL) {
+        free_token_stream((TokenStream*)reuse.tokens);
+        return true;
+    }
+
+    free_ast_p(*ast);
+    free_token_stream(*tokens);
+    *ast = result;
+    *tokens = (TokenStream*)reuse.tokens;
+    return false;
+}
@@ -1,162 +1,132 @@
-#include <stdlib.h>
-
 #include "parser_common.h"
 #include "printerr.h"
 
-TypeSpec parse_type_spec_mod(const Token** it, TypeSpec base);
+spec_t parse_type_spec_mod(Lexer* lexer, spec_t base);
 
-TypeSpec parse_type_spec_group(const Token** it) {
+spec_t parse_type_spec_group(Lexer* lexer) {
     // (
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // inner type specifier
-    TypeSpec group = parse_type_spec(it);
-    if (group.type == ERROR_SPEC) goto err;
+    spec_t group = parse_type_spec(lexer);
+    if (group == NO_NODE) return NO_NODE;
 
     // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_group;
+    if (consume_expected_token(lexer, RPAREN)) return NO_NODE;
 
-    TypeSpec spec;
+    TypeSpec spec = {};
     spec.type = GROUPED_SPEC;
-    spec.line = start.line;
-    spec.col = start.col;
+    spec.pos = start.pos;
+    spec.data.group = group;
 
-    // allocations
-    spec.data.group = malloc_struct(&group, sizeof(TypeSpec));
-    if (spec.data.group == NULL) goto err_free_group;
-
-    return spec;
-err_free_group:
-    free_spec(group);
-err:
-    return (TypeSpec) { .type = ERROR_SPEC };
+    return new_spec(&spec);
 }
 
-TypeSpec parse_fun_spec(const Token** it) {
+spec_t parse_fun_spec(Lexer* lexer) {
     // (a, b?) => c
 
-    TypeSpec item;
-
     // (
-    Token start = *(*it)++;
-    DynArr array = dynarr_create(sizeof(TypeSpec));
+    Token start = next_token(lexer);
+    NodeVec vec = node_vec_create();
 
     // number of optional parameters
-    size_t optional = 0;
-    if ((*it)->type != RPAREN) {
+    uint32_t optional = 0;
+    if (peek_type(lexer, 0) != RPAREN) {
         for (;;) {
             // next parameter type
-            item = parse_type_spec(it);
-            if (item.type == ERROR_SPEC) goto err_free_arr;
+            spec_t item = parse_type_spec(lexer);
+            if (item == NO_NODE) goto err_free_vec;
 
-            if (dynarr_append(&array, &item)) goto err_free_item;
+            if (node_vec_append(&vec, item)) goto err_free_vec;
 
             // optionally ?
-            if ((*it)->type == QMARK) {
-                (*it)++;
+            if (peek_type(lexer, 0) == QMARK) {
+                next_token(lexer);
                 optional++;
             } else if (optional) {
                 // ? is required if already seen
-                error_line = start.line;
-                error_col = start.col;
+                error_pos = start.pos;
                 syntax_error("non-optional parameter after optional parameter\n");
-                goto err_free_arr;
+                goto err_free_vec;
             }
 
             // comma or closing parenthesis
-            if ((*it)->type == COMMA) (*it)++;
-            else if ((*it)->type == RPAREN) break;
+            if (peek_type(lexer, 0) == COMMA) next_token(lexer);
+            else if (peek_type(lexer, 0) == RPAREN) break;
             else {
-                unexpected_token(**it);
-                goto err_free_arr;
+                unexpected_token(*peek(lexer, 0));
+                goto err_free_vec;
             }
         }
     }
-    (*it)++;
+    next_token(lexer);
 
     // =>
-    if (consume_expected_token(it, DARROW)) goto err_free_arr;
+    if (consume_expected_token(lexer, DARROW)) goto err_free_vec;
 
-    // return type
-    TypeSpec ret = parse_type_spec(it);
-    if (ret.type == ERROR_SPEC) goto err_free_arr;
-
-    TypeSpec spec;
+    TypeSpec spec = {};
     spec.type = FUN_SPEC;
-    spec.line = start.line;
-    spec.col = start.col;
-    spec.data.fun.paramc = array.length;
+    spec.pos = start.pos;
+    spec.data.fun.paramc = vec.length;
     spec.data.fun.optc = optional;
-    spec.data.fun.paramt = array.c_arr;
+
+    // return type
+    spec.data.fun.ret = parse_type_spec(lexer);
+    if (spec.data.fun.ret == NO_NODE) goto err_free_vec;
 
     // allocations
-    spec.data.fun.ret = malloc_struct(&ret, sizeof(TypeSpec));
-    if (spec.data.fun.ret == NULL) goto err_free_ret;
-
-    return spec;
-err_free_item:
-    free_spec(item);
-    goto err_free_arr;
-err_free_ret:
-    free_spec(ret);
-err_free_arr:
-    free_spec_dynarr(&array);
-    return (TypeSpec) { .type = ERROR_SPEC };
+    spec.data.fun.paramt = new_list(&vec);
+    if (spec.data.fun.paramt == NO_NODE) return NO_NODE;
+
+    return new_spec(&spec);
+err_free_vec:
+    node_vec_destroy(&vec);
+    return NO_NODE;
 }
 
-TypeSpec handle_type_spec_mod(TypeSpecEnum type, bool mut, const Token** it, TypeSpec base) {
+spec_t handle_type_spec_mod(TypeSpecEnum type, bool mut, Lexer* lexer, spec_t base) {
     // * or [
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     if (start.type == LBRACKET) {
         // ]
-        if (consume_expected_token(it, RBRACKET)) goto err;
+        if (consume_expected_token(lexer, RBRACKET)) return NO_NODE;
     }
 
-    TypeSpec spec;
-    spec.type = type;
-    spec.line = base.line;
-    spec.col = base.col;
-    spec.data.ptr.mutable = mut;
-
-    // allocations
-    spec.data.ptr.spec = malloc_struct(&base, sizeof(TypeSpec));
-    if (spec.data.ptr.spec == NULL) goto err;
+    spec_t id;
+    TypeSpec* spec = place_spec(&id);
+    if (spec == NULL) return NO_NODE;
+    spec->type = type;
+    spec->pos = get_spec(base)->pos;
+    spec->data.ptr.spec = base;
+    spec->data.ptr.mutable = mut;
 
     // may have another modification
-    TypeSpec next = parse_type_spec_mod(it, spec);
-    if (next.type == ERROR_SPEC) goto err_free_alloc;
-
-    return next;
-err_free_alloc:
-    free(spec.data.ptr.spec);
-err:
-    return (TypeSpec) { .type = ERROR_SPEC };
+    return parse_type_spec_mod(lexer, id);
 }
 
-TypeSpec parse_type_spec_mod(const Token** it, TypeSpec base) {
-    switch ((*it)->type) {
+spec_t parse_type_spec_mod(Lexer* lexer, spec_t base) {
+    if (base == NO_NODE) return NO_NODE;
+
+    switch (peek_type(lexer, 0)) {
         // regular modifier
-        case LBRACKET: return handle_type_spec_mod(ARR_SPEC, true, it, base);
-        case STAR:     return handle_type_spec_mod(PTR_SPEC, true, it, base);
+        case LBRACKET: return handle_type_spec_mod(ARR_SPEC, true, lexer, base);
+        case STAR:     return handle_type_spec_mod(PTR_SPEC, true, lexer, base);
 
         case CONST_TOKEN:  // const modifier
-            (*it)++;
-            switch ((*it)->type) {
-                case LBRACKET: return handle_type_spec_mod(ARR_SPEC, false, it, base);
-                case STAR:     return handle_type_spec_mod(PTR_SPEC, false, it, base);
-                default:       unexpected_token(**it); return (TypeSpec) { .type = ERROR_SPEC };
+            next_token(lexer);
+            switch (peek_type(lexer, 0)) {
+                case LBRACKET: return handle_type_spec_mod(ARR_SPEC, false, lexer, base);
+                case STAR:     return handle_type_spec_mod(PTR_SPEC, false, lexer, base);
+                default:       unexpected_token(*peek(lexer, 0)); return NO_NODE;
             }
 
         default: return base;  // no modifier
     }
 }
 
-TypeSpec parse_type_spec(const Token** it) {
-    TypeSpec spec;
-    TypeSpec next;
-
-    switch ((*it)->type) {
+spec_t parse_type_spec(Lexer* lexer) {
+    switch (peek_type(lexer, 0)) {
         // atomic types
         case VOID_TOKEN:
         case BOOL_TOKEN:
@@ -169,27 +139,24 @@ TypeSpec parse_type_spec(const Token** it) {
         case U32_TOKEN:
         case U64_TOKEN:
         case VAR_NAME:
-            Token token = *(*it)++;
-            spec.type = ATOMIC_SPEC;
-            spec.line = token.line;
-            spec.col = token.col;
-            spec.data.atom = token;
-            return parse_type_spec_mod(it, spec);
+            // decoded straight into the AST
+            token_t atom = new_next_token(lexer);
+            if (atom == NO_NODE) return NO_NODE;
+
+            spec_t id;
+            TypeSpec* spec = place_spec(&id);
+            if (spec == NULL) return NO_NODE;
+            spec->type = ATOMIC_SPEC;
+            spec->pos = get_token(atom)->pos;
+            spec->data.atom = atom;
+            return parse_type_spec_mod(lexer, id);
 
         case LPAREN:
-            // check if function type specifier
-            spec = is_lambda(it) ? parse_fun_spec(it) : parse_type_spec_group(it);
-            // modifications
-            next = parse_type_spec_mod(it, spec);
-            if (next.type == ERROR_SPEC) goto err_free_spec;
-            break;
-
-        default: unexpected_token(**it); goto err;
-    }
+            // check if function type specifier, then modifications
+            return parse_type_spec_mod(
+                lexer, is_lambda(lexer) ? parse_fun_spec(lexer) : parse_type_spec_group(lexer)
+            );
 
-    return next;
-err_free_spec:
-    free_spec(spec);
-err:
-    return (TypeSpec) { .type = ERROR_SPEC };
+        default: unexpected_token(*peek(lexer, 0)); return NO_NODE;
+    }
 }
@@ -1,650 +1,555 @@
-#include <stdlib.h>
-
 #include "parser_common.h"
 #include "printerr.h"
 
-Stmt parse_block(const Token** it) {
-    Token start = **it;
-
-    Stmt item;
+stmt_t parse_block(Lexer* lexer) {
+    Token start = *peek(lexer, 0);
+    size_t depth = lexer->depth;
+
+    // initialize vector
+    NodeVec vec = node_vec_create();
+    for (;;) {
+        size_t errors = syntax_errors;
+        stmt_t item = NO_NODE;
+        if (is_statement(lexer)) {
+            // next statement, copied from before an edit if it was not edited
+            if (reused && reuse_next_stmt(lexer, &item)) goto err_free_vec;
+            if (item == NO_NODE) item = parse_stmt(lexer);
+        } else if (ends_block(peek_type(lexer, 0), depth)) {
+            break;
+        } else {
+            unexpected_token(next_token(lexer));
+        }
 
-    // initialize array
-    DynArr array = dynarr_create(sizeof(Stmt));
-    while (is_statement(it)) {
-        // next statement
-        item = parse_stmt(it);
-        if (item.type == ERROR_STMT) goto err_free_arr;
-        if (dynarr_append(&array, &item)) goto err_free_item;
+        if (item == NO_NODE) {
+            // recover from syntax errors up to the limit by skipping to the next statement
+            if (syntax_errors == errors || syntax_errors >= max_syntax_errors) goto err_free_vec;
+            synchronize(lexer, depth);
+            item = new_stmt(&(Stmt) { .type = ERROR_STMT, .pos = error_pos });
+            if (item == NO_NODE) goto err_free_vec;
+        }
+        if (node_vec_append(&vec, item)) goto err_free_vec;
     }
 
-    Stmt stmt;
+    Stmt stmt = {};
     stmt.type = BLOCK;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.block.len = array.length;
-    stmt.data.block.stmts = array.c_arr;
-
-    return stmt;
-err_free_item:
-    free_stmt(item);
-err_free_arr:
-    free_stmt_dynarr(&array);
-    return (Stmt) { .type = ERROR_STMT };
+    stmt.pos = start.pos;
+    stmt.data.block.len = vec.length;
+
+    // allocations
+    stmt.data.block.stmts = new_list(&vec);
+    if (stmt.data.block.stmts == NO_NODE) return NO_NODE;
+
+    return new_stmt(&stmt);
+err_free_vec:
+    node_vec_destroy(&vec);
+    return NO_NODE;
 }
 
-Stmt parse_decl(const Token** it, bool mut) {
+stmt_t parse_decl(Lexer* lexer, bool mut) {
     // var x = y;
     // const x: a = y;
 
     // var or const
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // variable name
-    Token name = **it;
-    if (consume_expected_token(it, VAR_NAME)) goto err;
+    Token name = *peek(lexer, 0);
+    if (consume_expected_token(lexer, VAR_NAME)) return NO_NODE;
+
+    Stmt stmt = {};
+    stmt.type = DECL;
+    stmt.pos = start.pos;
+    stmt.data.decl.mutable = mut;
+    stmt.data.decl.name = new_token(&name);
+    if (stmt.data.decl.name == NO_NODE) return NO_NODE;
 
     // optionally : and type specifier
-    TypeSpec spec = { INFERRED_SPEC, name.line, name.col, {} };
-    if ((*it)->type == COLON) {
-        (*it)++;
+    if (peek_type(lexer, 0) == COLON) {
+        next_token(lexer);
 
-        spec = parse_type_spec(it);
-        if (spec.type == ERROR_SPEC) goto err;
+        stmt.data.decl.spec = parse_type_spec(lexer);
+    } else {
+        stmt.data.decl.spec = new_spec(&(TypeSpec) { .type = INFERRED_SPEC, .pos = name.pos });
     }
+    if (stmt.data.decl.spec == NO_NODE) return NO_NODE;
 
     // =
-    if (consume_expected_token(it, EQ_TOKEN)) goto err_free_spec;
+    if (consume_expected_token(lexer, EQ_TOKEN)) return NO_NODE;
 
     // value
-    Expr val = parse_expr(it, MAX_PRECEDENCE);
-    if (val.type == ERROR_EXPR) goto err_free_spec;
+    stmt.data.decl.val = parse_expr(lexer, MAX_PRECEDENCE);
+    if (stmt.data.decl.val == NO_NODE) return NO_NODE;
 
     // ;
-    if (consume_expected_token(it, SEMICOLON)) goto err_free_val;
+    if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
 
-    Stmt stmt;
-    stmt.type = DECL;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.decl.name = name;
-    stmt.data.decl.val = val;
-    stmt.data.decl.spec = spec;
-    stmt.data.decl.mutable = mut;
-
-    return stmt;
-err_free_val:
-    free_expr(val);
-err_free_spec:
-    free_spec(spec);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_typedef(const Token** it) {
+stmt_t parse_typedef(Lexer* lexer) {
     // type x = a;
 
     // type
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // variable name =
-    Token name = **it;
-    if (consume_expected_token(it, VAR_NAME) || consume_expected_token(it, EQ_TOKEN)) goto err;
+    Token name = *peek(lexer, 0);
+    if (consume_expected_token(lexer, VAR_NAME) || consume_expected_token(lexer, EQ_TOKEN)) {
+        return NO_NODE;
+    }
+
+    Stmt stmt = {};
+    stmt.type = TYPEDEF;
+    stmt.pos = start.pos;
+    stmt.data.type.name = new_token(&name);
+    if (stmt.data.type.name == NO_NODE) return NO_NODE;
 
     // value
-    TypeSpec val = parse_type_spec(it);
-    if (val.type == ERROR_SPEC) goto err;
+    stmt.data.type.val = parse_type_spec(lexer);
+    if (stmt.data.type.val == NO_NODE) return NO_NODE;
 
     // ;
-    if (consume_expected_token(it, SEMICOLON)) goto err_free_val;
+    if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
 
-    Stmt stmt;
-    stmt.type = TYPEDEF;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.type.name = name;
-    stmt.data.type.val = val;
-
-    return stmt;
-err_free_val:
-    free_spec(val);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_ifelse(const Token** it) {
+stmt_t parse_ifelse(Lexer* lexer) {
     // if (x) f
     // if (x) f else g
 
     // if
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // (
-    if (consume_expected_token(it, LPAREN)) goto err;
+    if (consume_expected_token(lexer, LPAREN)) return NO_NODE;
+
+    Stmt stmt = {};
+    stmt.type = IFELSE_STMT;
+    stmt.pos = start.pos;
 
     // condition
-    Expr condition = parse_expr(it, MAX_PRECEDENCE);
-    if (condition.type == ERROR_EXPR) goto err;
+    stmt.data.ifelse.condition = parse_expr(lexer, MAX_PRECEDENCE);
+    if (stmt.data.ifelse.condition == NO_NODE) return NO_NODE;
 
     // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_cond;
+    if (consume_expected_token(lexer, RPAREN)) return NO_NODE;
 
     // if branch
-    Stmt on_true = parse_stmt(it);
-    Stmt on_false;
-    if (on_true.type == ERROR_STMT) goto err_free_cond;
-
-    Stmt stmt;
-    stmt.type = IFELSE_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.ifelse.condition = condition;
-    stmt.data.ifelse.on_true = NULL;
-    stmt.data.ifelse.on_false = NULL;
+    stmt.data.ifelse.on_true = parse_stmt(lexer);
+    if (stmt.data.ifelse.on_true == NO_NODE) return NO_NODE;
 
     // optionally else and branch
-    if ((*it)->type == ELSE_TOKEN) {
-        (*it)++;
-
-        on_false = parse_stmt(it);
-        if (on_false.type == ERROR_STMT) goto err_free_true;
+    stmt.data.ifelse.on_false = NO_NODE;
+    if (peek_type(lexer, 0) == ELSE_TOKEN) {
+        next_token(lexer);
 
-        // allocations
-        stmt.data.ifelse.on_false = malloc_struct(&on_false, sizeof(Stmt));
-        if (stmt.data.ifelse.on_false == NULL) goto err_free_false;
+        stmt.data.ifelse.on_false = parse_stmt(lexer);
+        if (stmt.data.ifelse.on_false == NO_NODE) return NO_NODE;
     }
 
-    // allocations
-    stmt.data.ifelse.on_true = malloc_struct(&on_true, sizeof(Stmt));
-    if (stmt.data.ifelse.on_true == NULL) goto err_free_false_alloc;
-
-    return stmt;
-err_free_false_alloc:
-    if (stmt.data.ifelse.on_false == NULL) goto err_free_true;
-    free(stmt.data.ifelse.on_false);
-err_free_false:
-    free_stmt(on_false);
-err_free_true:
-    free_stmt(on_true);
-err_free_cond:
-    free_expr(condition);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_switch(const Token** it) {
+stmt_t parse_switch(Lexer* lexer) {
     // switch (x) {
     //     case y: f
     //     default: g
     // }
 
     // switch
-    Token start = *(*it)++;
-
-    Expr case_value;
-    Stmt branch_value;
+    Token start = next_token(lexer);
 
     // (
-    if (consume_expected_token(it, LPAREN)) goto err;
+    if (consume_expected_token(lexer, LPAREN)) return NO_NODE;
 
     // expression to switch on
-    Expr expr = parse_expr(it, MAX_PRECEDENCE);
-    if (expr.type == ERROR_EXPR) goto err;
+    expr_t expr = parse_expr(lexer, MAX_PRECEDENCE);
+    if (expr == NO_NODE) return NO_NODE;
 
     // ) {
-    if (consume_expected_token(it, RPAREN) || consume_expected_token(it, LBRACE)) {
-        goto err_free_expr;
+    if (consume_expected_token(lexer, RPAREN) || consume_expected_token(lexer, LBRACE)) {
+        return NO_NODE;
     }
 
-    DynArr case_array = dynarr_create(sizeof(Expr));
-    DynArr branch_array = dynarr_create(sizeof(Stmt));
+    NodeVec cases = node_vec_create();
+    NodeVec branches = node_vec_create();
 
     size_t default_index = 0;
-    while ((*it)->type != RBRACE) {
+    while (peek_type(lexer, 0) != RBRACE) {
         // case or default
-        case_value = (Expr) { NO_EXPR, (*it)->line, (*it)->col, {}, NULL };
-        switch ((*it)->type) {
+        expr_t case_value;
+        switch (peek_type(lexer, 0)) {
             case CASE_TOKEN:
-                (*it)++;
+                next_token(lexer);
                 // label value
-                case_value = parse_expr(it, MAX_PRECEDENCE);
-                if (case_value.type == ERROR_EXPR) goto err_free_arrs;
+                case_value = parse_expr(lexer, MAX_PRECEDENCE);
+                if (case_value == NO_NODE) goto err_free_vecs;
                 // if default not found, keep default index out of bounds
-                if (default_index == case_array.length) default_index++;
+                if (default_index == cases.length) default_index++;
                 break;
             case DEFAULT_TOKEN:
                 // already encountered default
-                if (default_index != case_array.length) {
-                    error_line = (*it)->line;
-                    error_col = (*it)->col;
+                if (default_index != cases.length) {
+                    error_pos = peek(lexer, 0)->pos;
                     syntax_error("multiple default labels in switch\n");
-                    goto err_free_arrs;
+                    goto err_free_vecs;
                 }
-                (*it)++;
+                case_value = new_expr(&(Expr) { .type = NO_EXPR, .pos = next_token(lexer).pos });
+                if (case_value == NO_NODE) goto err_free_vecs;
                 break;
 
-            default: unexpected_token(**it); goto err_free_arrs;
+            default: unexpected_token(*peek(lexer, 0)); goto err_free_vecs;
         }
 
         // :
-        if (consume_expected_token(it, COLON)) goto err_free_case_val;
+        if (consume_expected_token(lexer, COLON)) goto err_free_vecs;
 
         // case branch
-        branch_value = parse_block(it);
-        if (branch_value.type == ERROR_STMT) goto err_free_case_val;
+        stmt_t branch_value = parse_block(lexer);
+        if (branch_value == NO_NODE) goto err_free_vecs;
 
-        if (dynarr_append(&case_array, &case_value) || dynarr_append(&branch_array, &branch_value))
-        {
-            goto err_free_branch_val;
+        if (node_vec_append(&cases, case_value) || node_vec_append(&branches, branch_value)) {
+            goto err_free_vecs;
         }
     }
-    (*it)++;
+    next_token(lexer);
 
-    Stmt stmt;
+    Stmt stmt = {};
     stmt.type = SWITCH_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
+    stmt.pos = start.pos;
     stmt.data.switchcase.expr = expr;
-    stmt.data.switchcase.casec = case_array.length;
-    stmt.data.switchcase.casev = case_array.c_arr;
-    stmt.data.switchcase.branchv = branch_array.c_arr;
+    stmt.data.switchcase.casec = cases.length;
     stmt.data.switchcase.defaulti = default_index;
 
-    return stmt;
-err_free_branch_val:
-    free_stmt(branch_value);
-err_free_case_val:
-    free_expr(case_value);
-err_free_arrs:
-    free_expr_dynarr(&case_array);
-    free_stmt_dynarr(&branch_array);
-err_free_expr:
-    free_expr(expr);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    // allocations
+    stmt.data.switchcase.casev = new_list(&cases);
+    stmt.data.switchcase.branchv = new_list(&branches);
+    if (stmt.data.switchcase.casev == NO_NODE || stmt.data.switchcase.branchv == NO_NODE) {
+        return NO_NODE;
+    }
+
+    return new_stmt(&stmt);
+err_free_vecs:
+    node_vec_destroy(&cases);
+    node_vec_destroy(&branches);
+    return NO_NODE;
 }
 
-Stmt parse_while(const Token** it) {
+stmt_t parse_while(Lexer* lexer) {
     // while (x) f
 
     // while
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // (
-    if (consume_expected_token(it, LPAREN)) goto err;
+    if (consume_expected_token(lexer, LPAREN)) return NO_NODE;
+
+    Stmt stmt = {};
+    stmt.type = WHILE_STMT;
+    stmt.pos = start.pos;
 
     // condition
-    Expr condition = parse_expr(it, MAX_PRECEDENCE);
-    if (condition.type == ERROR_EXPR) goto err;
+    stmt.data.whileloop.condition = parse_expr(lexer, MAX_PRECEDENCE);
+    if (stmt.data.whileloop.condition == NO_NODE) return NO_NODE;
 
     // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_cond;
+    if (consume_expected_token(lexer, RPAREN)) return NO_NODE;
 
     // loop body
-    Stmt body = parse_stmt(it);
-    if (body.type == ERROR_STMT) goto err_free_cond;
+    stmt.data.whileloop.body = parse_stmt(lexer);
+    if (stmt.data.whileloop.body == NO_NODE) return NO_NODE;
 
-    Stmt stmt;
-    stmt.type = WHILE_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.whileloop.condition = condition;
-
-    // allocations
-    stmt.data.whileloop.body = malloc_struct(&body, sizeof(Stmt));
-    if (stmt.data.whileloop.body == NULL) goto err_free_body;
-
-    return stmt;
-err_free_body:
-    free_stmt(body);
-err_free_cond:
-    free_expr(condition);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_dowhile(const Token** it) {
+stmt_t parse_dowhile(Lexer* lexer) {
     // do f while (x);
 
     // do
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
+
+    Stmt stmt = {};
+    stmt.type = DOWHILE_STMT;
+    stmt.pos = start.pos;
 
     // loop body
-    Stmt body = parse_stmt(it);
-    if (body.type == ERROR_STMT) goto err;
+    stmt.data.whileloop.body = parse_stmt(lexer);
+    if (stmt.data.whileloop.body == NO_NODE) return NO_NODE;
 
     // while (
-    if (consume_expected_token(it, WHILE_TOKEN) || consume_expected_token(it, LPAREN)) {
-        goto err_free_body;
+    if (consume_expected_token(lexer, WHILE_TOKEN) || consume_expected_token(lexer, LPAREN)) {
+        return NO_NODE;
     }
 
     // condition
-    Expr condition = parse_expr(it, MAX_PRECEDENCE);
-    if (condition.type == ERROR_EXPR) goto err_free_body;
+    stmt.data.whileloop.condition = parse_expr(lexer, MAX_PRECEDENCE);
+    if (stmt.data.whileloop.condition == NO_NODE) return NO_NODE;
 
     // ) ;
-    if (consume_expected_token(it, RPAREN) || consume_expected_token(it, SEMICOLON)) {
-        goto err_free_cond;
+    if (consume_expected_token(lexer, RPAREN) || consume_expected_token(lexer, SEMICOLON)) {
+        return NO_NODE;
     }
 
-    Stmt stmt;
-    stmt.type = DOWHILE_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.whileloop.condition = condition;
-
-    // allocations
-    stmt.data.whileloop.body = malloc_struct(&body, sizeof(Stmt));
-    if (stmt.data.whileloop.body == NULL) goto err_free_cond;
-
-    return stmt;
-err_free_cond:
-    free_expr(condition);
-err_free_body:
-    free_stmt(body);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_for(const Token** it) {
+stmt_t parse_for(Lexer* lexer) {
     // for (x; y; z) f
     // for (var x = y; z; w) f
     // for (;;) f
 
     // for
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // (
-    if (consume_expected_token(it, LPAREN)) goto err;
+    if (consume_expected_token(lexer, LPAREN)) return NO_NODE;
+
+    Stmt stmt = {};
+    stmt.type = FOR_STMT;
+    stmt.pos = start.pos;
 
     // expr, decl or nop
-    const Token* branch = *it;
-    Stmt init = parse_stmt(it);
-    switch (init.type) {
+    Token branch = *peek(lexer, 0);
+    stmt.data.forloop.init = parse_stmt(lexer);
+    if (stmt.data.forloop.init == NO_NODE) return NO_NODE;
+    switch (get_stmt(stmt.data.forloop.init)->type) {
         case NOP:
         case DECL:
         case EXPR_STMT: break;
 
-        case ERROR_STMT: goto err;
-
-        default:
-            *it = branch;
-            unexpected_token(**it);
-            goto err_free_init;
+        default: unexpected_token(branch); return NO_NODE;
     }
 
     // middle expression
-    Expr condition = { NO_EXPR, (*it)->line, (*it)->col, {}, NULL };
-    if ((*it)->type != SEMICOLON) {
-        condition = parse_expr(it, MAX_PRECEDENCE);
-        if (condition.type == ERROR_EXPR) goto err_free_init;
+    if (peek_type(lexer, 0) != SEMICOLON) {
+        stmt.data.forloop.condition = parse_expr(lexer, MAX_PRECEDENCE);
+    } else {
+        Expr empty = { .type = NO_EXPR, .pos = peek(lexer, 0)->pos };
+        stmt.data.forloop.condition = new_expr(&empty);
     }
+    if (stmt.data.forloop.condition == NO_NODE) return NO_NODE;
     // ;
-    if (consume_expected_token(it, SEMICOLON)) goto err_free_cond;
+    if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
 
     // rightmost expression
-    Expr expr = { NO_EXPR, (*it)->line, (*it)->col, {}, NULL };
-    if ((*it)->type != RPAREN) {
-        expr = parse_expr(it, MAX_PRECEDENCE);
-        if (expr.type == ERROR_EXPR) goto err_free_cond;
+    if (peek_type(lexer, 0) != RPAREN) {
+        stmt.data.forloop.expr = parse_expr(lexer, MAX_PRECEDENCE);
+    } else {
+        Expr empty = { .type = NO_EXPR, .pos = peek(lexer, 0)->pos };
+        stmt.data.forloop.expr = new_expr(&empty);
     }
+    if (stmt.data.forloop.expr == NO_NODE) return NO_NODE;
     // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_expr;
+    if (consume_expected_token(lexer, RPAREN)) return NO_NODE;
 
     // loop body
-    Stmt body = parse_stmt(it);
-    if (body.type == ERROR_STMT) goto err_free_expr;
+    stmt.data.forloop.body = parse_stmt(lexer);
+    if (stmt.data.forloop.body == NO_NODE) return NO_NODE;
 
-    Stmt stmt;
-    stmt.type = FOR_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.forloop.condition = condition;
-    stmt.data.forloop.expr = expr;
-
-    // allocations
-    stmt.data.forloop.init = malloc_struct(&init, sizeof(Stmt));
-    stmt.data.forloop.body = malloc_struct(&body, sizeof(Stmt));
-    if (stmt.data.forloop.init == NULL || stmt.data.forloop.body == NULL) goto err_free_allocs;
-
-    return stmt;
-err_free_allocs:
-    free(stmt.data.forloop.init);
-    free(stmt.data.forloop.body);
-    free_stmt(body);
-err_free_expr:
-    free_expr(expr);
-err_free_cond:
-    free_expr(condition);
-err_free_init:
-    free_stmt(init);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_function(const Token** it) {
+stmt_t parse_function(Lexer* lexer) {
     // fn f(x: a, y: b = 1): 1 {...}
 
     // fn
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // variable name (
-    Token name = **it;
-    if (consume_expected_token(it, VAR_NAME) || consume_expected_token(it, LPAREN)) goto err;
+    Token name = *peek(lexer, 0);
+    if (consume_expected_token(lexer, VAR_NAME) || consume_expected_token(lexer, LPAREN)) {
+        return NO_NODE;
+    }
 
-    Stmt stmt;
+    Stmt stmt = {};
     stmt.type = FUNCTION_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.fun.name = name;
+    stmt.pos = start.pos;
+    stmt.data.fun.name = new_token(&name);
+    if (stmt.data.fun.name == NO_NODE) return NO_NODE;
 
     // parameters
-    if (parse_params(
-            it, &stmt.data.fun.paramc, &stmt.data.fun.optc, &stmt.data.fun.paramv,
-            &stmt.data.fun.paramt, &stmt.data.fun.paramd
-        ))
-    {
-        goto err;
+    if (parse_params(lexer, &stmt.data.fun.paramc, &stmt.data.fun.optc, &stmt.data.fun.params)) {
+        return NO_NODE;
     }
 
     // )
-    if (consume_expected_token(it, RPAREN)) goto err_free_params;
+    if (consume_expected_token(lexer, RPAREN)) return NO_NODE;
 
     // optionally : and type specifier
-    stmt.data.fun.ret = (TypeSpec) { INFERRED_SPEC, start.line, start.col, {} };
-    if ((*it)->type == COLON) {
-        (*it)++;
+    if (peek_type(lexer, 0) == COLON) {
+        next_token(lexer);
 
-        stmt.data.fun.ret = parse_type_spec(it);
-        if (stmt.data.fun.ret.type == ERROR_SPEC) goto err_free_params;
+        stmt.data.fun.ret = parse_type_spec(lexer);
+    } else {
+        stmt.data.fun.ret = new_spec(&(TypeSpec) { .type = INFERRED_SPEC, .pos = start.pos });
     }
+    if (stmt.data.fun.ret == NO_NODE) return NO_NODE;
 
     // {
-    if (consume_expected_token(it, LBRACE)) goto err_free_ret;
+    if (consume_expected_token(lexer, LBRACE)) return NO_NODE;
 
     // function body
-    Stmt body = parse_block(it);
-    if (body.type == ERROR_STMT) goto err_free_ret;
+    stmt.data.fun.body = parse_block(lexer);
+    if (stmt.data.fun.body == NO_NODE) return NO_NODE;
 
     // }
-    if (consume_expected_token(it, RBRACE)) goto err_free_body;
+    if (consume_expected_token(lexer, RBRACE)) return NO_NODE;
 
-    // allocations
-    stmt.data.fun.body = malloc_struct(&body, sizeof(Stmt));
-    if (stmt.data.fun.body == NULL) goto err_free_body;
-
-    return stmt;
-err_free_body:
-    free_stmt(body);
-err_free_ret:
-    free_spec(stmt.data.fun.ret);
-err_free_params:
-    free(stmt.data.fun.paramv);
-    free_spec_arrn(stmt.data.fun.paramt, stmt.data.fun.paramc);
-    free_expr_arrn(stmt.data.fun.paramd, stmt.data.fun.paramc);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
 
-Stmt parse_struct(const Token** it) {
+stmt_t parse_struct(Lexer* lexer) {
     // struct s {
     //     x: a,
     //     y: b = 1
     // }
 
     // struct
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // variable name {
-    Token name = **it;
-    if (consume_expected_token(it, VAR_NAME) || consume_expected_token(it, LBRACE)) goto err;
+    Token name = *peek(lexer, 0);
+    if (consume_expected_token(lexer, VAR_NAME) || consume_expected_token(lexer, LBRACE)) {
+        return NO_NODE;
+    }
 
-    Stmt stmt;
+    Stmt stmt = {};
     stmt.type = STRUCT_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.structdef.name = name;
+    stmt.pos = start.pos;
+    stmt.data.structdef.name = new_token(&name);
+    if (stmt.data.structdef.name == NO_NODE) return NO_NODE;
 
     // members
     if (parse_params(
-            it, &stmt.data.structdef.paramc, &stmt.data.structdef.optc, &stmt.data.structdef.paramv,
-            &stmt.data.structdef.paramt, &stmt.data.structdef.paramd
+            lexer, &stmt.data.structdef.paramc, &stmt.data.structdef.optc,
+            &stmt.data.structdef.params
         ))
     {
-        goto err;
+        return NO_NODE;
     }
 
     // }
-    if (consume_expected_token(it, RBRACE)) goto err_free_params;
-
-    return stmt;
-err_free_params:
-    free(stmt.data.structdef.paramv);
-    free_spec_arrn(stmt.data.structdef.paramt, stmt.data.structdef.paramc);
-    free_expr_arrn(stmt.data.structdef.paramd, stmt.data.structdef.paramc);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    if (consume_expected_token(lexer, RBRACE)) return NO_NODE;
+
+    return new_stmt(&stmt);
 }
 
-Stmt parse_enum(const Token** it) {
+stmt_t parse_enum(Lexer* lexer) {
     // enum e { x, y, z }
 
     // enum
-    Token start = *(*it)++;
+    Token start = next_token(lexer);
 
     // variable name {
-    Token name = **it;
-    if (consume_expected_token(it, VAR_NAME) || consume_expected_token(it, LBRACE)) goto err;
+    Token name = *peek(lexer, 0);
+    if (consume_expected_token(lexer, VAR_NAME) || consume_expected_token(lexer, LBRACE)) {
+        return NO_NODE;
+    }
 
-    // initialize array
-    DynArr array = dynarr_create(sizeof(Token));
+    Stmt stmt = {};
+    stmt.type = ENUM_STMT;
+    stmt.pos = start.pos;
+    stmt.data.enumdef.name = new_token(&name);
+    if (stmt.data.enumdef.name == NO_NODE) return NO_NODE;
 
-    if ((*it)->type != RBRACE) {
+    // initialize vector
+    NodeVec vec = node_vec_create();
+
+    if (peek_type(lexer, 0) != RBRACE) {
         for (;;) {
             // element in enum
-            Token item = **it;
-            if (consume_expected_token(it, VAR_NAME)) goto err_free_arr;
-            if (dynarr_append(&array, &item)) goto err_free_arr;
+            Token item = *peek(lexer, 0);
+            if (consume_expected_token(lexer, VAR_NAME)) goto err_free_vec;
+            token_t token = new_token(&item);
+            if (token == NO_NODE || node_vec_append(&vec, token)) goto err_free_vec;
 
             // comma or closing parenthesis
-            if ((*it)->type == COMMA) (*it)++;
-            else if ((*it)->type == RBRACE) break;
+            if (peek_type(lexer, 0) == COMMA) next_token(lexer);
+            else if (peek_type(lexer, 0) == RBRACE) break;
             else {
-                unexpected_token(**it);
-                goto err_free_arr;
+                unexpected_token(*peek(lexer, 0));
+                goto err_free_vec;
             }
         }
     }
-    (*it)++;
+    next_token(lexer);
 
-    Stmt stmt;
-    stmt.type = ENUM_STMT;
-    stmt.line = start.line;
-    stmt.col = start.col;
-    stmt.data.enumdef.name = name;
-    stmt.data.enumdef.len = array.length;
-    stmt.data.enumdef.items = array.c_arr;
-
-    return stmt;
-err_free_arr:
-    dynarr_destroy(&array);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    stmt.data.enumdef.len = vec.length;
+
+    // allocations
+    stmt.data.enumdef.items = new_list(&vec);
+    if (stmt.data.enumdef.items == NO_NODE) return NO_NODE;
+
+    return new_stmt(&stmt);
+err_free_vec:
+    node_vec_destroy(&vec);
+    return NO_NODE;
 }
 
-Stmt parse_stmt(const Token** it) {
-    Stmt stmt;
-    Expr expr;
+stmt_t parse_stmt(Lexer* lexer) {
+    Stmt stmt = {};
 
-    switch ((*it)->type) {
+    switch (peek_type(lexer, 0)) {
         case SEMICOLON:
             stmt.type = NOP;
-            stmt.line = (*it)->line;
-            stmt.col = (*it)->col;
-            (*it)++;
+            stmt.pos = peek(lexer, 0)->pos;
+            next_token(lexer);
             break;
 
-        case VAR_TOKEN:   return parse_decl(it, true);
-        case CONST_TOKEN: return parse_decl(it, false);
-        case TYPE_TOKEN:  return parse_typedef(it);
+        case VAR_TOKEN:   return parse_decl(lexer, true);
+        case CONST_TOKEN: return parse_decl(lexer, false);
+        case TYPE_TOKEN:  return parse_typedef(lexer);
 
-        case IF_TOKEN:     return parse_ifelse(it);
-        case SWITCH_TOKEN: return parse_switch(it);
-        case WHILE_TOKEN:  return parse_while(it);
-        case DO_TOKEN:     return parse_dowhile(it);
-        case FOR_TOKEN:    return parse_for(it);
+        case IF_TOKEN:     return parse_ifelse(lexer);
+        case SWITCH_TOKEN: return parse_switch(lexer);
+        case WHILE_TOKEN:  return parse_while(lexer);
+        case DO_TOKEN:     return parse_dowhile(lexer);
+        case FOR_TOKEN:    return parse_for(lexer);
 
-        case FN_TOKEN:     return parse_function(it);
-        case STRUCT_TOKEN: return parse_struct(it);
-        case ENUM_TOKEN:   return parse_enum(it);
+        case FN_TOKEN:     return parse_function(lexer);
+        case STRUCT_TOKEN: return parse_struct(lexer);
+        case ENUM_TOKEN:   return parse_enum(lexer);
 
         case RETURN_TOKEN:
             stmt.type = RETURN_STMT;
-            stmt.line = (*it)->line;
-            stmt.col = (*it)->col;
-            (*it)++;
-            if ((*it)->type == SEMICOLON) {
-                (*it)++;
-                stmt.data.expr = (Expr) { NO_EXPR, stmt.line, stmt.col, {}, NULL };
+            stmt.pos = peek(lexer, 0)->pos;
+            next_token(lexer);
+            if (peek_type(lexer, 0) == SEMICOLON) {
+                next_token(lexer);
+                stmt.data.expr = new_expr(&(Expr) { .type = NO_EXPR, .pos = stmt.pos });
+                if (stmt.data.expr == NO_NODE) return NO_NODE;
                 break;
             }
-            expr = parse_expr(it, MAX_PRECEDENCE);
-            if (expr.type == ERROR_EXPR) goto err;
+            stmt.data.expr = parse_expr(lexer, MAX_PRECEDENCE);
+            if (stmt.data.expr == NO_NODE) return NO_NODE;
             // ;
-            if (consume_expected_token(it, SEMICOLON)) goto err_free_expr;
-            stmt.data.expr = expr;
+            if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
             break;
         case BREAK_TOKEN:
             stmt.type = BREAK_STMT;
-            stmt.line = (*it)->line;
-            stmt.col = (*it)->col;
-            (*it)++;
+            stmt.pos = peek(lexer, 0)->pos;
+            next_token(lexer);
             // ;
-            if (consume_expected_token(it, SEMICOLON)) goto err;
+            if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
             break;
         case CONTINUE_TOKEN:
             stmt.type = CONTINUE_STMT;
-            stmt.line = (*it)->line;
-            stmt.col = (*it)->col;
-            (*it)++;
+            stmt.pos = peek(lexer, 0)->pos;
+            next_token(lexer);
             // ;
-            if (consume_expected_token(it, SEMICOLON)) goto err;
+            if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
             break;
 
         default:  // expr
-            expr = parse_expr(it, MAX_PRECEDENCE);
-            if (expr.type == ERROR_EXPR) goto err;
-            // ;
-            if (consume_expected_token(it, SEMICOLON)) goto err_free_expr;
             stmt.type = EXPR_STMT;
-            stmt.line = expr.line;
-            stmt.col = expr.col;
-            stmt.data.expr = expr;
+            stmt.data.expr = parse_expr(lexer, MAX_PRECEDENCE);
+            if (stmt.data.expr == NO_NODE) return NO_NODE;
+            stmt.pos = get_expr(stmt.data.expr)->pos;
+            // ;
+            if (consume_expected_token(lexer, SEMICOLON)) return NO_NODE;
             break;
     }
 
-    return stmt;
-err_free_expr:
-    free_expr(expr);
-err:
-    return (Stmt) { .type = ERROR_STMT };
+    return new_stmt(&stmt);
 }
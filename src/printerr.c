@@ -3,31 +3,100 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include "memutils.h"
+
 const char* error_filename = NULL;
-size_t error_line = 0, error_col = 0;
+_Thread_local pos_t error_pos = 0;
+// set by threads whose errors are reported again by another pass
+_Thread_local bool errors_muted = false;
+// counted even when muted, reset by the parser
+_Thread_local size_t syntax_errors = 0;
+// set while looking ahead, so that syntax errors are kept in deferred_error instead of written
+_Thread_local bool errors_deferred = false;
+// last deferred syntax error, taken by whoever reports it later
+_Thread_local char* deferred_error = NULL;
+
+// Keep error and formatted output in deferred_error, replacing the previous one.
+void defer_syntax_error(const char* format, va_list args) {
+    size_t line = source_line(error_pos);
+    size_t col = source_col(error_pos);
+    const char* prefix = "%s:%zu:%zu: syntax error: ";
+
+    va_list copy;
+    va_copy(copy, args);
+    int prefix_len = snprintf(NULL, 0, prefix, error_filename, line, col);
+    int len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (prefix_len < 0 || len < 0) return;
+
+    char* error = mem_alloc(prefix_len + len + 1, ARRAY_MEM);
+    if (error == NULL) {
+        malloc_error();
+        return;
+    }
+    snprintf(error, prefix_len + 1, prefix, error_filename, line, col);
+    vsnprintf(error + prefix_len, len + 1, format, args);
+
+    mem_free(deferred_error);
+    deferred_error = error;
+}
 
 // Write error and formatted output to stderr.
 void syntax_error(const char* format, ...) {
+    syntax_errors++;
+    if (errors_muted) return;
     va_list args;
     va_start(args, format);
-    fprintf(stderr, "%s:%zu:%zu: syntax error: ", error_filename, error_line, error_col);
+    if (errors_deferred) {
+        defer_syntax_error(format, args);
+        va_end(args);
+        return;
+    }
+    fprintf(
+        stderr, "%s:%zu:%zu: syntax error: ", error_filename, source_line(error_pos),
+        source_col(error_pos)
+    );
     vfprintf(stderr, format, args);
 }
 
 // Write error and formatted output to stderr.
 void type_error(const char* format, ...) {
+    if (errors_muted) return;
     va_list args;
     va_start(args, format);
-    fprintf(stderr, "%s:%zu:%zu: type error: ", error_filename, error_line, error_col);
+    fprintf(
+        stderr, "%s:%zu:%zu: type error: ", error_filename, source_line(error_pos),
+        source_col(error_pos)
+    );
     vfprintf(stderr, format, args);
 }
 
 // Write error message to stderr.
 void malloc_error(void) {
+    if (errors_muted) return;
     fprintf(stderr, "error: memory allocation failed\n");
 }
 
 // Write error message to stderr.
 void fread_error(void) {
+    if (errors_muted) return;
     fprintf(stderr, "%s: error: cannot read file\n", error_filename);
 }
+
+// Write error message to stderr.
+void fsize_error(void) {
+    if (errors_muted) return;
+    fprintf(stderr, "%s: error: file is too large\n", error_filename);
+}
+
+// Write error message to stderr.
+void fwrite_error(void) {
+    if (errors_muted) return;
+    fprintf(stderr, "%s: error: cannot write file\n", error_filename);
+}
+
+// Write error message to stderr.
+void fformat_error(void) {
+    if (errors_muted) return;
+    fprintf(stderr, "%s: error: unsupported file format\n", error_filename);
+}
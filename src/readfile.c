@@ -1,51 +1,104 @@
+// madvise and MAP_POPULATE are not part of strict C
+#define _DEFAULT_SOURCE
+
 #include "readfile.h"
 
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "memutils.h"
 #include "printerr.h"
 
-// Read entire file to string.
-// Returns NULL on error.
-char* readfile(const char* filename) {
-    if (filename == NULL) return NULL;
+#if defined(__unix__) || defined(__APPLE__)
+#define READFILE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
-    // open file
-    FILE* fp = fopen(filename, "rb");
-    if (fp == NULL) {
-        fread_error();
-        return NULL;
+// bytes read at a time from files that cannot be mapped
+#define READ_CHUNK_SIZE 65536
+
+// Read the rest of fp into an allocation.
+// Returns a FileText with a NULL text on error.
+FileText read_stream(FILE* fp) {
+    FileText file = { NULL, 0, false };
+    char* text = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        if (file.len == capacity) {
+            capacity = capacity ? capacity * 2 : READ_CHUNK_SIZE;
+            char* grown = mem_realloc(text, capacity, SOURCE_MEM);
+            if (grown == NULL) {
+                malloc_error();
+                mem_free(text);
+                return file;
+            }
+            text = grown;
+        }
+
+        size_t room = capacity - file.len;
+        size_t len = fread(text + file.len, 1, room, fp);
+        file.len += len;
+        if (len < room) break;
     }
 
-    // get file size
-    fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    if (errno) {
+    if (ferror(fp)) {
         fread_error();
-        fclose(fp);
-        return NULL;
+        mem_free(text);
+        return (FileText) { NULL, 0, false };
     }
+    file.text = text;
+    return file;
+}
 
-    // allocate string
-    char* content = malloc(size + 1);
-    if (content == NULL) {
-        malloc_error();
-        fclose(fp);
-        return NULL;
-    }
+// Map the file filename into memory, or read it if it cannot be mapped, like pipes.
+// The filename - reads standard input.
+// If populate is set the whole file is read ahead instead of on first access.
+// Returns a FileText with a NULL text on error.
+FileText map_file(const char* filename, bool populate) {
+    if (filename == NULL) return (FileText) { NULL, 0, false };
 
-    // read file
-    if (size > fread(content, 1, size, fp)) {
+    // open file
+    bool is_stdin = strcmp(filename, "-") == 0;
+    FILE* fp = is_stdin ? stdin : fopen(filename, "rb");
+    if (fp == NULL) {
         fread_error();
-        fclose(fp);
-        free(content);
-        return NULL;
+        return (FileText) { NULL, 0, false };
     }
 
-    // close and add null terminator
-    fclose(fp);
-    content[size] = '\0';
-    return content;
+#ifdef READFILE_MMAP
+    // only regular files can be mapped, and empty mappings are invalid
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        if (populate) flags |= MAP_POPULATE;
+#endif
+        void* text = mmap(NULL, st.st_size, PROT_READ, flags, fileno(fp), 0);
+        if (text != MAP_FAILED) {
+            // the source is lexed front to back
+            madvise(text, st.st_size, MADV_SEQUENTIAL);
+            if (!is_stdin) fclose(fp);
+            return (FileText) { text, st.st_size, true };
+        }
+    }
+#else
+    (void)populate;
+#endif
+
+    FileText file = read_stream(fp);
+    if (!is_stdin) fclose(fp);
+    return file;
+}
+
+// Free the contents of file.
+void unmap_file(FileText* file) {
+#ifdef READFILE_MMAP
+    if (file->mapped) munmap((void*)file->text, file->len);
+#endif
+    if (!file->mapped) mem_free((char*)file->text);
+    file->text = NULL;
+    file->len = 0;
+    file->mapped = false;
 }
@@ -0,0 +1,277 @@
+#include "scan.h"
+
+#include <stdbool.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+// Check whether chr is a letter, digit or underscore.
+bool is_word_chr(char chr) {
+    unsigned char c = chr;
+    return (unsigned char)((c | 0x20) - 'a') < 26 || (unsigned char)(c - '0') < 10 || c == '_';
+}
+
+const char* skip_spaces_scalar(const char* it, const char* end) {
+    while (it < end && *it == ' ') it++;
+    return it;
+}
+
+const char* find_line_end_scalar(const char* it, const char* end) {
+    while (it < end && *it != '\n') it++;
+    return it;
+}
+
+const char* find_word_end_scalar(const char* it, const char* end) {
+    while (it < end && is_word_chr(*it)) it++;
+    return it;
+}
+
+const char* find_literal_end_scalar(const char* it, const char* end, char quote) {
+    while (it < end && *it != '\\' && *it != quote && *it != '\n' && *it != '\0') it++;
+    return it;
+}
+
+#ifdef SCAN_X86
+
+// Bytes of v in the unsigned range [lo, lo + n) as a byte mask.
+__attribute__((target("sse2"))) __m128i in_range_sse2(__m128i v, char lo, char n) {
+    __m128i offset = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(n - 1)), offset);
+}
+
+// Bitmask of the bytes in chunk that are not letters, digits or underscores.
+__attribute__((target("sse2"))) unsigned non_word_mask_sse2(__m128i chunk) {
+    __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    __m128i word = _mm_or_si128(in_range_sse2(lower, 'a', 26), in_range_sse2(chunk, '0', 10));
+    word = _mm_or_si128(word, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+    return ~_mm_movemask_epi8(word) & 0xFFFF;
+}
+
+__attribute__((target("sse2"))) const char* skip_spaces_sse2(const char* it, const char* end) {
+    const __m128i space = _mm_set1_epi8(' ');
+    for (; end - it >= 16; it += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)it);
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, space)) & 0xFFFF;
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    return skip_spaces_scalar(it, end);
+}
+
+__attribute__((target("sse2"))) const char* find_line_end_sse2(const char* it, const char* end) {
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; end - it >= 16; it += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)it);
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    return find_line_end_scalar(it, end);
+}
+
+__attribute__((target("sse2"))) const char* find_word_end_sse2(const char* it, const char* end) {
+    for (; end - it >= 16; it += 16) {
+        unsigned mask = non_word_mask_sse2(_mm_loadu_si128((const __m128i*)it));
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    return find_word_end_scalar(it, end);
+}
+
+// Bitmask of the bytes in chunk that end a run of regular literal characters.
+__attribute__((target("sse2"))) unsigned literal_end_mask_sse2(__m128i chunk, char quote) {
+    __m128i stop = _mm_or_si128(
+        _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8(quote))
+    );
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_setzero_si128()));
+    return _mm_movemask_epi8(stop);
+}
+
+__attribute__((target("sse2"))) const char* find_literal_end_sse2(
+    const char* it, const char* end, char quote
+) {
+    for (; end - it >= 16; it += 16) {
+        unsigned mask = literal_end_mask_sse2(_mm_loadu_si128((const __m128i*)it), quote);
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    return find_literal_end_scalar(it, end, quote);
+}
+
+// Bytes of v in the unsigned range [lo, lo + n) as a byte mask.
+__attribute__((target("avx2"))) __m256i in_range_avx2(__m256i v, char lo, char n) {
+    __m256i offset = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(n - 1)), offset);
+}
+
+// Bitmask of the bytes in chunk that are not letters, digits or underscores.
+__attribute__((target("avx2"))) unsigned non_word_mask_avx2(__m256i chunk) {
+    __m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    __m256i word = _mm256_or_si256(in_range_avx2(lower, 'a', 26), in_range_avx2(chunk, '0', 10));
+    word = _mm256_or_si256(word, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_')));
+    return ~(unsigned)_mm256_movemask_epi8(word);
+}
+
+// The avx2 kernels check the first 16 bytes with sse2 since most runs are short.
+// They clear the upper halves of the ymm registers before finishing with sse2, which would
+// otherwise stall on the transition.
+
+__attribute__((target("avx2"))) const char* skip_spaces_avx2(const char* it, const char* end) {
+    if (end - it < 32) return skip_spaces_sse2(it, end);
+    unsigned mask16 =
+        ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)it), _mm_set1_epi8(' ')));
+    if (mask16 & 0xFFFF) return it + __builtin_ctz(mask16 & 0xFFFF);
+    it += 16;
+
+    const __m256i space = _mm256_set1_epi8(' ');
+    for (; end - it >= 32; it += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)it);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, space));
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return skip_spaces_sse2(it, end);
+}
+
+__attribute__((target("avx2"))) const char* find_line_end_avx2(const char* it, const char* end) {
+    if (end - it < 32) return find_line_end_sse2(it, end);
+    unsigned mask16 =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)it), _mm_set1_epi8('\n')));
+    if (mask16) return it + __builtin_ctz(mask16);
+    it += 16;
+
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; end - it >= 32; it += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)it);
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf));
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return find_line_end_sse2(it, end);
+}
+
+__attribute__((target("avx2"))) const char* find_word_end_avx2(const char* it, const char* end) {
+    if (end - it < 32) return find_word_end_sse2(it, end);
+    unsigned mask16 = non_word_mask_sse2(_mm_loadu_si128((const __m128i*)it));
+    if (mask16) return it + __builtin_ctz(mask16);
+    it += 16;
+
+    for (; end - it >= 32; it += 32) {
+        unsigned mask = non_word_mask_avx2(_mm256_loadu_si256((const __m256i*)it));
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return find_word_end_sse2(it, end);
+}
+
+__attribute__((target("avx2"))) const char* find_literal_end_avx2(
+    const char* it, const char* end, char quote
+) {
+    if (end - it < 32) return find_literal_end_sse2(it, end, quote);
+    unsigned mask16 = literal_end_mask_sse2(_mm_loadu_si128((const __m128i*)it), quote);
+    if (mask16) return it + __builtin_ctz(mask16);
+    it += 16;
+
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i quotes = _mm256_set1_epi8(quote);
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; end - it >= 32; it += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)it);
+        __m256i stop =
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, backslash), _mm256_cmpeq_epi8(chunk, quotes));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(chunk, lf));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(chunk, _mm256_setzero_si256()));
+        unsigned mask = _mm256_movemask_epi8(stop);
+        if (mask) return it + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return find_literal_end_sse2(it, end, quote);
+}
+
+#endif
+
+const ScanKernels scalar_kernels = {
+    SCAN_SCALAR,
+    skip_spaces_scalar,
+    find_line_end_scalar,
+    find_word_end_scalar,
+    find_literal_end_scalar,
+};
+
+#ifdef SCAN_X86
+const ScanKernels sse2_kernels = {
+    SCAN_SSE2,
+    skip_spaces_sse2,
+    find_line_end_sse2,
+    find_word_end_sse2,
+    find_literal_end_sse2,
+};
+
+const ScanKernels avx2_kernels = {
+    SCAN_AVX2,
+    skip_spaces_avx2,
+    find_line_end_avx2,
+    find_word_end_avx2,
+    find_literal_end_avx2,
+};
+#endif
+
+const ScanKernels* selected_kernels = NULL;
+
+// Check whether the running cpu can execute kernels of level.
+bool scan_supported(ScanLevel level) {
+    switch (level) {
+        case SCAN_DETECT: return true;
+        case SCAN_SCALAR: return true;
+#ifdef SCAN_X86
+        case SCAN_SSE2: return __builtin_cpu_supports("sse2");
+        case SCAN_AVX2: return __builtin_cpu_supports("avx2");
+#else
+        case SCAN_SSE2:
+        case SCAN_AVX2: return false;
+#endif
+    }
+
+    // unreachable
+    return false;
+}
+
+// Use the kernels of level, or of the best supported level if it is SCAN_DETECT.
+// Falls back to the scalar kernels if level is not supported.
+// Returns the level that was selected.
+ScanLevel scan_select(ScanLevel level) {
+    if (level == SCAN_DETECT) {
+        level = scan_supported(SCAN_AVX2) ? SCAN_AVX2
+              : scan_supported(SCAN_SSE2) ? SCAN_SSE2
+                                          : SCAN_SCALAR;
+    }
+    if (!scan_supported(level)) level = SCAN_SCALAR;
+
+    switch (level) {
+#ifdef SCAN_X86
+        case SCAN_AVX2: selected_kernels = &avx2_kernels; break;
+        case SCAN_SSE2: selected_kernels = &sse2_kernels; break;
+#endif
+        default: selected_kernels = &scalar_kernels; break;
+    }
+
+    return selected_kernels->level;
+}
+
+// Get the selected kernels, detecting the best ones on first use.
+const ScanKernels* scan_kernels(void) {
+    if (selected_kernels == NULL) scan_select(SCAN_DETECT);
+    return selected_kernels;
+}
+
+// Get the name of level for diagnostics.
+const char* scan_level_name(ScanLevel level) {
+    switch (level) {
+        case SCAN_DETECT: return "detect";
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2:   return "sse2";
+        case SCAN_AVX2:   return "avx2";
+    }
+
+    // unreachable
+    return NULL;
+}
@@ -0,0 +1,125 @@
+#include "source.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memutils.h"
+#include "readfile.h"
+
+typedef struct Source Source;
+struct Source {
+    const char* filename;  // read on first lookup unless text is known
+    const char* text;
+    size_t len;
+    FileText file;  // contents of filename
+    size_t tabsize;
+
+    bool indexed;
+    DynArr line_starts;  // offset of the first character of every line
+};
+
+Source source = {
+    NULL, NULL, 0, { NULL, 0, false }, 4, false, { NULL, sizeof(pos_t), 0, 0, SOURCE_MEM }
+};
+
+// Forget the previous source.
+void reset_source(size_t tabsize) {
+    free_source();
+    source.tabsize = tabsize ? tabsize : 1;
+}
+
+// Use text of length len for positions, assuming a tab width of tabsize.
+// The text is borrowed and must outlive its positions.
+void set_source_text(const char* text, size_t len, size_t tabsize) {
+    reset_source(tabsize);
+    source.text = text;
+    source.len = len;
+}
+
+// Use the file filename for positions, assuming a tab width of tabsize.
+// The file is only read if a position is looked up.
+void set_source_file(const char* filename, size_t tabsize) {
+    reset_source(tabsize);
+    source.filename = filename;
+}
+
+// Build the line index of the source, reading it first if needed.
+// Returns whether the source is unknown.
+bool index_source(void) {
+    if (source.indexed) return source.line_starts.length == 0;
+    // only try once, an unknown source has no lines
+    source.indexed = true;
+
+    if (source.text == NULL) {
+        if (source.filename == NULL) return true;
+        source.file = map_file(source.filename, false);
+        if (source.file.text == NULL) return true;
+        source.text = source.file.text;
+        source.len = source.file.len;
+    }
+
+    pos_t start = 0;
+    if (dynarr_append(&source.line_starts, &start)) goto err;
+    for (const char* it = source.text; (it = memchr(it, '\n', source.text + source.len - it));) {
+        start = ++it - source.text;
+        if (dynarr_append(&source.line_starts, &start)) goto err;
+    }
+
+    return false;
+err:
+    dynarr_destroy(&source.line_starts);
+    return true;
+}
+
+// Find the index of the line containing pos, which must be indexed.
+size_t line_index(pos_t pos) {
+    const pos_t* starts = source.line_starts.c_arr;
+
+    // last line starting at or before pos
+    size_t lo = 0, hi = source.line_starts.length;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (starts[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Find the line number of pos, counting from 1.
+// Returns 0 if the source is unknown.
+size_t source_line(pos_t pos) {
+    if (index_source()) return 0;
+    return line_index(pos) + 1;
+}
+
+// Find the column number of pos, counting from 1.
+// Tabs advance to the next multiple of the tab width and carriage returns restart the line.
+// Returns 0 if the source is unknown.
+size_t source_col(pos_t pos) {
+    if (index_source()) return 0;
+
+    const pos_t* starts = source.line_starts.c_arr;
+    const char* it = source.text + starts[line_index(pos)];
+    const char* end = source.text + (pos < source.len ? pos : source.len);
+
+    size_t col = 1;
+    for (; it < end; it++) {
+        switch (*it) {
+            case '\t': col += source.tabsize - (col - 1) % source.tabsize; break;
+            case '\r': col = 1; break;
+            default:   col++; break;
+        }
+    }
+    return col;
+}
+
+// Forget the source and free its line index.
+void free_source(void) {
+    unmap_file(&source.file);
+    source.text = NULL;
+    source.filename = NULL;
+    source.len = 0;
+    source.indexed = false;
+    dynarr_destroy(&source.line_starts);
+}
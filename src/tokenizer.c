@@ -1,10 +1,27 @@
 #include "tokenizer.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "interner.h"
 #include "memutils.h"
 #include "printerr.h"
+#include "scan.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#ifndef LEXER_CHUNK_SIZE
+// bytes of source read from a file at a time
+#define LEXER_CHUNK_SIZE 65536
+#endif
+
+#ifndef TOKENIZE_MIN_CHUNK
+// smallest part of a program worth tokenizing on its own thread
+#define TOKENIZE_MIN_CHUNK 65536
+#endif
 
 typedef struct TokenMapItem TokenMapItem;
 struct TokenMapItem {
@@ -23,24 +40,83 @@ const TokenMapItem keywords[] = {
     { "i32", I32_TOKEN },           { "i64", I64_TOKEN },       { "u8", U8_TOKEN },
     { "u16", U16_TOKEN },           { "u32", U32_TOKEN },       { "u64", U64_TOKEN },
 };
-const TokenMapItem symbols[] = {
-    { "(", LPAREN },     { ")", RPAREN },     { "[", LBRACKET },   { "]", RBRACKET },
-    { "{", LBRACE },     { "}", RBRACE },     { "+", PLUS },       { "++", DPLUS },
-    { "-", MINUS },      { "--", DMINUS },    { "*", STAR },       { "/", SLASH },
-    { "%", PERCENT },    { "|", PIPE },       { "||", DPIPE },     { "&", AND },
-    { "&&", DAND },      { "^", CARET },      { "~", TILDE },      { "!", EXCLMARK },
-    { "?", QMARK },      { "=", EQ_TOKEN },   { "==", DEQ_TOKEN }, { "!=", NEQ_TOKEN },
-    { "<", LT_TOKEN },   { "<<", DLT_TOKEN }, { "<=", LEQ_TOKEN }, { ">", GT_TOKEN },
-    { ">>", DGT_TOKEN }, { ">=", GEQ_TOKEN }, { "+=", PLUSEQ },    { "-=", MINUSEQ },
-    { "*=", STAREQ },    { "/=", SLASHEQ },   { "%=", PERCENTEQ }, { "|=", PIPEEQ },
-    { "&=", ANDEQ },     { "^=", CARETEQ },   { "<<=", DLTEQ },    { ">>=", DGTEQ },
-    { "->", ARROW },     { "=>", DARROW },    { ".", DOT },        { ",", COMMA },
-    { ":", COLON },      { ";", SEMICOLON },
+
+// Character classes driving the lexer state machine.
+enum CharClass {
+    CHR_INVALID,  // cannot appear outside of literals and comments
+    CHR_END,      // null terminator
+    CHR_SPACE,    // space
+    CHR_TAB,      // horizontal tab
+    CHR_CR,       // carriage return
+    CHR_LF,       // line feed
+    CHR_HASH,     // comment
+    CHR_QUOTE,    // character and string literals
+    CHR_ALPHA,    // [_a-zA-Z]
+    CHR_DIGIT,    // [0-9]
+    CHR_SYMBOL,   // first character of a symbol
 };
 
-void free_token(Token token);
-void free_token_arrn(Token* arr, size_t n);
-void free_token_dynarr(DynArr* arr);
+typedef enum CharClass CharClass;
+
+// Class of every character, indexed by its unsigned value.
+const unsigned char char_class[256] = {
+    ['\0'] = CHR_END,    [' '] = CHR_SPACE,   ['\t'] = CHR_TAB,    ['\r'] = CHR_CR,
+    ['\n'] = CHR_LF,     ['#'] = CHR_HASH,    ['\''] = CHR_QUOTE,  ['\"'] = CHR_QUOTE,
+
+    ['_'] = CHR_ALPHA,   ['a'] = CHR_ALPHA,   ['b'] = CHR_ALPHA,   ['c'] = CHR_ALPHA,
+    ['d'] = CHR_ALPHA,   ['e'] = CHR_ALPHA,   ['f'] = CHR_ALPHA,   ['g'] = CHR_ALPHA,
+    ['h'] = CHR_ALPHA,   ['i'] = CHR_ALPHA,   ['j'] = CHR_ALPHA,   ['k'] = CHR_ALPHA,
+    ['l'] = CHR_ALPHA,   ['m'] = CHR_ALPHA,   ['n'] = CHR_ALPHA,   ['o'] = CHR_ALPHA,
+    ['p'] = CHR_ALPHA,   ['q'] = CHR_ALPHA,   ['r'] = CHR_ALPHA,   ['s'] = CHR_ALPHA,
+    ['t'] = CHR_ALPHA,   ['u'] = CHR_ALPHA,   ['v'] = CHR_ALPHA,   ['w'] = CHR_ALPHA,
+    ['x'] = CHR_ALPHA,   ['y'] = CHR_ALPHA,   ['z'] = CHR_ALPHA,   ['A'] = CHR_ALPHA,
+    ['B'] = CHR_ALPHA,   ['C'] = CHR_ALPHA,   ['D'] = CHR_ALPHA,   ['E'] = CHR_ALPHA,
+    ['F'] = CHR_ALPHA,   ['G'] = CHR_ALPHA,   ['H'] = CHR_ALPHA,   ['I'] = CHR_ALPHA,
+    ['J'] = CHR_ALPHA,   ['K'] = CHR_ALPHA,   ['L'] = CHR_ALPHA,   ['M'] = CHR_ALPHA,
+    ['N'] = CHR_ALPHA,   ['O'] = CHR_ALPHA,   ['P'] = CHR_ALPHA,   ['Q'] = CHR_ALPHA,
+    ['R'] = CHR_ALPHA,   ['S'] = CHR_ALPHA,   ['T'] = CHR_ALPHA,   ['U'] = CHR_ALPHA,
+    ['V'] = CHR_ALPHA,   ['W'] = CHR_ALPHA,   ['X'] = CHR_ALPHA,   ['Y'] = CHR_ALPHA,
+    ['Z'] = CHR_ALPHA,
+
+    ['0'] = CHR_DIGIT,   ['1'] = CHR_DIGIT,   ['2'] = CHR_DIGIT,   ['3'] = CHR_DIGIT,
+    ['4'] = CHR_DIGIT,   ['5'] = CHR_DIGIT,   ['6'] = CHR_DIGIT,   ['7'] = CHR_DIGIT,
+    ['8'] = CHR_DIGIT,   ['9'] = CHR_DIGIT,
+
+    ['('] = CHR_SYMBOL,  [')'] = CHR_SYMBOL,  ['['] = CHR_SYMBOL,  [']'] = CHR_SYMBOL,
+    ['{'] = CHR_SYMBOL,  ['}'] = CHR_SYMBOL,  ['+'] = CHR_SYMBOL,  ['-'] = CHR_SYMBOL,
+    ['*'] = CHR_SYMBOL,  ['/'] = CHR_SYMBOL,  ['%'] = CHR_SYMBOL,  ['|'] = CHR_SYMBOL,
+    ['&'] = CHR_SYMBOL,  ['^'] = CHR_SYMBOL,  ['~'] = CHR_SYMBOL,  ['!'] = CHR_SYMBOL,
+    ['?'] = CHR_SYMBOL,  ['='] = CHR_SYMBOL,  ['<'] = CHR_SYMBOL,  ['>'] = CHR_SYMBOL,
+    ['.'] = CHR_SYMBOL,  [','] = CHR_SYMBOL,  [':'] = CHR_SYMBOL,  [';'] = CHR_SYMBOL,
+};
+
+// Symbol state transitions.
+// symbol_dfa[state][chr] is the symbol formed by appending chr to the symbol state,
+// where ERROR_TOKEN is the start state, or ERROR_TOKEN if no such symbol exists.
+const unsigned char symbol_dfa[SEMICOLON + 1][128] = {
+    [ERROR_TOKEN] = {
+        ['('] = LPAREN,   [')'] = RPAREN,    ['['] = LBRACKET, [']'] = RBRACKET,
+        ['{'] = LBRACE,   ['}'] = RBRACE,    ['+'] = PLUS,     ['-'] = MINUS,
+        ['*'] = STAR,     ['/'] = SLASH,     ['%'] = PERCENT,  ['|'] = PIPE,
+        ['&'] = AND,      ['^'] = CARET,     ['~'] = TILDE,    ['!'] = EXCLMARK,
+        ['?'] = QMARK,    ['='] = EQ_TOKEN,  ['<'] = LT_TOKEN, ['>'] = GT_TOKEN,
+        ['.'] = DOT,      [','] = COMMA,     [':'] = COLON,    [';'] = SEMICOLON,
+    },
+    [PLUS] = { ['+'] = DPLUS, ['='] = PLUSEQ },
+    [MINUS] = { ['-'] = DMINUS, ['='] = MINUSEQ, ['>'] = ARROW },
+    [STAR] = { ['='] = STAREQ },
+    [SLASH] = { ['='] = SLASHEQ },
+    [PERCENT] = { ['='] = PERCENTEQ },
+    [PIPE] = { ['|'] = DPIPE, ['='] = PIPEEQ },
+    [AND] = { ['&'] = DAND, ['='] = ANDEQ },
+    [CARET] = { ['='] = CARETEQ },
+    [EXCLMARK] = { ['='] = NEQ_TOKEN },
+    [EQ_TOKEN] = { ['='] = DEQ_TOKEN, ['>'] = DARROW },
+    [LT_TOKEN] = { ['<'] = DLT_TOKEN, ['='] = LEQ_TOKEN },
+    [DLT_TOKEN] = { ['='] = DLTEQ },
+    [GT_TOKEN] = { ['>'] = DGT_TOKEN, ['='] = GEQ_TOKEN },
+    [DGT_TOKEN] = { ['='] = DGTEQ },
+};
 
 // Check whether chr is a lowercase letter.
 bool is_lower(char chr) {
@@ -72,64 +148,30 @@ bool is_alphanum(char chr) {
     return is_alpha(chr) || is_num(chr);
 }
 
-// Check whether str of length len is an integer literal.
-bool is_int(const char* str, size_t len) {
-    // [0-9][_0-9a-zA-Z]*
-    if (len == 0) return false;
-    if (!is_num(str[0])) return false;
-    for (size_t i = 1; i < len; i++) {
-        if (!(is_alphanum(str[i]) || str[i] == '_')) {
-            return false;
-        }
-    }
-    return true;
-}
+// Check whether chr ends an invalid token.
+bool is_delimiter(char chr) {
+    switch (char_class[(unsigned char)chr]) {
+        case CHR_END:
+        case CHR_SPACE:
+        case CHR_TAB:
+        case CHR_CR:
+        case CHR_LF:
+        case CHR_HASH:
+        case CHR_QUOTE: return true;
 
-// Check whether str of length len is a variable name.
-bool is_var(const char* str, size_t len) {
-    // [_a-zA-Z][_0-9a-zA-Z]*
-    if (len == 0) return false;
-    if (!(is_alpha(str[0]) || str[0] == '_')) return false;
-    for (size_t i = 1; i < len; i++) {
-        if (!(is_alphanum(str[i]) || str[i] == '_')) {
-            return false;
-        }
+        default: return false;
     }
-    return true;
 }
 
-// Find the token type of the keyword str of length len.
-// Returns ERROR_TOKEN if it is not a keyword.
-TokenEnum get_keyword_type(const char* str, size_t len) {
+// Intern all keywords tagged with their token type.
+// Returns whether an error occurred.
+bool intern_keywords(void) {
     for (size_t i = 0; i < sizeof(keywords) / sizeof(TokenMapItem); i++) {
-        if (strlen(keywords[i].key) == len && strncmp(str, keywords[i].key, len) == 0) {
-            return keywords[i].val;
-        }
+        symbol_t symbol = intern(keywords[i].key, strlen(keywords[i].key));
+        if (symbol == NO_SYMBOL) return true;
+        set_symbol_tag(symbol, keywords[i].val);
     }
-    return ERROR_TOKEN;
-}
-
-// Find the token type of the symbol str of length len.
-// Returns ERROR_TOKEN if it is not a symbol.
-TokenEnum get_symbol_type(const char* str, size_t len) {
-    for (size_t i = 0; i < sizeof(symbols) / sizeof(TokenMapItem); i++) {
-        if (strlen(symbols[i].key) == len && strncmp(str, symbols[i].key, len) == 0) {
-            return symbols[i].val;
-        }
-    }
-    return ERROR_TOKEN;
-}
-
-// Find the token type of str of length len.
-// Returns ERROR_TOKEN if it is not a token.
-TokenEnum get_token_type(const char* str, size_t len) {
-    TokenEnum token = get_keyword_type(str, len);
-    if (token != ERROR_TOKEN) return token;
-    token = get_symbol_type(str, len);
-    if (token != ERROR_TOKEN) return token;
-    if (is_int(str, len)) return INT_LITERAL;
-    if (is_var(str, len)) return VAR_NAME;
-    return ERROR_TOKEN;
+    return false;
 }
 
 // Find the value of the digit chr.
@@ -140,38 +182,143 @@ literal_t parse_digit(char chr) {
     return 0;
 }
 
-// Find the value of the integer literal src.
+// bytes in a word of digits
+#define WORD_DIGITS 8
+// word with every byte set to byte
+#define WORD_BYTES(byte) (0x0101010101010101u * (uint8_t)(byte))
+
+// powers of ten by number of digits in a word
+const literal_t dec_scales[WORD_DIGITS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+// Load up to WORD_DIGITS digits from src, aligned to the least significant end of the number.
+// The missing most significant digits are '0'.
+// The first digit is in the lowest byte regardless of byte order.
+uint64_t load_digits(const char* src, size_t len) {
+    unsigned char bytes[WORD_DIGITS] = { '0', '0', '0', '0', '0', '0', '0', '0' };
+    memcpy(bytes + WORD_DIGITS - len, src, len);
+
+    uint64_t word = 0;
+    for (size_t i = WORD_DIGITS; i-- > 0;) word = word << 8 | bytes[i];
+    return word;
+}
+
+// Bitmask of the high bits of the bytes of word in the range [lo, hi].
+// Every byte of word must be below 0x80.
+uint64_t bytes_in_range(uint64_t word, uint8_t lo, uint8_t hi) {
+    uint64_t above_lo = word + WORD_BYTES(0x80 - lo);
+    uint64_t above_hi = word + WORD_BYTES(0x7F - hi);
+    return above_lo & ~above_hi & WORD_BYTES(0x80);
+}
+
+// Check whether every byte of word is a decimal digit.
+bool is_dec_word(uint64_t word) {
+    if (word & WORD_BYTES(0x80)) return false;
+    return bytes_in_range(word, '0', '9') == WORD_BYTES(0x80);
+}
+
+// Check whether every byte of word is a hexadecimal digit.
+bool is_hex_word(uint64_t word) {
+    if (word & WORD_BYTES(0x80)) return false;
+    uint64_t lower = word | WORD_BYTES(0x20);
+    return (bytes_in_range(word, '0', '9') | bytes_in_range(lower, 'a', 'f')) == WORD_BYTES(0x80);
+}
+
+// Find the value of a word of decimal digits, combining neighboring digits in parallel.
+literal_t dec_word_value(uint64_t word) {
+    word -= WORD_BYTES('0');
+    word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFu;
+    word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFu;
+    return (word * 10000 + (word >> 32)) & 0xFFFFFFFFu;
+}
+
+// Find the value of a word of hexadecimal digits, combining neighboring digits in parallel.
+literal_t hex_word_value(uint64_t word) {
+    // letters have bit 6 set and their low nibble is 9 less than their value
+    word = (word & WORD_BYTES(0x0F)) + (word >> 6 & WORD_BYTES(0x01)) * 9;
+    word = (word << 4 & 0x00F000F000F000F0u) | (word >> 8 & 0x000F000F000F000Fu);
+    word = (word << 8 & 0x0000FF000000FF00u) | (word >> 16 & 0x000000FF000000FFu);
+    return (word << 16 & 0xFFFF0000u) | (word >> 32 & 0xFFFFu);
+}
+
+// Find the narrowest integer type that can hold value, preferring signed types.
+TokenEnum literal_width(literal_t value) {
+    if (value <= INT8_MAX) return I8_TOKEN;
+    if (value <= UINT8_MAX) return U8_TOKEN;
+    if (value <= INT16_MAX) return I16_TOKEN;
+    if (value <= UINT16_MAX) return U16_TOKEN;
+    if (value <= INT32_MAX) return I32_TOKEN;
+    if (value <= UINT32_MAX) return U32_TOKEN;
+    if (value <= INT64_MAX) return I64_TOKEN;
+    return U64_TOKEN;
+}
+
+// Find the value of the integer literal src of length src_len, and the narrowest type holding it.
+// Runs of decimal and hexadecimal digits are converted a word at a time.
 // Result is stored in dst unless dst is NULL.
 // Returns whether an error occurred.
-bool parse_int(literal_t* dst, const char* src) {
+bool parse_int(IntLiteral* dst, const char* src, size_t src_len) {
     if (src == NULL) return true;
     const char* it = src;
+    const char* end = src + src_len;
 
     // find the base of the integer
     literal_t base = 10;
-    if (strncmp(it, "0x", 2) == 0) {
+    if (src_len >= 2 && strncmp(it, "0x", 2) == 0) {
         base = 16;
         it += 2;
-    } else if (strncmp(it, "0b", 2) == 0) {
+    } else if (src_len >= 2 && strncmp(it, "0b", 2) == 0) {
         base = 2;
         it += 2;
     }
 
     literal_t n = 0;
-    for (; *it != '\0'; it++) {
+    bool overflow = false;
+    while (it != end) {
+        // up to a word of digits at once, stopping at underscores and invalid digits
+        size_t len = end - it < WORD_DIGITS ? (size_t)(end - it) : WORD_DIGITS;
+        if (base != 2) {
+            uint64_t word = load_digits(it, len);
+            if (base == 10 && is_dec_word(word)) {
+                overflow |= __builtin_mul_overflow(n, dec_scales[len], &n);
+                overflow |= __builtin_add_overflow(n, dec_word_value(word), &n);
+                it += len;
+                continue;
+            }
+            if (base == 16 && is_hex_word(word)) {
+                overflow |= (n >> (64 - 4 * len)) != 0;
+                n = n << (4 * len) | hex_word_value(word);
+                it += len;
+                continue;
+            }
+        }
+
         // underscores do nothing
-        if (*it == '_') continue;
+        if (*it == '_') {
+            it++;
+            continue;
+        }
         literal_t d = parse_digit(*it);
         // check that digit is valid in base
         if (is_alphanum(*it) && d < base) {
-            n = n * base + d;
+            overflow |= __builtin_mul_overflow(n, base, &n);
+            overflow |= __builtin_add_overflow(n, d, &n);
+            it++;
         } else {
-            syntax_error("invalid digit '%c' in integer literal '%s'\n", *it, src);
+            syntax_error(
+                "invalid digit '%c' in integer literal '%.*s'\n", *it, (int)src_len, src
+            );
             return true;
         }
     }
 
-    if (dst) *dst = n;
+    if (overflow) {
+        syntax_error("integer literal '%.*s' does not fit in 64 bits\n", (int)src_len, src);
+        return true;
+    }
+
+    if (dst) *dst = (IntLiteral) { n, literal_width(n) };
     return false;
 }
 
@@ -186,366 +333,1408 @@ const char* literal_name(char quote) {
 
 // Find the value of the string literal src of length src_len.
 // The string literal must begin and end with a quote character.
-// Result is stored in dst unless dst is NULL.
+// Runs without escape sequences are found with the scanning kernels and copied in bulk.
+// Result is written to str, which must have room for src_len - 2 characters.
 // Result length is stored in dst_len unless dst_len is NULL.
 // Returns whether an error occurred.
-bool parse_str(char** dst, size_t* dst_len, const char* src, size_t src_len) {
+bool parse_str(char* str, size_t* dst_len, const char* src, size_t src_len) {
     if (src == NULL) return true;
-
-    // parsed string is never longer
-    char* str = malloc(src_len);
-    if (str == NULL) {
-        malloc_error();
-        return false;
-    }
+    const ScanKernels* scan = scan_kernels();
 
     size_t i = 0;
-    bool escaping = false;
-    const char* it = src;
-    char quote = *it;
-
-    while (*++it != quote || escaping) {
-        if (escaping) {
-            switch (*it) {
-                // simple escape sequences
-                case '\\': str[i++] = '\\'; break;
-                case '\'': str[i++] = '\''; break;
-                case '\"': str[i++] = '\"'; break;
-                case 'n':  str[i++] = '\n'; break;
-                case 'r':  str[i++] = '\r'; break;
-                case 't':  str[i++] = '\t'; break;
-                case '0':  str[i++] = '\0'; break;
-
-                case 'x':  // numeric escape sequence
-                    // left digit
-                    char hi = *++it;
-                    if (hi == '\0') {
-                        syntax_error(
-                            "invalid escape sequence '\\x' in %s literal %s\n", literal_name(quote),
-                            src
-                        );
-                        free(str);
-                        return true;
-                    }
+    const char* it = src + 1;
+    const char* last = src + src_len - 1;  // closing quote
+    char quote = *src;
 
-                    // right digit
-                    char lo = *++it;
-                    if (hi == '\0') {
-                        syntax_error(
-                            "invalid escape sequence '\\x%c' in %s literal %s\n", hi,
-                            literal_name(quote), src
-                        );
-                        free(str);
-                        return true;
-                    }
+    for (;;) {
+        // push regular characters
+        const char* run_end = scan->find_literal_end(it, last, quote);
+        memcpy(str + i, it, run_end - it);
+        i += run_end - it;
+        it = run_end;
 
-                    // check that digits are valid hex
-                    if (is_hex(hi) && is_hex(lo)) {
-                        str[i++] = parse_digit(hi) * 16 + parse_digit(lo);
-                    } else {
-                        syntax_error(
-                            "invalid escape sequence '\\x%c%c' in %s literal %s\n", hi, lo,
-                            literal_name(quote), src
-                        );
-                        free(str);
-                        return true;
-                    }
-                    break;
+        if (it == last || *it == quote) break;
+        if (*it != '\\') {
+            // line feeds and null characters are regular characters here
+            str[i++] = *it++;
+            continue;
+        }
+
+        // escape sequence
+        it++;
+        switch (it < last ? *it : '\0') {
+            // simple escape sequences
+            case '\\': str[i++] = '\\'; break;
+            case '\'': str[i++] = '\''; break;
+            case '\"': str[i++] = '\"'; break;
+            case 'n':  str[i++] = '\n'; break;
+            case 'r':  str[i++] = '\r'; break;
+            case 't':  str[i++] = '\t'; break;
+            case '0':  str[i++] = '\0'; break;
 
-                default:  // invalid escape sequence
+            case 'x':  // numeric escape sequence
+                // left digit
+                char hi = it + 1 < last ? *++it : '\0';
+                if (hi == '\0') {
                     syntax_error(
-                        "invalid escape sequence '\\%c' in %s literal %s\n", *it,
-                        literal_name(quote), src
+                        "invalid escape sequence '\\x' in %s literal %.*s\n", literal_name(quote),
+                        (int)src_len, src
                     );
-                    free(str);
                     return true;
-            }
+                }
 
-            escaping = false;
-        } else if (*it == '\\') {
-            // begin escape sequence
-            escaping = true;
-        } else {
-            // push regular character
-            str[i++] = *it;
+                // right digit
+                char lo = it + 1 < last ? *++it : '\0';
+                if (lo == '\0') {
+                    syntax_error(
+                        "invalid escape sequence '\\x%c' in %s literal %.*s\n", hi,
+                        literal_name(quote), (int)src_len, src
+                    );
+                    return true;
+                }
+
+                // check that digits are valid hex
+                if (is_hex(hi) && is_hex(lo)) {
+                    str[i++] = parse_digit(hi) * 16 + parse_digit(lo);
+                } else {
+                    syntax_error(
+                        "invalid escape sequence '\\x%c%c' in %s literal %.*s\n", hi, lo,
+                        literal_name(quote), (int)src_len, src
+                    );
+                    return true;
+                }
+                break;
+
+            default:  // invalid escape sequence
+                syntax_error(
+                    "invalid escape sequence '\\%c' in %s literal %.*s\n", *it,
+                    literal_name(quote), (int)src_len, src
+                );
+                return true;
         }
+        it++;
     }
 
-    // add null terminator
-    str[i] = '\0';
-    if (dst) *dst = str;
     if (dst_len) *dst_len = i;
     return false;
 }
 
 // Find the value of the character literal src of length src_len.
 // The character literal must begin and end with a quote character.
+// The value is decoded in str, which must have room for src_len - 2 characters.
 // Result is stored in dst unless dst is NULL.
 // Returns whether an error occurred.
-bool parse_chr(char* dst, const char* src, size_t src_len) {
+bool parse_chr(char* dst, char* str, const char* src, size_t src_len) {
     // parse like string literal
-    char* str = NULL;
     size_t len = 0;
-    bool failed = parse_str(&str, &len, src, src_len);
+    bool failed = parse_str(str, &len, src, src_len);
     if (failed) return true;
 
     // check that length is 1
     if (len < 1) {
-        syntax_error("empty character literal %s\n", src);
-        free(str);
+        syntax_error("empty character literal %.*s\n", (int)src_len, src);
         return true;
     }
     if (len > 1) {
-        syntax_error("multiple characters in character literal %s\n", src);
-        free(str);
+        syntax_error("multiple characters in character literal %.*s\n", (int)src_len, src);
         return true;
     }
 
     // get first character
-    *dst = *str;
-    free(str);
+    if (dst) *dst = *str;
     return false;
 }
 
-// Tokenize program assuming a tab width of tabsize.
-// Result is terminated by an EOF_TOKEN.
+typedef struct OpenBracket OpenBracket;
+
+// Opening bracket waiting for its closing bracket.
+struct OpenBracket {
+    size_t index;  // of its token
+    pos_t pos;
+    TokenEnum type;
+};
+
+typedef struct LexerError LexerError;
+
+// Syntax error lexed while looking ahead.
+struct LexerError {
+    size_t index;   // of the token the parser writes it at
+    char* message;  // formatted
+};
+
+// Create a lexer over program of length len, which need not be null terminated.
+// Token strings point into program.
+Lexer lexer_create(const char* program, size_t len) {
+    Lexer lexer = {
+        .fp = NULL,
+        .buf = NULL,
+        .buf_size = 0,
+        .it = program,
+        .end = program + len,
+        .start = program,
+        .base = 0,
+        .exhausted = true,
+        .failed = false,
+        .ring = NULL,
+        .distances = NULL,
+        .ring_mask = 0,
+        .head = 0,
+        .count = 0,
+        .done = false,
+        .brackets = dynarr_create(sizeof(OpenBracket), LEXER_MEM),
+        .unmatched = NULL,
+        .lexed = 0,
+        .closed = NO_MATCH,
+        .depth = 0,
+        .mismatched = false,
+        .errors = dynarr_create(sizeof(LexerError), LEXER_MEM),
+        .symbols = NULL,
+        .literal_buf = NULL,
+        .literals = arena_create(STRING_MEM),
+        .scratch = dynarr_create(sizeof(char), LEXER_MEM),
+        .stream = NULL,
+        .pos = 0,
+        .payload_pos = 0,
+        .peeked = {},
+    };
+
+    // offsets and positions are 32-bit
+    if (len > UINT32_MAX) {
+        fsize_error();
+        lexer.failed = true;
+    }
+
+    // keywords are recognized by their symbol tag
+    if (intern_keywords()) lexer.failed = true;
+    return lexer;
+}
+
+// Create a lexer reading fp in chunks.
+// Token strings are owned by the lexer.
+Lexer lexer_open(FILE* fp) {
+    Lexer lexer = lexer_create("", 0);
+    lexer.fp = fp;
+    lexer.exhausted = false;
+
+    lexer.buf_size = LEXER_CHUNK_SIZE;
+    lexer.buf = mem_alloc(lexer.buf_size, LEXER_MEM);
+    if (lexer.buf == NULL) {
+        malloc_error();
+        lexer.failed = true;
+        return lexer;
+    }
+    lexer.it = lexer.end = lexer.start = lexer.buf;
+    return lexer;
+}
+
+// Create a lexer that replays the tokens of stream.
+// The stream is borrowed and must outlive the lexer.
+Lexer lexer_from_stream(const TokenStream* stream) {
+    Lexer lexer = lexer_create("", 0);
+    lexer.stream = stream;
+    lexer.done = true;
+    return lexer;
+}
+
+// Free all data owned by lexer, including token strings it created.
+void lexer_destroy(Lexer* lexer) {
+    mem_free(lexer->buf);
+    lexer->buf = NULL;
+    mem_free(lexer->ring);
+    lexer->ring = NULL;
+    mem_free(lexer->distances);
+    lexer->distances = NULL;
+    lexer->count = 0;
+    dynarr_destroy(&lexer->brackets);
+    arena_destroy(&lexer->literals);
+    dynarr_destroy(&lexer->scratch);
+
+    LexerError* errors = lexer->errors.c_arr;
+    for (size_t i = 0; i < lexer->errors.length; i++) mem_free(errors[i].message);
+    dynarr_destroy(&lexer->errors);
+}
+
+// Move the unlexed source from keep to the front of the buffer and read the next chunk after it.
+// Returns the new position of keep, or NULL if an error occurred.
+const char* read_source(Lexer* lexer, const char* keep) {
+    size_t kept = lexer->end - keep;
+    memmove(lexer->buf, keep, kept);
+    lexer->base += keep - lexer->start;
+
+    // make room for a whole chunk after a long unfinished token
+    if (lexer->buf_size - kept < LEXER_CHUNK_SIZE) {
+        size_t size = kept + LEXER_CHUNK_SIZE;
+        char* buf = mem_realloc(lexer->buf, size, LEXER_MEM);
+        if (buf == NULL) {
+            malloc_error();
+            return NULL;
+        }
+        lexer->buf = buf;
+        lexer->buf_size = size;
+    }
+
+    size_t room = lexer->buf_size - kept;
+    size_t len = fread(lexer->buf + kept, 1, room, lexer->fp);
+    if (len < room) {
+        if (ferror(lexer->fp)) {
+            fread_error();
+            return NULL;
+        }
+        lexer->exhausted = true;
+    }
+
+    // offsets are 32-bit
+    if (lexer->base + kept + len > UINT32_MAX) {
+        fsize_error();
+        return NULL;
+    }
+
+    lexer->start = lexer->buf;
+    lexer->it = lexer->buf;
+    lexer->end = lexer->buf + kept + len;
+    return lexer->buf;
+}
+
+// Copy str of length len to storage owned by lexer.
 // Returns NULL if an error occurred.
-Token* tokenize(const char* program, size_t tabsize) {
-    if (program == NULL) return NULL;
+const char* copy_token_str(Lexer* lexer, const char* str, size_t len) {
+    char* copy = arena_alloc(&lexer->literals, len, 1);
+    if (copy) memcpy(copy, str, len);
+    return copy;
+}
 
-    DynArr array = dynarr_create(sizeof(Token));
+// Find the symbol of the name str of length len for lexer.
+// Names not interned yet go to the local interner of lexer if it has one.
+// Returns NO_SYMBOL if an error occurred.
+symbol_t lex_symbol(Lexer* lexer, const char* str, size_t len) {
+    if (lexer->symbols == NULL) return intern(str, len);
 
-    // initialize position
-    size_t line = 1, col = 1;
+    // the global interner is only read while lexing in parallel
+    symbol_t symbol = find_symbol(str, len);
+    if (symbol != NO_SYMBOL) return symbol;
+    symbol = interner_intern(lexer->symbols, str, len);
+    return symbol == NO_SYMBOL ? NO_SYMBOL : symbol | LOCAL_SYMBOL;
+}
 
-    // initialize current token
-    const char* tokenpos = program;
-    size_t tokenlen = 0;
-    TokenEnum tokentype = ERROR_TOKEN;
-    size_t tokenline = line, tokencol = col;
+// Check whether type is a bracket.
+bool is_bracket(TokenEnum type) {
+    return LPAREN <= type && type <= RBRACE;
+}
 
-    char chr;
-    do {
-        chr = *program++;         // pop a character
-        bool push_token = false;  // whether current token is finished
-
-        switch (chr) {
-            // end token on whitespace or EOF
-            case '\0': push_token = true; break;
-            case ' ':
-                col++;
-                push_token = true;
-                break;
-            case '\t':
-                // next multiple of tabsize + 1
-                col += tabsize - (col - 1) % tabsize;
-                push_token = true;
-                break;
-            case '\r':
-                col = 1;
-                push_token = true;
+// Get the closing bracket of the opening bracket type.
+// Returns ERROR_TOKEN if type is not an opening bracket.
+TokenEnum closing_bracket(TokenEnum type) {
+    switch (type) {
+        case LPAREN:   return RPAREN;
+        case LBRACKET: return RBRACKET;
+        case LBRACE:   return RBRACE;
+        default:       return ERROR_TOKEN;
+    }
+}
+
+// Get the character of the bracket type.
+char bracket_chr(TokenEnum type) {
+    switch (type) {
+        case LPAREN:   return '(';
+        case RPAREN:   return ')';
+        case LBRACKET: return '[';
+        case RBRACKET: return ']';
+        case LBRACE:   return '{';
+        case RBRACE:   return '}';
+        default:       return '?';
+    }
+}
+
+// Keep the syntax error deferred while looking ahead, if any, until the parser reaches the token
+// at index.
+void keep_error(Lexer* lexer, size_t index) {
+    if (deferred_error == NULL) return;
+    LexerError error = { index, deferred_error };
+    deferred_error = NULL;
+    if (dynarr_append(&lexer->errors, &error)) {
+        fputs(error.message, stderr);
+        mem_free(error.message);
+    }
+}
+
+// Stop counting the opening bracket open of the lookahead ring buffer in the depth of lexer, now
+// or once it is consumed, as it is never closed.
+void unclose_bracket(Lexer* lexer, const OpenBracket* open) {
+    if (lexer->ring == NULL) return;
+    size_t head_index = lexer->lexed - lexer->count;
+    if (open->index < head_index) {
+        lexer->depth--;
+    } else {
+        size_t slot = (lexer->head + open->index - head_index) & lexer->ring_mask;
+        lexer->distances[slot] = NO_MATCH;
+    }
+}
+
+// Match the next token of lexer with its opening bracket if it is a closing bracket, or keep it
+// open if it is an opening bracket.
+// A closing bracket that does not match is reported, and closes the innermost opening bracket of
+// its kind, leaving the ones inside it unclosed, or is left out if there is none.
+// Returns whether an error occurred that ends the tokens.
+bool match_bracket(Lexer* lexer, TokenEnum type, pos_t pos) {
+    if (!is_bracket(type)) return false;
+    if (closing_bracket(type) != ERROR_TOKEN) {
+        OpenBracket open = { lexer->lexed, pos, type };
+        return dynarr_append(&lexer->brackets, &open);
+    }
+
+    size_t depth = lexer->brackets.length;
+    OpenBracket* brackets = lexer->brackets.c_arr;
+    if (depth == 0) {
+        // the opening bracket may be in an earlier chunk
+        if (lexer->unmatched) return dynarr_append(lexer->unmatched, &lexer->lexed);
+        syntax_error("unmatched '%c'\n", bracket_chr(type));
+        keep_error(lexer, lexer->lexed);
+        lexer->mismatched = true;
+        return false;
+    }
+
+    OpenBracket* open = &brackets[depth - 1];
+    if (closing_bracket(open->type) != type) {
+        // chunks are lexed on threads that must not build the line index of the source
+        if (lexer->unmatched) return true;
+        syntax_error(
+            "'%c' does not match '%c' at %zu:%zu\n", bracket_chr(type), bracket_chr(open->type),
+            source_line(open->pos), source_col(open->pos)
+        );
+        keep_error(lexer, lexer->lexed);
+        lexer->mismatched = true;
+
+        // brackets[match - 1] is the innermost one of its kind
+        size_t match = depth - 1;
+        while (match > 0 && closing_bracket(brackets[match - 1].type) != type) match--;
+        if (match == 0) return false;
+        for (size_t i = match; i < depth; i++) unclose_bracket(lexer, &brackets[i]);
+        lexer->brackets.length = match;
+        open = &brackets[match - 1];
+    }
+    lexer->closed = open->index;
+    lexer->brackets.length--;
+    return false;
+}
+
+// Lex the next token of the source of lexer.
+// The bracket it closes if any is stored in lexer->closed.
+// Returns an ERROR_TOKEN if an error occurred.
+Token lex_token(Lexer* lexer) {
+    if (lexer->failed) goto err;
+    lexer->closed = NO_MATCH;
+
+    // long runs of spaces, comments and words are skipped in bulk
+    const ScanKernels* scan = scan_kernels();
+
+    // local copy of the position
+    const char* it = lexer->it;
+    const char* end = lexer->end;
+
+    for (;;) {
+        if (it == end) {
+            if (lexer->exhausted) break;
+            it = read_source(lexer, it);
+            if (it == NULL) goto err;
+            end = lexer->end;
+            continue;
+        }
+
+        // start of current token
+        const char* tokenpos = it;
+        TokenEnum tokentype = ERROR_TOKEN;
+        TokenData data = {};
+
+        switch ((CharClass)char_class[(unsigned char)*it]) {
+            case CHR_END:  // a null character ends the program
+                end = lexer->end = it;
+                lexer->exhausted = true;
+                continue;
+
+            // whitespace
+            case CHR_SPACE: it = scan->skip_spaces(it + 1, end); continue;
+            case CHR_TAB:
+            case CHR_CR:
+            case CHR_LF:    it++; continue;
+
+            case CHR_HASH:  // comment
+                // skip until end of line or file
+                it = scan->find_line_end(it + 1, end);
+                if (it == end && !lexer->exhausted) goto read;
+                continue;
+
+            case CHR_QUOTE:  // character and string literals
+                char quote = *it++;
+                bool escaping = false;
+                for (;;) {
+                    // skip regular characters in bulk
+                    if (!escaping) it = scan->find_literal_end(it, end, quote);
+
+                    // hit end of line or file before closing quote
+                    if (it == end || *it == '\0' || (!escaping && *it == '\n')) {
+                        if (it == end && !lexer->exhausted) goto read;
+                        error_pos = lexer->base + (tokenpos - lexer->start);
+                        syntax_error(
+                            "missing terminating %c character in %s literal %.*s\n", quote,
+                            literal_name(quote), (int)(it - tokenpos), tokenpos
+                        );
+                        goto err;
+                    }
+
+                    char chr = *it++;
+                    if (escaping) escaping = false;
+                    else if (chr == '\\') escaping = true;
+                    else if (chr == quote) break;
+                }
+
+                // check if it was a character or string by its quotes
+                tokentype = quote == '\'' ? CHR_LITERAL : STR_LITERAL;
                 break;
-            case '\n':
 
-                line++;
-                col = 1;
-                push_token = true;
+            case CHR_ALPHA:  // variable names and keywords
+                it = scan->find_word_end(it + 1, end);
+                tokentype = VAR_NAME;
                 break;
 
-            case '#':  // comment
-                // skip until end of line or file
-                do {
-                    chr = *program++;
-                    col++;
-                } while (chr != '\0' && chr != '\n');
-                chr = *program--;  // don't skip the end of line or file
-                push_token = true;
+            case CHR_DIGIT:  // integer literals
+                it = scan->find_word_end(it + 1, end);
+                tokentype = INT_LITERAL;
                 break;
 
-            case '\'':  // character and string literals
-            case '\"':
-                // end previous token first
-                if (tokenlen) {
-                    chr = *program--;
-                    push_token = true;
-                } else {
-                    // parse entire string here
-                    bool escaping = false;
-                    char quote = chr;
-                    do {
-                        escaping = !escaping && chr == '\\';
-                        chr = *program++;
-                        tokenlen++;
-                        col++;
-
-                        // hit end of line or file before closing string
-                        if (chr == '\0' || (!escaping && chr == '\n')) {
-                            error_line = tokenline;
-                            error_col = tokencol;
-                            syntax_error(
-                                "missing terminating %c character in %s literal %.*s\n", quote,
-                                literal_name(quote), tokenlen, tokenpos
-                            );
-                            free_token_dynarr(&array);
-                            return NULL;
-                        }
-                    } while (chr != quote || escaping);
-
-                    // check if it was a character or string by its quotes
-                    tokentype = quote == '\'' ? CHR_LITERAL : STR_LITERAL;
-                    tokenlen++;
-                    col++;
-                    push_token = true;
+            case CHR_SYMBOL:  // longest matching symbol
+                while (it < end) {
+                    unsigned char chr = *it;
+                    TokenEnum next = chr < 128 ? symbol_dfa[tokentype][chr] : ERROR_TOKEN;
+                    if (next == ERROR_TOKEN) break;
+                    tokentype = next;
+                    it++;
                 }
                 break;
 
-            default:
-                // check if current token would become invalid by adding next character
-                TokenEnum next_type = get_token_type(tokenpos, tokenlen + 1);
-                if (tokentype != ERROR_TOKEN && next_type == ERROR_TOKEN) {
-                    // end previous one token if it does
-                    push_token = true;
-                    program--;
+            case CHR_INVALID:  // invalid tokens extend to the next delimiter
+                while (it < end && !is_delimiter(*it)) it++;
+                if (it == end && !lexer->exhausted) goto read;
+                error_pos = lexer->base + (tokenpos - lexer->start);
+                syntax_error("invalid token '%.*s'\n", (int)(it - tokenpos), tokenpos);
+                goto err;
+        }
+
+        // the token may continue after the source window
+        if (it == end && !lexer->exhausted) goto read;
+
+        size_t tokenlen = it - tokenpos;
+        pos_t tokenoffset = lexer->base + (tokenpos - lexer->start);
+        error_pos = tokenoffset;
+
+        StrView str = { tokenpos, tokenlen };
+        symbol_t symbol = NO_SYMBOL;
+
+        // add necessary data based on type
+        switch (tokentype) {
+            case VAR_NAME:
+                // keywords are only recognized once the whole word is known
+                symbol = lex_symbol(lexer, tokenpos, tokenlen);
+                if (symbol == NO_SYMBOL) goto err;
+                tokentype = symbol & LOCAL_SYMBOL ? ERROR_TOKEN : symbol_tag(symbol);
+                if (tokentype == ERROR_TOKEN) {
+                    tokentype = VAR_NAME;
+                    data.var_name = symbol;
+                }
+                break;
+            case INT_LITERAL:
+                if (parse_int(&data.int_literal, tokenpos, tokenlen)) goto err;
+                break;
+            case CHR_LITERAL:
+                // decode in scratch storage
+                if (dynarr_reserve(&lexer->scratch, tokenlen)) goto err;
+                char* scratch = lexer->scratch.c_arr;
+                if (parse_chr(&data.chr_literal, scratch, tokenpos, tokenlen)) goto err;
+                break;
+            case STR_LITERAL:
+                // decode and null terminate in literal storage
+                DynArr* buf = lexer->literal_buf;
+                char* value;
+                if (buf) {
+                    if (dynarr_reserve(buf, buf->length + tokenlen)) goto err;
+                    value = (char*)buf->c_arr + buf->length;
                 } else {
-                    // add character to current token otherwise
-                    tokentype = next_type;
-                    tokenlen++;
-                    col++;
+                    value = arena_alloc(&lexer->literals, tokenlen, 1);
+                    if (value == NULL) goto err;
                 }
+                if (parse_str(value, &data.str_literal.len, tokenpos, tokenlen)) goto err;
+                value[data.str_literal.len] = '\0';
+                data.str_literal.ptr = value;
+                if (buf) buf->length += data.str_literal.len + 1;
+                break;
+            default:
+                if (match_bracket(lexer, tokentype, tokenoffset)) goto err;
+                // closing brackets that match nothing were reported and are left out
+                bool closing = is_bracket(tokentype) && closing_bracket(tokentype) == ERROR_TOKEN;
+                if (closing && lexer->closed == NO_MATCH && lexer->unmatched == NULL) continue;
                 break;
         }
 
-        // add current token to array and clear it
-        if (push_token) {
-            // skip empty tokens
-            if (tokenlen > 0) {
-                error_line = tokenline;
-                error_col = tokencol;
+        // the source window is reused when reading a file, so keep a copy of the string
+        if (lexer->fp) {
+            switch (tokentype) {
+                case INT_LITERAL:
+                case CHR_LITERAL:
+                case STR_LITERAL: str.ptr = copy_token_str(lexer, tokenpos, tokenlen); break;
+                default:
+                    // names, keywords and symbols repeat, so share their interned strings
+                    if (symbol == NO_SYMBOL) symbol = intern(tokenpos, tokenlen);
+                    str.ptr = symbol == NO_SYMBOL ? NULL : symbol_name(symbol).ptr;
+                    break;
+            }
+            if (str.ptr == NULL) goto err;
+        }
 
-                // check that token is valid
-                if (tokentype == ERROR_TOKEN) {
-                    syntax_error("invalid token '%.*s'\n", tokenlen, tokenpos);
-                    free_token_dynarr(&array);
-                    return NULL;
-                }
+        lexer->it = it;
+        lexer->lexed++;
+        return (Token) {
+            .type = tokentype,
+            .str = str,
+            .pos = tokenoffset,
+            .data = data,
+        };
+    read:
+        // read more and start the token over
+        it = read_source(lexer, tokenpos);
+        if (it == NULL) goto err;
+        end = lexer->end;
+    }
 
-                // copy token to new string
-                char* str = malloc(tokenlen + 1);
-                if (str == NULL) {
-                    malloc_error();
-                    free_token_dynarr(&array);
-                    return NULL;
-                }
-                strncpy(str, tokenpos, tokenlen);
-                str[tokenlen] = '\0';
-
-                // add necessary data based on type
-                TokenData data = {};
-                switch (tokentype) {
-                    case INT_LITERAL:
-                        if (parse_int(&data.int_literal, str)) {
-                            free_token_dynarr(&array);
-                            free(str);
-                            return NULL;
-                        }
-                        break;
-                    case CHR_LITERAL:
-                        if (parse_chr(&data.chr_literal, str, tokenlen)) {
-                            free_token_dynarr(&array);
-                            free(str);
-                            return NULL;
-                        }
-                        break;
-                    case STR_LITERAL:
-                        if (parse_str(&data.str_literal, NULL, str, tokenlen)) {
-                            free_token_dynarr(&array);
-                            free(str);
-                            return NULL;
-                        }
-                        break;
-                    case VAR_NAME:
-                        // variable name is same as token string
-                        data.var_name = str;
-                        break;
-
-                    default: break;
-                }
+    // brackets left open may be closed in a later chunk
+    if (lexer->brackets.length && lexer->unmatched == NULL) {
+        OpenBracket* open = dynarr_get(&lexer->brackets, lexer->brackets.length - 1);
+        error_pos = open->pos;
+        syntax_error("unclosed '%c'\n", bracket_chr(open->type));
+        // written when the parser reaches the bracket, before the errors after it
+        keep_error(lexer, open->index);
 
-                // push token
-                Token token = {
-                    .type = tokentype,
-                    .str = str,
-                    .line = tokenline,
-                    .col = tokencol,
-                    .data = data,
-                };
-                if (dynarr_append(&array, &token)) {
-                    malloc_error();
-                    dynarr_destroy(&array);
-                    return NULL;
-                }
+        OpenBracket* brackets = lexer->brackets.c_arr;
+        for (size_t i = 0; i < lexer->brackets.length; i++) unclose_bracket(lexer, &brackets[i]);
+        lexer->brackets.length = 0;
+        goto err;
+    }
 
-                // clear token
-                tokentype = ERROR_TOKEN;
-                tokenlen = 0;
+    lexer->it = it;
+    lexer->lexed++;
+    return (Token) {
+        .type = EOF_TOKEN,
+        .str = { lexer->fp ? "" : it, 0 },
+        .pos = lexer->base + (it - lexer->start),
+        .data = {},
+    };
+err:
+    lexer->failed = true;
+    lexer->lexed++;
+    return (Token) {
+        .type = ERROR_TOKEN,
+        .str = { "", 0 },
+        .pos = error_pos,
+        .data = {},
+    };
+}
+
+// Lex tokens until there are more than n in the lookahead ring buffer or the last one ends it.
+// Returns whether an error occurred.
+bool fill_ring(Lexer* lexer, size_t n) {
+    while (lexer->count <= n && !lexer->done) {
+        // grow ring buffer, keeping buffered tokens in order from the start
+        if (lexer->count == lexer->ring_mask + 1 || lexer->ring == NULL) {
+            size_t capacity = lexer->ring ? (lexer->ring_mask + 1) * 2 : 16;
+            Token* ring = mem_alloc(capacity * sizeof(Token), LEXER_MEM);
+            size_t* distances = mem_alloc(capacity * sizeof(size_t), LEXER_MEM);
+            if (ring == NULL || distances == NULL) {
+                mem_free(ring);
+                mem_free(distances);
+                malloc_error();
+                return true;
+            }
+            for (size_t i = 0; i < lexer->count; i++) {
+                ring[i] = lexer->ring[(lexer->head + i) & lexer->ring_mask];
+                distances[i] = lexer->distances[(lexer->head + i) & lexer->ring_mask];
             }
+            mem_free(lexer->ring);
+            mem_free(lexer->distances);
+            lexer->ring = ring;
+            lexer->distances = distances;
+            lexer->ring_mask = capacity - 1;
+            lexer->head = 0;
+        }
 
-            // set new start position
-            tokenpos = program;
-            tokenline = line;
-            tokencol = col;
+        // errors past the current token are written when the parser reaches them, after the
+        // syntax errors of the tokens before
+        bool deferred = errors_deferred;
+        errors_deferred = lexer->count > 0;
+        Token token = lex_token(lexer);
+        errors_deferred = deferred;
+        keep_error(lexer, lexer->lexed - 1);
+
+        size_t slot = (lexer->head + lexer->count++) & lexer->ring_mask;
+        lexer->ring[slot] = token;
+        lexer->distances[slot] = 0;
+        lexer->done = token.type == EOF_TOKEN || token.type == ERROR_TOKEN;
+
+        // the closed bracket may have been consumed already
+        size_t head_index = lexer->lexed - lexer->count;
+        if (lexer->closed != NO_MATCH && lexer->closed >= head_index) {
+            size_t open_slot = (lexer->head + lexer->closed - head_index) & lexer->ring_mask;
+            lexer->distances[open_slot] = lexer->lexed - 1 - lexer->closed;
         }
+    }
+    return false;
+}
+
+// Check whether tokens of type carry a payload in a TokenStream.
+bool has_payload(TokenEnum type) {
+    switch (type) {
+        case INT_LITERAL:
+        case CHR_LITERAL:
+        case STR_LITERAL:
+        case VAR_NAME:    return true;
 
-    } while (chr);
+        default: return false;
+    }
+}
 
-    // add EOF terminator
-    Token eof = {
-        .type = EOF_TOKEN,
-        .str = NULL,
-        .line = line,
-        .col = col,
+// Build token i of stream, whose payload if any is the one at payload_pos.
+Token stream_token(const TokenStream* stream, size_t i, size_t payload_pos) {
+    Token token = {
+        .type = stream->kinds[i],
+        .str = { stream->program + stream->offsets[i], stream->lens[i] },
+        .pos = stream->offsets[i],
+        .data = {},
     };
-    if (dynarr_append(&array, &eof)) {
+
+    const TokenPayload* payload = &stream->payloads[payload_pos];
+    switch (token.type) {
+        case INT_LITERAL:
+            literal_t value = payload->int_literal;
+            token.data.int_literal = (IntLiteral) { value, literal_width(value) };
+            break;
+        case CHR_LITERAL: token.data.chr_literal = payload->chr_literal; break;
+        case STR_LITERAL:
+            token.data.str_literal = (StrView) {
+                stream->literals + payload->str_literal.offset,
+                payload->str_literal.len,
+            };
+            break;
+        case VAR_NAME: token.data.var_name = payload->var_name; break;
+        default:       break;
+    }
+    return token;
+}
+
+// Write the errors lexed while looking ahead at the tokens up to index, in the order they were
+// lexed.
+void write_lexer_errors(Lexer* lexer, size_t index) {
+    LexerError* errors = lexer->errors.c_arr;
+    size_t kept = 0;
+    for (size_t i = 0; i < lexer->errors.length; i++) {
+        if (errors[i].index <= index) {
+            fputs(errors[i].message, stderr);
+            mem_free(errors[i].message);
+        } else {
+            errors[kept++] = errors[i];
+        }
+    }
+    lexer->errors.length = kept;
+}
+
+// Write the errors lexed while looking ahead that were not written yet.
+void report_lexer_errors(Lexer* lexer) {
+    write_lexer_errors(lexer, SIZE_MAX);
+}
+
+// Look n tokens ahead of the current token without consuming anything.
+// The EOF_TOKEN or ERROR_TOKEN ending the stream repeats forever.
+// The result is valid until the next call on lexer.
+const Token* peek(Lexer* lexer, size_t n) {
+    if (lexer->stream) {
+        const TokenStream* stream = lexer->stream;
+        size_t i = lexer->pos + n < stream->len ? lexer->pos + n : stream->len - 1;
+
+        // payloads of the skipped tokens come first
+        size_t payload_pos = lexer->payload_pos;
+        for (size_t j = lexer->pos; j < i; j++) payload_pos += has_payload(stream->kinds[j]);
+
+        lexer->peeked = stream_token(stream, i, payload_pos);
+        return &lexer->peeked;
+    }
+
+    if (n >= lexer->count && fill_ring(lexer, n)) {
+        static const Token error = { .type = ERROR_TOKEN, .str = { "", 0 } };
+        lexer->failed = true;
+        return &error;
+    }
+    if (lexer->errors.length) write_lexer_errors(lexer, lexer->lexed - lexer->count);
+    if (n >= lexer->count) n = lexer->count - 1;
+    return &lexer->ring[(lexer->head + n) & lexer->ring_mask];
+}
+
+// Find the type of the token n tokens ahead of the current token.
+// Token streams are looked ahead in their dense type array only.
+TokenEnum peek_type(Lexer* lexer, size_t n) {
+    if (lexer->stream) {
+        const TokenStream* stream = lexer->stream;
+        size_t i = lexer->pos + n < stream->len ? lexer->pos + n : stream->len - 1;
+        return stream->kinds[i];
+    }
+    return peek(lexer, n)->type;
+}
+
+// Find how many tokens after the opening bracket n tokens ahead of the current token its closing
+// bracket is, lexing up to it if necessary.
+// Returns 0 if that token is not an opening bracket, it is never closed or an error occurred.
+size_t peek_match(Lexer* lexer, size_t n) {
+    if (closing_bracket(peek_type(lexer, n)) == ERROR_TOKEN) return 0;
+    if (lexer->stream) {
+        size_t i = lexer->pos + n;
+        return lexer->stream->matches[i] - i;
+    }
+
+    while (lexer->distances[(lexer->head + n) & lexer->ring_mask] == 0 && !lexer->done) {
+        if (fill_ring(lexer, lexer->count)) {
+            lexer->failed = true;
+            return 0;
+        }
+    }
+    size_t distance = lexer->distances[(lexer->head + n) & lexer->ring_mask];
+    return distance == NO_MATCH ? 0 : distance;
+}
+
+// Track the brackets left open after consuming a token of type.
+void count_depth(Lexer* lexer, TokenEnum type) {
+    if (is_bracket(type)) lexer->depth += closing_bracket(type) != ERROR_TOKEN ? 1 : -1;
+}
+
+// Consume the current token.
+// The EOF_TOKEN or ERROR_TOKEN ending the stream is never consumed.
+Token next_token(Lexer* lexer) {
+    if (lexer->stream) {
+        const TokenStream* stream = lexer->stream;
+        Token token = stream_token(stream, lexer->pos, lexer->payload_pos);
+        if (lexer->pos + 1 < stream->len) {
+            lexer->payload_pos += has_payload(token.type);
+            count_depth(lexer, token.type);
+            lexer->pos++;
+        }
+        return token;
+    }
+
+    Token token = *peek(lexer, 0);
+    if (lexer->count > 1 || !lexer->done) {
+        size_t distance = lexer->distances[lexer->head];
+        lexer->head = (lexer->head + 1) & lexer->ring_mask;
+        lexer->count--;
+        // brackets that are never closed do not count
+        if (distance != NO_MATCH) count_depth(lexer, token.type);
+    }
+    return token;
+}
+
+// Lex ahead until the innermost bracket left open by the consumed tokens is closed, or is known
+// to be never closed and no longer counts in the depth of lexer.
+void settle_depth(Lexer* lexer) {
+    if (lexer->stream) return;
+    for (size_t n = 0; lexer->depth > 0; n++) {
+        TokenEnum type = peek_type(lexer, n);
+        if (type == EOF_TOKEN || type == ERROR_TOKEN) return;
+        if (closing_bracket(type) != ERROR_TOKEN) n += peek_match(lexer, n);
+        else if (is_bracket(type)) return;
+    }
+}
+
+// Grow the token arrays of stream to hold capacity tokens.
+// Returns whether an error occurred.
+bool reserve_tokens(TokenStream* stream, size_t capacity) {
+    uint8_t* kinds = mem_realloc(stream->kinds, capacity * sizeof(uint8_t), TOKEN_MEM);
+    if (kinds) stream->kinds = kinds;
+    pos_t* offsets = mem_realloc(stream->offsets, capacity * sizeof(pos_t), TOKEN_MEM);
+    if (offsets) stream->offsets = offsets;
+    uint32_t* lens = mem_realloc(stream->lens, capacity * sizeof(uint32_t), TOKEN_MEM);
+    if (lens) stream->lens = lens;
+    uint32_t* matches = mem_realloc(stream->matches, capacity * sizeof(uint32_t), TOKEN_MEM);
+    if (matches) stream->matches = matches;
+
+    if (kinds == NULL || offsets == NULL || lens == NULL || matches == NULL) {
+        malloc_error();
+        return true;
+    }
+    return false;
+}
+
+// Lex the rest of the source of lexer into the token arrays of stream.
+// Payloads and decoded string literals are appended to payloads and literals.
+// Returns whether an error occurred.
+bool lex_tokens(Lexer* lexer, TokenStream* stream, DynArr* payloads, DynArr* literals) {
+    // string literals are decoded in place
+    lexer->literal_buf = literals;
+
+    size_t capacity = stream->len;
+    Token token;
+    do {
+        token = lex_token(lexer);
+        if (token.type == ERROR_TOKEN || lexer->mismatched) return true;
+
+        if (stream->len == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            if (reserve_tokens(stream, capacity)) return true;
+        }
+        size_t i = stream->len++;
+        stream->kinds[i] = token.type;
+        stream->offsets[i] = token.pos;
+        stream->lens[i] = token.str.len;
+        // brackets left open for later chunks match themselves until then
+        stream->matches[i] = i;
+        if (lexer->closed != NO_MATCH) {
+            stream->matches[i] = lexer->closed;
+            stream->matches[lexer->closed] = i;
+        }
+
+        TokenPayload payload;
+        switch (token.type) {
+            case INT_LITERAL: payload.int_literal = token.data.int_literal.value; break;
+            case CHR_LITERAL: payload.chr_literal = token.data.chr_literal; break;
+            case STR_LITERAL:
+                // already decoded into literals
+                StrView value = token.data.str_literal;
+                payload.str_literal = (StrRef) { value.ptr - (char*)literals->c_arr, value.len };
+                break;
+            case VAR_NAME: payload.var_name = token.data.var_name; break;
+            default:       continue;
+        }
+        if (dynarr_append(payloads, &payload)) return true;
+    } while (token.type != EOF_TOKEN);
+    return false;
+}
+
+// Tokenize program of length len.
+// Result is terminated by an EOF_TOKEN.
+// Returns NULL if an error occurred.
+TokenStream* tokenize(const char* program, size_t len) {
+    if (program == NULL) return NULL;
+
+    Lexer lexer = lexer_create(program, len);
+    if (lexer.failed) goto err_free_lexer;
+
+    TokenStream* stream = mem_alloc(sizeof(TokenStream), TOKEN_MEM);
+    if (stream == NULL) {
+        malloc_error();
+        goto err_free_lexer;
+    }
+    *stream = (TokenStream) { .program = program };
+
+    DynArr payloads = dynarr_create(sizeof(TokenPayload), TOKEN_MEM);
+    // decoded string literals, null terminated and in token order
+    DynArr literals = dynarr_create(sizeof(char), STRING_MEM);
+    if (lex_tokens(&lexer, stream, &payloads, &literals)) goto err_free_arrs;
+
+    stream->payloads = payloads.c_arr;
+    stream->literals = literals.c_arr;
+    lexer_destroy(&lexer);
+    return stream;
+err_free_arrs:
+    dynarr_destroy(&payloads);
+    dynarr_destroy(&literals);
+    free_token_stream(stream);
+err_free_lexer:
+    lexer_destroy(&lexer);
+    return NULL;
+}
+
+typedef struct TokenChunk TokenChunk;
+
+// Part of a program tokenized on its own thread by tokenize_parallel.
+struct TokenChunk {
+    pthread_t thread;
+    bool joinable;
+    bool failed;
+
+    Lexer lexer;
+    Interner symbols;  // names that were not interned before tokenizing
+    TokenStream tokens;
+    DynArr payloads;
+    DynArr literals;
+    DynArr unmatched;  // indexes of closing brackets of earlier chunks
+
+    // place of the chunk in the stitched stream
+    TokenStream* dst;
+    size_t len;  // number of tokens kept, without the EOF_TOKEN unless it is the last chunk
+    size_t token_base;
+    size_t payload_base;
+    size_t literal_base;
+    symbol_t* remap;  // global symbols of the local ones
+};
+
+// Find the offset after the first line feed at or after from that does not follow a backslash.
+// Such a line feed ends every comment and cannot be inside a valid literal.
+// Returns len if there is none.
+size_t find_split(const char* program, size_t len, size_t from) {
+    for (const char* lf; (lf = memchr(program + from, '\n', len - from)) != NULL;) {
+        from = lf - program + 1;
+        if (lf == program || lf[-1] != '\\') return from;
+    }
+    return len;
+}
+
+// Lex a chunk, with errors reported later by tokenizing sequentially.
+void* lex_chunk(void* arg) {
+    TokenChunk* chunk = arg;
+    errors_muted = true;
+    chunk->failed = lex_tokens(&chunk->lexer, &chunk->tokens, &chunk->payloads, &chunk->literals);
+    return NULL;
+}
+
+// Copy the tokens of a chunk to its place in the stitched stream.
+void* copy_chunk(void* arg) {
+    TokenChunk* chunk = arg;
+    TokenStream* dst = chunk->dst;
+    memcpy(dst->kinds + chunk->token_base, chunk->tokens.kinds, chunk->len * sizeof(uint8_t));
+    memcpy(dst->offsets + chunk->token_base, chunk->tokens.offsets, chunk->len * sizeof(pos_t));
+    memcpy(dst->lens + chunk->token_base, chunk->tokens.lens, chunk->len * sizeof(uint32_t));
+    // other tokens match themselves like in tokenize, brackets matched across chunks are
+    // overwritten later
+    for (size_t i = 0; i < chunk->len; i++) {
+        dst->matches[chunk->token_base + i] = chunk->token_base + chunk->tokens.matches[i];
+    }
+    if (chunk->literals.length) {
+        memcpy(dst->literals + chunk->literal_base, chunk->literals.c_arr, chunk->literals.length);
+    }
+
+    // rebase string literals and replace local symbols
+    const TokenPayload* src = chunk->payloads.c_arr;
+    TokenPayload* payloads = dst->payloads + chunk->payload_base;
+    for (size_t i = 0, j = 0; i < chunk->len; i++) {
+        switch ((TokenEnum)chunk->tokens.kinds[i]) {
+            case INT_LITERAL:
+            case CHR_LITERAL: payloads[j] = src[j]; break;
+            case STR_LITERAL:
+                payloads[j] = src[j];
+                payloads[j].str_literal.offset += chunk->literal_base;
+                break;
+            case VAR_NAME:
+                symbol_t symbol = src[j].var_name;
+                if (symbol & LOCAL_SYMBOL) symbol = chunk->remap[(symbol & ~LOCAL_SYMBOL) - 1];
+                payloads[j].var_name = symbol;
+                break;
+            default: continue;
+        }
+        j++;
+    }
+    return NULL;
+}
+
+// Run fn on every chunk, each on its own thread if one can be started.
+void run_chunks(TokenChunk* chunks, size_t count, void* (*fn)(void*)) {
+    for (size_t i = 0; i < count; i++) {
+        chunks[i].joinable = pthread_create(&chunks[i].thread, NULL, fn, &chunks[i]) == 0;
+        if (!chunks[i].joinable) fn(&chunks[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].joinable) pthread_join(chunks[i].thread, NULL);
+    }
+}
+
+// Free all data of count chunks, and the chunks themselves.
+void free_chunks(TokenChunk* chunks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        lexer_destroy(&chunks[i].lexer);
+        interner_destroy(&chunks[i].symbols);
+        mem_free(chunks[i].tokens.kinds);
+        mem_free(chunks[i].tokens.offsets);
+        mem_free(chunks[i].tokens.lens);
+        mem_free(chunks[i].tokens.matches);
+        dynarr_destroy(&chunks[i].payloads);
+        dynarr_destroy(&chunks[i].literals);
+        dynarr_destroy(&chunks[i].unmatched);
+        mem_free(chunks[i].remap);
+    }
+    mem_free(chunks);
+}
+
+// Match the brackets the chunks of stream left open or closed with each other, in chunk order.
+// Returns whether a bracket is unbalanced or an error occurred.
+bool match_chunks(TokenChunk* chunks, size_t count, TokenStream* stream) {
+    // indexes of the opening brackets of earlier chunks that are not closed yet
+    DynArr open = dynarr_create(sizeof(size_t), ARRAY_MEM);
+    for (size_t i = 0; i < count; i++) {
+        TokenChunk* chunk = &chunks[i];
+
+        // a chunk closes brackets of earlier chunks before it opens any it leaves open
+        const size_t* closing = chunk->unmatched.c_arr;
+        for (size_t j = 0; j < chunk->unmatched.length; j++) {
+            if (open.length == 0) goto err_free_open;
+            size_t index = ((size_t*)open.c_arr)[--open.length];
+            size_t match = chunk->token_base + closing[j];
+            if (closing_bracket(stream->kinds[index]) != stream->kinds[match]) goto err_free_open;
+            stream->matches[index] = match;
+            stream->matches[match] = index;
+        }
+
+        const OpenBracket* opening = chunk->lexer.brackets.c_arr;
+        for (size_t j = 0; j < chunk->lexer.brackets.length; j++) {
+            size_t index = chunk->token_base + opening[j].index;
+            if (dynarr_append(&open, &index)) goto err_free_open;
+        }
+    }
+    if (open.length) goto err_free_open;
+
+    dynarr_destroy(&open);
+    return false;
+err_free_open:
+    dynarr_destroy(&open);
+    return true;
+}
+
+// Get the number of processors available to run threads on, at least 1.
+size_t online_cpus(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 1) return count;
+#endif
+    return 1;
+}
+
+// Tokenize program of length len on up to threads threads.
+// The program is split into chunks after line feeds outside of literals and comments, and their
+// tokens are stitched into the same stream, with the same symbols, as tokenize produces.
+// Errors are reported by tokenizing sequentially, so they are the same as well.
+// Returns NULL if an error occurred.
+TokenStream* tokenize_parallel(const char* program, size_t len, size_t threads) {
+    if (program == NULL) return NULL;
+
+    // a null character ends the program, so no chunk may start after it
+    const char* nul = memchr(program, '\0', len);
+    size_t lexed_len = nul ? (size_t)(nul - program) : len;
+    if (threads > lexed_len / TOKENIZE_MIN_CHUNK) threads = lexed_len / TOKENIZE_MIN_CHUNK;
+    if (threads <= 1 || len > UINT32_MAX) return tokenize(program, len);
+
+    TokenChunk* chunks = mem_calloc(threads, sizeof(TokenChunk), TOKEN_MEM);
+    if (chunks == NULL) {
         malloc_error();
-        dynarr_destroy(&array);
         return NULL;
     }
 
-    return array.c_arr;
+    // global state is set up before any thread reads it
+    scan_kernels();
+    size_t count = 0;
+    for (size_t begin = 0; begin < lexed_len; count++) {
+        size_t target = (count + 1) * lexed_len / threads;
+        size_t end = count + 1 < threads
+                       ? find_split(program, lexed_len, target > begin ? target : begin)
+                       : lexed_len;
+        // the last chunk keeps the rest of the program
+        if (end == lexed_len) end = len;
+
+        TokenChunk* chunk = &chunks[count];
+        chunk->lexer = lexer_create("", 0);
+        chunk->lexer.start = program;
+        chunk->lexer.it = program + begin;
+        chunk->lexer.end = program + end;
+        chunk->lexer.symbols = &chunk->symbols;
+        chunk->symbols = interner_create();
+        chunk->payloads = dynarr_create(sizeof(TokenPayload), TOKEN_MEM);
+        chunk->literals = dynarr_create(sizeof(char), STRING_MEM);
+        chunk->unmatched = dynarr_create(sizeof(size_t), ARRAY_MEM);
+        chunk->lexer.unmatched = &chunk->unmatched;
+        begin = end;
+    }
+
+    run_chunks(chunks, count, lex_chunk);
+    for (size_t i = 0; i < count; i++) {
+        if (chunks[i].failed) {
+            free_chunks(chunks, count);
+            return tokenize(program, len);
+        }
+    }
+
+    // intern local symbols in chunk order, which is the order tokenize interns them in
+    size_t total_tokens = 0, total_payloads = 0, total_literals = 0;
+    for (size_t i = 0; i < count; i++) {
+        TokenChunk* chunk = &chunks[i];
+        chunk->len = chunk->tokens.len - (i + 1 < count);
+        chunk->token_base = total_tokens;
+        chunk->payload_base = total_payloads;
+        chunk->literal_base = total_literals;
+        total_tokens += chunk->len;
+        total_payloads += chunk->payloads.length;
+        total_literals += chunk->literals.length;
+
+        size_t local_count = interner_count(&chunk->symbols);
+        if (local_count == 0) continue;
+        chunk->remap = mem_alloc(local_count * sizeof(symbol_t), SYMBOL_MEM);
+        if (chunk->remap == NULL) {
+            malloc_error();
+            goto err_free_chunks;
+        }
+        for (size_t j = 0; j < local_count; j++) {
+            StrView name = interner_name(&chunk->symbols, j + 1);
+            chunk->remap[j] = intern(name.ptr, name.len);
+            if (chunk->remap[j] == NO_SYMBOL) goto err_free_chunks;
+        }
+    }
+
+    TokenStream* stream = mem_alloc(sizeof(TokenStream), TOKEN_MEM);
+    if (stream == NULL) {
+        malloc_error();
+        goto err_free_chunks;
+    }
+    *stream = (TokenStream) { .program = program, .len = total_tokens };
+    if (reserve_tokens(stream, total_tokens)) goto err_free_stream;
+    stream->payloads = mem_alloc(total_payloads * sizeof(TokenPayload), TOKEN_MEM);
+    stream->literals = mem_alloc(total_literals, STRING_MEM);
+    if ((stream->payloads == NULL && total_payloads) ||
+        (stream->literals == NULL && total_literals)) {
+        malloc_error();
+        goto err_free_stream;
+    }
+
+    for (size_t i = 0; i < count; i++) chunks[i].dst = stream;
+    run_chunks(chunks, count, copy_chunk);
+    if (match_chunks(chunks, count, stream)) {
+        // unbalanced brackets are reported by tokenizing sequentially
+        free_token_stream(stream);
+        free_chunks(chunks, count);
+        return tokenize(program, len);
+    }
+
+    free_chunks(chunks, count);
+    return stream;
+err_free_stream:
+    free_token_stream(stream);
+err_free_chunks:
+    free_chunks(chunks, count);
+    return NULL;
 }
 
-// Free all data inside token.
-void free_token(Token token) {
-    switch (token.type) {
-        case ERROR_TOKEN:
-        case EOF_TOKEN:   break;
+// Find the offset after the last line feed before to that does not follow a backslash, so that
+// lexing can start there as it does in find_split.
+// Returns 0 if there is none.
+size_t find_split_before(const char* program, size_t to) {
+    for (size_t i = to; i > 0; i--) {
+        if (program[i - 1] == '\n' && (i == 1 || program[i - 2] != '\\')) return i;
+    }
+    return 0;
+}
 
-        case STR_LITERAL:
-            free(token.str);
-            free(token.data.str_literal);
-            break;
+// Find the index of the first token of stream at or after offset.
+size_t find_token(const TokenStream* stream, size_t offset) {
+    size_t lo = 0, hi = stream->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (stream->offsets[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Match all brackets of stream, the way lex_tokens does.
+// Returns whether a bracket is unbalanced or an error occurred.
+bool match_brackets(TokenStream* stream) {
+    // indexes of the opening brackets that are not closed yet
+    DynArr open = dynarr_create(sizeof(size_t), ARRAY_MEM);
+    for (size_t i = 0; i < stream->len; i++) {
+        TokenEnum kind = stream->kinds[i];
+        stream->matches[i] = i;
+        if (!is_bracket(kind)) continue;
 
-        default: free(token.str); break;
+        if (closing_bracket(kind) != ERROR_TOKEN) {
+            if (dynarr_append(&open, &i)) goto err_free_open;
+            continue;
+        }
+        if (open.length == 0) goto err_free_open;
+        size_t index = ((size_t*)open.c_arr)[--open.length];
+        if (closing_bracket(stream->kinds[index]) != kind) goto err_free_open;
+        stream->matches[index] = i;
+        stream->matches[i] = index;
     }
+    if (open.length) goto err_free_open;
+
+    dynarr_destroy(&open);
+    return false;
+err_free_open:
+    dynarr_destroy(&open);
+    return true;
 }
 
-// Free token array of length n and all token data inside it.
-void free_token_arrn(Token* arr, size_t n) {
-    if (arr == NULL) return;
-    for (size_t i = 0; i < n; i++) free_token(arr[i]);
-    free(arr);
+// Copy the tokens of stream from index begin to end to their place in dst, moved by shift bytes,
+// with their payloads from payload_pos and their literals moved by literal_shift bytes.
+void copy_kept_tokens(
+    TokenStream* dst, size_t token_base, size_t payload_base, const TokenStream* stream,
+    size_t begin, size_t end, size_t payload_pos, ptrdiff_t shift, ptrdiff_t literal_shift
+) {
+    size_t len = end - begin;
+    memcpy(dst->kinds + token_base, stream->kinds + begin, len * sizeof(uint8_t));
+    memcpy(dst->lens + token_base, stream->lens + begin, len * sizeof(uint32_t));
+    for (size_t i = 0; i < len; i++) {
+        dst->offsets[token_base + i] = stream->offsets[begin + i] + shift;
+    }
+
+    TokenPayload* payloads = dst->payloads + payload_base;
+    const TokenPayload* src = stream->payloads + payload_pos;
+    for (size_t i = begin, j = 0; i < end; i++) {
+        if (!has_payload(stream->kinds[i])) continue;
+        payloads[j] = src[j];
+        if (stream->kinds[i] == STR_LITERAL) payloads[j].str_literal.offset += literal_shift;
+        j++;
+    }
 }
 
-// Free generic token array and all token data inside it.
-void free_token_dynarr(DynArr* arr) {
-    if (arr == NULL) return;
-    for (size_t i = 0; i < arr->length; i++) free_token(*(Token*)dynarr_get(arr, i));
-    dynarr_destroy(arr);
+// Tokenize program of length len, which is the program of stream after edit.
+// Only the lines around the edit are lexed again, from and to line feeds find_split would split
+// at, and the tokens of stream before and after them are kept. The range of tokens that was
+// replaced is stored in damage.
+// Errors are reported by tokenizing the whole program, so they are the same as tokenize reports.
+// Returns NULL if an error occurred.
+TokenStream* retokenize(
+    const TokenStream* stream, const char* program, size_t len, TextEdit edit, TokenDamage* damage
+) {
+    if (stream == NULL || program == NULL) return NULL;
+
+    // the text of stream ends at its EOF_TOKEN unless it holds a null character
+    size_t old_len = stream->offsets[stream->len - 1];
+    size_t removed = edit.end - edit.start;
+    if (edit.start > edit.end || edit.end > old_len || len != old_len - removed + edit.len ||
+        len > UINT32_MAX)
+    {
+        goto tokenize_all;
+    }
+
+    // edited lines, as offsets in program
+    size_t from = find_split_before(program, edit.start);
+    size_t edit_end = edit.start + edit.len;
+    size_t to = edit_end + 1 < len ? find_split(program, len, edit_end + 1) : len;
+    // a null character would end the program early
+    if (memchr(program + from, '\0', to - from)) goto tokenize_all;
+
+    size_t begin = find_token(stream, from);
+    size_t old_end = to == len ? stream->len : find_token(stream, to + removed - edit.len);
+
+    TokenChunk* lines = mem_calloc(1, sizeof(TokenChunk), TOKEN_MEM);
+    if (lines == NULL) {
+        malloc_error();
+        return NULL;
+    }
+    lines->lexer = lexer_create(program, len);
+    lines->lexer.it = program + from;
+    lines->lexer.end = program + to;
+    lines->payloads = dynarr_create(sizeof(TokenPayload), TOKEN_MEM);
+    lines->literals = dynarr_create(sizeof(char), STRING_MEM);
+    // brackets are matched in the whole stream later
+    lines->unmatched = dynarr_create(sizeof(size_t), ARRAY_MEM);
+    lines->lexer.unmatched = &lines->unmatched;
+
+    bool muted = errors_muted;
+    errors_muted = true;
+    lines->failed = lines->lexer.failed ||
+                    lex_tokens(&lines->lexer, &lines->tokens, &lines->payloads, &lines->literals);
+    errors_muted = muted;
+    if (lines->failed) {
+        free_chunks(lines, 1);
+        goto tokenize_all;
+    }
+    // the EOF_TOKEN is only kept at the end of the program
+    lines->len = lines->tokens.len - (to < len);
+
+    // payloads and literal bytes of the tokens before begin, before old_end and in total
+    size_t payload_count = 0, literal_len = 0;
+    size_t payload_begin = 0, payload_old_end = 0, literal_begin = 0, literal_old_end = 0;
+    for (size_t i = 0; i <= stream->len; i++) {
+        if (i == begin) payload_begin = payload_count, literal_begin = literal_len;
+        if (i == old_end) payload_old_end = payload_count, literal_old_end = literal_len;
+        if (i == stream->len || !has_payload(stream->kinds[i])) continue;
+
+        if (stream->kinds[i] == STR_LITERAL) {
+            StrRef literal = stream->payloads[payload_count].str_literal;
+            literal_len = literal.offset + literal.len + 1;
+        }
+        payload_count++;
+    }
+    lines->token_base = begin;
+    lines->payload_base = payload_begin;
+    lines->literal_base = literal_begin;
+
+    size_t suffix = begin + lines->len;
+    size_t total_tokens = suffix + stream->len - old_end;
+    size_t total_payloads =
+        payload_begin + lines->payloads.length + payload_count - payload_old_end;
+    size_t suffix_literals = literal_len - literal_old_end;
+    size_t total_literals = literal_begin + lines->literals.length + suffix_literals;
+
+    TokenStream* result = mem_alloc(sizeof(TokenStream), TOKEN_MEM);
+    if (result == NULL) {
+        malloc_error();
+        goto err_free_lines;
+    }
+    *result = (TokenStream) { .program = program, .len = total_tokens };
+    if (reserve_tokens(result, total_tokens)) goto err_free_result;
+    result->payloads = mem_alloc(total_payloads * sizeof(TokenPayload), TOKEN_MEM);
+    result->literals = mem_alloc(total_literals, STRING_MEM);
+    if ((result->payloads == NULL && total_payloads) ||
+        (result->literals == NULL && total_literals))
+    {
+        malloc_error();
+        goto err_free_result;
+    }
+
+    // tokens before, in and after the edited lines
+    ptrdiff_t shift = (ptrdiff_t)edit.len - (ptrdiff_t)removed;
+    ptrdiff_t literal_shift =
+        (ptrdiff_t)(literal_begin + lines->literals.length) - (ptrdiff_t)literal_old_end;
+    copy_kept_tokens(result, 0, 0, stream, 0, begin, 0, 0, 0);
+    if (literal_begin) memcpy(result->literals, stream->literals, literal_begin);
+    lines->dst = result;
+    copy_chunk(lines);
+    copy_kept_tokens(
+        result, suffix, total_payloads - (payload_count - payload_old_end), stream, old_end,
+        stream->len, payload_old_end, shift, literal_shift
+    );
+    if (suffix_literals) {
+        memcpy(
+            result->literals + literal_begin + lines->literals.length,
+            stream->literals + literal_old_end, suffix_literals
+        );
+    }
+    free_chunks(lines, 1);
+
+    if (match_brackets(result)) {
+        // unbalanced brackets are reported by tokenizing the whole program
+        free_token_stream(result);
+        goto tokenize_all;
+    }
+
+    *damage = (TokenDamage) {
+        .begin = begin,
+        .old_end = old_end,
+        .new_end = suffix,
+        .shift = shift,
+        .literal_shift = literal_shift,
+    };
+    return result;
+err_free_result:
+    free_token_stream(result);
+err_free_lines:
+    free_chunks(lines, 1);
+    return NULL;
+tokenize_all:
+    // no token is kept
+    TokenStream* tokens = tokenize(program, len);
+    if (tokens == NULL) return NULL;
+    *damage = (TokenDamage) { .begin = 0, .old_end = stream->len, .new_end = tokens->len };
+    return tokens;
 }
 
-// Free EOF terminated token array and all token data inside it.
-void free_token_arr(Token* arr) {
-    if (arr == NULL) return;
-    for (Token* it = arr; it->type != EOF_TOKEN; it++) free_token(*it);
-    free(arr);
+// Free stream and all token data inside it.
+void free_token_stream(TokenStream* stream) {
+    if (stream == NULL) return;
+    mem_free(stream->kinds);
+    mem_free(stream->offsets);
+    mem_free(stream->lens);
+    mem_free(stream->matches);
+    mem_free(stream->payloads);
+    mem_free(stream->literals);
+    mem_free(stream);
 }
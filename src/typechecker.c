@@ -4,69 +4,170 @@
 #include <string.h>
 
 #include "printerr.h"
+#include "visitor.h"
 
 size_t id = 1;
 
-typedef struct SymbolTable SymbolTable;
-struct SymbolTable {
-    SymbolTable* parent;
-    size_t len;
-    char** symbols;
-    Type* types;
-};
-
-bool typecheck_stmt(Stmt* stmt, SymbolTable* table);
-
-void free_type(Type type);
-void free_type_arrn(Type* arr, size_t n);
-void free_symbol_table(SymbolTable table);
-void free_expr_annots(Expr expr);
-void free_expr_arrn_annots(Expr* arr, size_t n);
-void free_stmt_annots(Stmt stmt);
-void free_stmt_arrn_annots(Stmt* arr, size_t n);
-
-Type lookup_symbol(SymbolTable* table, Token symbol) {
-    if (table == NULL) {
-        error_line = symbol.line;
-        error_col = symbol.col;
-        type_error("identifier '%s' is undefined\n", symbol.data.var_name);
+// AST being typechecked, whose arena holds its annotations and the types inside them
+AST* typed_ast = NULL;
+// types and annotations made while typechecking, moved to the arena of typed_ast at the end
+Arena type_arena = { NULL, TYPE_MEM };
+Arena annotation_arena = { NULL, ANNOTATION_MEM };
+
+SymbolTable symbol_table_create(void) {
+    return (SymbolTable) {
+        .bindings = dynarr_create(sizeof(Binding), SCOPE_MEM),
+        .scopes = dynarr_create(sizeof(size_t), SCOPE_MEM),
+        .slots = NULL,
+        .slot_mask = 0,
+        .names = 0,
+    };
+}
+
+void free_symbol_table(SymbolTable* table) {
+    dynarr_destroy(&table->bindings);
+    dynarr_destroy(&table->scopes);
+    mem_free(table->slots);
+    table->slots = NULL;
+    table->slot_mask = 0;
+    table->names = 0;
+}
+
+// Find the slot of symbol in the hash table of table, which must have one.
+// The slot is empty if symbol was never declared.
+SymbolSlot* find_symbol_slot(const SymbolTable* table, symbol_t symbol) {
+    // symbols are dense, so a multiplicative hash keeps consecutive ones in distinct slots
+    size_t slot = (symbol * 2654435769u) & table->slot_mask;
+    while (table->slots[slot].symbol != NO_SYMBOL && table->slots[slot].symbol != symbol) {
+        slot = (slot + 1) & table->slot_mask;
+    }
+    return &table->slots[slot];
+}
+
+// Double the hash table size of table and reinsert all names.
+// Returns whether an error occurred.
+bool grow_symbol_slots(SymbolTable* table) {
+    SymbolTable grown = *table;
+    size_t count = table->slot_mask ? (table->slot_mask + 1) * 2 : 64;
+    grown.slots = mem_calloc(count, sizeof(SymbolSlot), SCOPE_MEM);
+    if (grown.slots == NULL) {
+        malloc_error();
+        return true;
+    }
+    grown.slot_mask = count - 1;
+
+    for (size_t i = 0; table->slots && i <= table->slot_mask; i++) {
+        if (table->slots[i].symbol == NO_SYMBOL) continue;
+        *find_symbol_slot(&grown, table->slots[i].symbol) = table->slots[i];
+    }
+
+    mem_free(table->slots);
+    *table = grown;
+    return false;
+}
+
+// Open a scope in table, innermost until it is closed.
+// Returns whether an error occurred.
+bool push_scope(SymbolTable* table) {
+    size_t scope = table->bindings.length;
+    return dynarr_append(&table->scopes, &scope);
+}
+
+// Declare symbol in the innermost scope of table, still undefined.
+// Only the first declaration of a name in a scope is bound.
+// Returns whether an error occurred.
+bool declare_symbol(SymbolTable* table, symbol_t symbol) {
+    // keep the load factor at most one half
+    if (table->names * 2 >= table->slot_mask && grow_symbol_slots(table)) return true;
+
+    SymbolSlot* slot = find_symbol_slot(table, symbol);
+    size_t scope = ((size_t*)table->scopes.c_arr)[table->scopes.length - 1];
+    bool bound = slot->symbol != NO_SYMBOL && slot->binding != NO_BINDING;
+    if (bound && slot->binding >= scope) return false;
+
+    // indexes are 32-bit
+    if (table->bindings.length >= NO_BINDING) {
+        malloc_error();
+        return true;
+    }
+    Binding binding = {
+        .symbol = symbol,
+        .shadowed = bound ? slot->binding : NO_BINDING,
+        .type = { UNDEFINED_TYPE, false, false, {} },
+    };
+    if (dynarr_append(&table->bindings, &binding)) return true;
+
+    if (slot->symbol == NO_SYMBOL) table->names++;
+    slot->symbol = symbol;
+    slot->binding = table->bindings.length - 1;
+    return false;
+}
+
+// Find the innermost binding of symbol in table.
+// Returns NULL if symbol is not in scope.
+Binding* find_binding(const SymbolTable* table, symbol_t symbol) {
+    if (table->slots == NULL) return NULL;
+    const SymbolSlot* slot = find_symbol_slot(table, symbol);
+    if (slot->symbol == NO_SYMBOL || slot->binding == NO_BINDING) return NULL;
+    return (Binding*)table->bindings.c_arr + slot->binding;
+}
+
+Type lookup_symbol(const SymbolTable* table, Token symbol) {
+    const Binding* binding = find_binding(table, symbol.data.var_name);
+
+    // names declared later in their block are undefined until then
+    if (binding == NULL || binding->type.type == UNDEFINED_TYPE) {
+        error_pos = symbol.pos;
+        type_error(
+            "identifier '%" PRIstrview "' is undefined\n",
+            STRVIEW_ARG(symbol_name(symbol.data.var_name))
+        );
         return (Type) { ERROR_TYPE, false, false, {} };
     }
-    for (size_t i = 0; i < table->len; i++) {
-        if (strcmp(table->symbols[i], symbol.data.var_name) == 0) {
-            if (table->types[i].type == UNDEFINED_TYPE) {
-                error_line = symbol.line;
-                error_col = symbol.col;
-                type_error("identifier '%s' is undefined\n", symbol.data.var_name);
-                return (Type) { ERROR_TYPE, false, false, {} };
-            }
-            return table->types[i];
-        }
+    return binding->type;
+}
+
+// Find the integer type of the keyword width.
+TypeEnum int_type(TokenEnum width) {
+    switch (width) {
+        case I8_TOKEN:  return I8_TYPE;
+        case I16_TOKEN: return I16_TYPE;
+        case I32_TOKEN: return I32_TYPE;
+        case I64_TOKEN: return I64_TYPE;
+        case U8_TOKEN:  return U8_TYPE;
+        case U16_TOKEN: return U16_TYPE;
+        case U32_TOKEN: return U32_TYPE;
+        case U64_TOKEN: return U64_TYPE;
+        default:        return ERROR_TYPE;
     }
-    return lookup_symbol(table->parent, symbol);
 }
 
-Type typecheck_atom(Token atom, SymbolTable* table) {
+Type typecheck_atom(Token atom, const SymbolTable* table) {
     switch (atom.type) {
-        case INT_LITERAL: return (Type) { LITERAL_TYPE, false, false, {} };
+        case INT_LITERAL: return (Type) { int_type(atom.data.int_literal.width), false, false, {} };
         case CHR_LITERAL: return (Type) { U8_TYPE, false, false, {} };
         case STR_LITERAL:
             Type chr = { U8_TYPE, false, false, {} };
             Type str = { ARR_TYPE, false, false, { .ptr = { &chr, false } } };
-            return clone_type(str);
-        case VAR_NAME: return clone_type(lookup_symbol(table, atom));
+            return clone_type(str, &type_arena);
+        case VAR_NAME: return clone_type(lookup_symbol(table, atom), &type_arena);
 
         default: return (Type) { ERROR_TYPE, false, false, {} };
     }
 }
 
-Type typecheck_expr(Expr* expr, SymbolTable* table) {
+// Type expr after its children were typed, and annotate it with the type.
+Type typecheck_expr(expr_t id, const SymbolTable* table) {
+    const Expr* expr = &typed_ast->exprs[id];
     Type type = (Type) { ERROR_TYPE, false, false, {} };
     switch (expr->type) {
-        case ERROR_EXPR:   return type;
-        case NO_EXPR:      type = (Type) { VOID_TYPE, false, false, {} }; break;
-        case GROUPED_EXPR: type = typecheck_expr(expr->data.group, table); break;
-        case ATOMIC_EXPR:  type = typecheck_atom(expr->data.atom, table); break;
+        case ERROR_EXPR: return type;
+        case NO_EXPR:    type = (Type) { VOID_TYPE, false, false, {} }; break;
+        case GROUPED_EXPR:
+            const Type* group = typed_ast->annotations[expr->data.group];
+            if (group) type = *group;
+            break;
+        case ATOMIC_EXPR: type = typecheck_atom(typed_ast->tokens[expr->data.atom], table); break;
         case ARR_EXPR:
         case LAMBDA_EXPR:
         case UNOP_EXPR:
@@ -78,90 +179,62 @@ Type typecheck_expr(Expr* expr, SymbolTable* table) {
         case ACCESS_EXPR:
     }
 
-    expr->annotation = malloc(sizeof(Type));
-    if (expr->annotation == NULL) {
-        malloc_error();
-        free_type(type);
-        return (Type) { ERROR_TYPE, false, false, {} };
-    }
-    memcpy(expr->annotation, &type, sizeof(Type));
+    Type* annotation = arena_dup(&annotation_arena, &type, sizeof(Type), _Alignof(Type));
+    if (annotation == NULL) return (Type) { ERROR_TYPE, false, false, {} };
+    typed_ast->annotations[id] = annotation;
 
     return type;
 }
 
-bool typecheck_block(Stmt* stmt, SymbolTable* table) {
-    size_t length = 0;
-    for (size_t i = 0; i < stmt->data.block.len; i++) {
-        switch (stmt->data.block.stmts[i].type) {
-            case ERROR_STMT: return true;
-
-            case DECL:
-            case TYPEDEF:
-            case FUNCTION_STMT:
-            case STRUCT_STMT:
-            case ENUM_STMT:     length++; break;
-
-            default: break;
-        }
-    }
-
-    SymbolTable scope;
-    scope.parent = table;
-    scope.len = length;
-
-    if (length) {
-        scope.symbols = malloc(sizeof(char*) * length);
-        scope.types = malloc(sizeof(Type) * length);
-        if (scope.symbols == NULL || scope.types == NULL) {
-            malloc_error();
-            free(scope.symbols);
-            free(scope.types);
-            return true;
-        }
-    } else {
-        scope.symbols = NULL;
-        scope.types = NULL;
-    }
+// Open the scope of the block stmt in table, with the names it declares still undefined.
+// Returns whether an error occurred.
+bool open_scope(const Stmt* stmt, SymbolTable* table) {
+    if (push_scope(table)) return true;
 
-    for (size_t i = 0; i < length; i++) {
-        scope.types[i] = (Type) { UNDEFINED_TYPE, false, false, {} };
-    }
+    // the statements of the block are contiguous in the list pool
+    const stmt_t* stmts = &typed_ast->lists[stmt->data.block.stmts];
+    const Stmt* pool = typed_ast->stmts;
+    const Token* tokens = typed_ast->tokens;
 
-    length = 0;
     for (size_t i = 0; i < stmt->data.block.len; i++) {
-        Stmt decl = stmt->data.block.stmts[i];
-        switch (decl.type) {
-            case DECL:          scope.symbols[length++] = decl.data.decl.name.str; break;
-            case TYPEDEF:       scope.symbols[length++] = decl.data.type.name.str; break;
-            case FUNCTION_STMT: scope.symbols[length++] = decl.data.fun.name.str; break;
-            case STRUCT_STMT:   scope.symbols[length++] = decl.data.structdef.name.str; break;
-            case ENUM_STMT:     scope.symbols[length++] = decl.data.enumdef.name.str; break;
+        const Stmt* decl = &pool[stmts[i]];
+        token_t name;
+        switch (decl->type) {
+            case ERROR_STMT: return true;
 
-            default: break;
-        }
-    }
+            case DECL:          name = decl->data.decl.name; break;
+            case TYPEDEF:       name = decl->data.type.name; break;
+            case FUNCTION_STMT: name = decl->data.fun.name; break;
+            case STRUCT_STMT:   name = decl->data.structdef.name; break;
+            case ENUM_STMT:     name = decl->data.enumdef.name; break;
 
-    for (size_t i = 0; i < stmt->data.block.len; i++) {
-        if (typecheck_stmt(&stmt->data.block.stmts[i], &scope)) {
-            free_symbol_table(scope);
-            free_stmt_arrn_annots(stmt->data.block.stmts, i);
-            return true;
+            default: continue;
         }
+        if (declare_symbol(table, tokens[name].data.var_name)) return true;
     }
 
-    free_symbol_table(scope);
     return false;
 }
 
-bool typecheck_stmt(Stmt* stmt, SymbolTable* table) {
+// Close the innermost scope of table, restoring the bindings its names shadowed.
+void close_scope(SymbolTable* table) {
+    size_t scope = ((size_t*)table->scopes.c_arr)[--table->scopes.length];
+    const Binding* bindings = table->bindings.c_arr;
+    while (table->bindings.length > scope) {
+        const Binding* binding = &bindings[--table->bindings.length];
+        find_symbol_slot(table, binding->symbol)->binding = binding->shadowed;
+    }
+}
+
+// Typecheck stmt before its children, opening the scope of a block in table.
+// Returns whether an error occurred.
+bool typecheck_stmt(stmt_t id, SymbolTable* table) {
+    const Stmt* stmt = &typed_ast->stmts[id];
     switch (stmt->type) {
         case ERROR_STMT: return true;
         case NOP:        return false;
-        case BLOCK:      return typecheck_block(stmt, table);
-        case EXPR_STMT:
-            Type type = typecheck_expr(&stmt->data.expr, table);
-            free_type(type);
-            return type.type == ERROR_TYPE;
+        case BLOCK:      return open_scope(stmt, table);
+        case EXPR_STMT: return false;
 
         case DECL:
         case TYPEDEF:
@@ -182,117 +255,63 @@ bool typecheck_stmt(Stmt* stmt, SymbolTable* table) {
     return true;
 }
 
-bool typecheck(AST* ast) {
-    if (ast == NULL) return true;
-    return typecheck_stmt(ast, NULL);
-}
-
-void free_type(Type type) {
-    switch (type.type) {
-        case ERROR_TYPE:
-        case UNDEFINED_TYPE:
-        case VOID_TYPE:
-        case BOOL_TYPE:
-        case I8_TYPE:
-        case I16_TYPE:
-        case I32_TYPE:
-        case I64_TYPE:
-        case U8_TYPE:
-        case U16_TYPE:
-        case U32_TYPE:
-        case U64_TYPE:       break;
-
-        case ARR_TYPE:
-        case PTR_TYPE:
-            free_type(*type.data.ptr.type);
-            free(type.data.ptr.type);
-            break;
-        case FUN_TYPE:
-            free_type(*type.data.fun.ret);
-            free(type.data.fun.ret);
-            free_type_arrn(type.data.fun.paramt, type.data.fun.paramc);
-            break;
-        case STRUCT_TYPE:
-            free(type.data.structtype.paramv);
-            free_type_arrn(type.data.structtype.paramt, type.data.structtype.paramc);
-            break;
-        case ENUM_TYPE:      free(type.data.enumtype.items); break;
-        case ENUM_ITEM_TYPE: break;
-        case TYPEDEF_TYPE:
-            free_type(*type.data.typedeftype.type);
-            free(type.data.typedeftype.type);
-            break;
-    }
-}
-
-void free_type_arrn(Type* arr, size_t n) {
-    for (size_t i = 0; i < n; i++) free_type(arr[i]);
-    free(arr);
-}
-
-void free_symbol_table(SymbolTable table) {
-    free(table.symbols);
-    free_type_arrn(table.types, table.len);
-}
+// Typecheck stmt after its children, closing the scope of a block in table.
+// Returns whether an error occurred.
+bool typecheck_stmt_post(stmt_t id, SymbolTable* table) {
+    const Stmt* stmt = &typed_ast->stmts[id];
+    switch (stmt->type) {
+        case BLOCK: close_scope(table); return false;
+        case EXPR_STMT:
+            const Type* type = typed_ast->annotations[stmt->data.expr];
+            return type == NULL || type->type == ERROR_TYPE;
 
-void free_expr_annots(Expr expr) {
-    if (expr.annotation) {
-        free_type(*expr.annotation);
-        free(expr.annotation);
-    }
-    switch (expr.type) {
-        case ERROR_EXPR:   break;
-        case NO_EXPR:      break;
-        case GROUPED_EXPR: free_expr_annots(*expr.data.group); break;
-        case ATOMIC_EXPR:  break;
-        case ARR_EXPR:
-        case LAMBDA_EXPR:
-        case UNOP_EXPR:
-        case BINOP_EXPR:
-        case TERNOP_EXPR:
-        case SUBSRIPT_EXPR:
-        case CALL_EXPR:
-        case CONSTRUCTOR_EXPR:
-        case ACCESS_EXPR:
+        default: return false;
     }
 }
 
-void free_expr_arrn_annots(Expr* arr, size_t n) {
-    for (size_t i = 0; i < n; i++) free_expr_annots(arr[i]);
-}
+// Annotate the expressions of ast with their types, allocated in the arena of ast.
+// Returns whether an error occurred.
+bool typecheck(AST* ast) {
+    if (ast == NULL) return true;
 
-void free_stmt_annots(Stmt stmt) {
-    switch (stmt.type) {
-        case ERROR_STMT: break;
-        case NOP:        break;
-        case BLOCK:      free_stmt_arrn_annots(stmt.data.block.stmts, stmt.data.block.len); break;
-        case EXPR_STMT:  free_expr_annots(stmt.data.expr); break;
-        case DECL:
-        case TYPEDEF:
-        case IFELSE_STMT:
-        case SWITCH_STMT:
-        case WHILE_STMT:
-        case DOWHILE_STMT:
-        case FOR_STMT:
-        case FUNCTION_STMT:
-        case STRUCT_STMT:
-        case ENUM_STMT:
-        case RETURN_STMT:
-        case BREAK_STMT:
-        case CONTINUE_STMT:
+    // annotations are indexed like the expressions
+    size_t size = sizeof(Type*) * ast->exprc;
+    ast->annotations = arena_alloc(&annotation_arena, size, _Alignof(Type*));
+    if (ast->annotations == NULL) return true;
+    memset(ast->annotations, 0, size);
+
+    typed_ast = ast;
+    SymbolTable table = symbol_table_create();
+    bool failed = false;
+
+    // expressions are typed after their children, and only grouped ones have typed children yet
+    Visitor visitor = visitor_create(ast, STMT_NODE, ast->block);
+    for (Visit visit; !failed && visit_next(&visitor, &visit);) {
+        switch (visit.kind) {
+            case STMT_NODE:
+                if (visit.post) failed = typecheck_stmt_post(visit.id, &table);
+                else failed = typecheck_stmt(visit.id, &table);
+                break;
+            case EXPR_NODE:
+                if (visit.post) typecheck_expr(visit.id, &table);
+                else if (ast->exprs[visit.id].type != GROUPED_EXPR) visit_skip(&visitor);
+                break;
+            default: break;
+        }
     }
+    failed = failed || visitor.failed;
+    visitor_destroy(&visitor);
+
+    free_symbol_table(&table);
+    arena_merge(&ast->arena, &type_arena);
+    arena_merge(&ast->arena, &annotation_arena);
+    typed_ast = NULL;
+    return failed;
 }
 
-void free_stmt_arrn_annots(Stmt* arr, size_t n) {
-    for (size_t i = 0; i < n; i++) free_stmt_annots(arr[i]);
-}
-
-void free_typed_ast_p(AST* ast) {
-    free_stmt_annots(*ast);
-    free_ast_p(ast);
-}
-
-Type clone_type(Type type) {
+// Deep copy type to arena.
+// Returns an ERROR_TYPE if an error occurred.
+Type clone_type(Type type, Arena* arena) {
     Type clone = type;
     switch (type.type) {
         case ERROR_TYPE:
@@ -310,97 +329,60 @@ Type clone_type(Type type) {
 
         case ARR_TYPE:
         case PTR_TYPE:
-            Type inner = clone_type(*type.data.ptr.type);
+            Type inner = clone_type(*type.data.ptr.type, arena);
             if (inner.type == ERROR_TYPE) return inner;
-            clone.data.ptr.type = malloc(sizeof(Type));
-            if (clone.data.ptr.type == NULL) {
-                malloc_error();
-                free_type(inner);
-                return (Type) { ERROR_TYPE, false, false, {} };
-            }
-            memcpy(clone.data.ptr.type, &inner, sizeof(Type));
+            clone.data.ptr.type = arena_dup(arena, &inner, sizeof(Type), _Alignof(Type));
+            if (clone.data.ptr.type == NULL) break;
             return clone;
 
         case FUN_TYPE:
-            Type ret = clone_type(*type.data.fun.ret);
+            Type ret = clone_type(*type.data.fun.ret, arena);
             if (ret.type == ERROR_TYPE) return ret;
-            clone.data.fun.ret = malloc(sizeof(Type));
-            clone.data.fun.paramt = malloc(sizeof(Type) * type.data.fun.paramc);
-            if (clone.data.fun.ret == NULL ||
-                (type.data.fun.paramc && clone.data.fun.paramt == NULL))
-            {
-                malloc_error();
-                free_type(ret);
-                free(clone.data.fun.ret);
-                free(clone.data.fun.paramt);
-                return (Type) { ERROR_TYPE, false, false, {} };
-            }
-            memcpy(clone.data.ptr.type, &inner, sizeof(Type));
+            clone.data.fun.ret = arena_dup(arena, &ret, sizeof(Type), _Alignof(Type));
+            clone.data.fun.paramt =
+                arena_alloc(arena, sizeof(Type) * type.data.fun.paramc, _Alignof(Type));
+            if (clone.data.fun.ret == NULL || clone.data.fun.paramt == NULL) break;
             for (size_t i = 0; i < type.data.fun.paramc; i++) {
-                Type param = clone_type(type.data.fun.paramt[i]);
-                if (param.type == ERROR_TYPE) {
-                    free_type(*clone.data.fun.ret);
-                    free(clone.data.fun.ret);
-                    free_type_arrn(clone.data.fun.paramt, i);
-                    return param;
-                }
-                memcpy(&clone.data.fun.paramt[i], &param, sizeof(Type));
+                clone.data.fun.paramt[i] = clone_type(type.data.fun.paramt[i], arena);
+                if (clone.data.fun.paramt[i].type == ERROR_TYPE) return clone.data.fun.paramt[i];
             }
             return clone;
 
         case STRUCT_TYPE:
-            clone.data.structtype.paramv = malloc(sizeof(char*) * type.data.structtype.paramc);
-            clone.data.structtype.paramt = malloc(sizeof(Type) * type.data.structtype.paramc);
-            if (type.data.structtype.paramc &&
-                (clone.data.structtype.paramt == NULL || clone.data.structtype.paramt == NULL))
-            {
-                malloc_error();
-                free(clone.data.structtype.paramv);
-                free(clone.data.structtype.paramt);
-                return (Type) { ERROR_TYPE, false, false, {} };
-            }
-            memcpy(
-                clone.data.structtype.paramv, type.data.structtype.paramv,
-                sizeof(Type) * type.data.structtype.paramc
+            clone.data.structtype.paramv = arena_dup(
+                arena, type.data.structtype.paramv, sizeof(char*) * type.data.structtype.paramc,
+                _Alignof(char*)
             );
+            clone.data.structtype.paramt =
+                arena_alloc(arena, sizeof(Type) * type.data.structtype.paramc, _Alignof(Type));
+            if (clone.data.structtype.paramv == NULL || clone.data.structtype.paramt == NULL) {
+                break;
+            }
             for (size_t i = 0; i < type.data.structtype.paramc; i++) {
-                Type param = clone_type(type.data.structtype.paramt[i]);
-                if (param.type == ERROR_TYPE) {
-                    free(clone.data.structtype.paramv);
-                    free_type_arrn(clone.data.structtype.paramt, i);
-                    return param;
-                }
-                memcpy(&clone.data.structtype.paramt[i], &param, sizeof(Type));
+                Type* param = &clone.data.structtype.paramt[i];
+                *param = clone_type(type.data.structtype.paramt[i], arena);
+                if (param->type == ERROR_TYPE) return *param;
             }
             return clone;
 
         case ENUM_TYPE:
-            clone.data.enumtype.items = malloc(sizeof(char*) * type.data.enumtype.len);
-            if (type.data.enumtype.len && clone.data.enumtype.items == NULL) {
-                malloc_error();
-                return (Type) { ERROR_TYPE, false, false, {} };
-            }
-            memcpy(
-                clone.data.enumtype.items, type.data.enumtype.items,
-                sizeof(char*) * type.data.enumtype.len
+            clone.data.enumtype.items = arena_dup(
+                arena, type.data.enumtype.items, sizeof(char*) * type.data.enumtype.len,
+                _Alignof(char*)
             );
+            if (clone.data.enumtype.items == NULL) break;
             return clone;
 
         case ENUM_ITEM_TYPE: return clone;
 
         case TYPEDEF_TYPE:
-            Type value = clone_type(*type.data.typedeftype.type);
+            Type value = clone_type(*type.data.typedeftype.type, arena);
             if (value.type == ERROR_TYPE) return value;
-            clone.data.typedeftype.type = malloc(sizeof(Type));
-            if (clone.data.typedeftype.type == NULL) {
-                malloc_error();
-                free_type(value);
-                return (Type) { ERROR_TYPE, false, false, {} };
-            }
-            memcpy(clone.data.typedeftype.type, &value, sizeof(Type));
+            clone.data.typedeftype.type = arena_dup(arena, &value, sizeof(Type), _Alignof(Type));
+            if (clone.data.typedeftype.type == NULL) break;
             return clone;
     }
 
-    // unreachable
+    // allocation failed
     return (Type) { ERROR_TYPE, false, false, {} };
 }
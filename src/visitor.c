@@ -0,0 +1,251 @@
+#include "visitor.h"
+
+typedef struct VisitFrame VisitFrame;
+
+// Node on the stack of a Visitor.
+struct VisitFrame {
+    NodeKind kind;
+    uint32_t id;
+    uint32_t next;   // index of the next child to visit
+    uint32_t index;  // position among the children of the parent
+    bool entered;    // visited before its children
+    bool skipped;    // its children are not visited
+};
+
+// Push a node that was not visited yet to the stack of visitor.
+// Returns whether an error occurred.
+bool push_frame(Visitor* visitor, NodeKind kind, uint32_t id, uint32_t index) {
+    VisitFrame frame = { .kind = kind, .id = id, .index = index };
+    if (dynarr_append(&visitor->stack, &frame)) {
+        visitor->failed = true;
+        return true;
+    }
+    return false;
+}
+
+// Start a traversal of ast from root, which is a node of kind.
+// Errors are stored in failed.
+Visitor visitor_create(const AST* ast, NodeKind kind, uint32_t root) {
+    Visitor visitor = {
+        .ast = ast, .stack = dynarr_create(sizeof(VisitFrame), ARRAY_MEM), .failed = false
+    };
+    push_frame(&visitor, kind, root, 0);
+    return visitor;
+}
+
+// Free the stack of visitor.
+void visitor_destroy(Visitor* visitor) {
+    dynarr_destroy(&visitor->stack);
+}
+
+// Find the child i of spec.
+// Returns whether there is one.
+bool spec_child(const AST* ast, const TypeSpec* spec, size_t i, NodeKind* kind, uint32_t* dst) {
+    *kind = SPEC_NODE;
+    switch (spec->type) {
+        case ERROR_SPEC:
+        case INFERRED_SPEC:
+        case ATOMIC_SPEC:   return false;
+        case GROUPED_SPEC:  *dst = spec->data.group; return i < 1;
+        case ARR_SPEC:
+        case PTR_SPEC:      *dst = spec->data.ptr.spec; return i < 1;
+        case FUN_SPEC:
+            // (a, b) => c
+            if (i < spec->data.fun.paramc) *dst = ast->lists[spec->data.fun.paramt + i];
+            else *dst = spec->data.fun.ret;
+            return i <= spec->data.fun.paramc;
+    }
+    return false;
+}
+
+// Find the child i of expr.
+// Returns whether there is one.
+bool expr_child(const AST* ast, const Expr* expr, size_t i, NodeKind* kind, uint32_t* dst) {
+    *kind = EXPR_NODE;
+    switch (expr->type) {
+        case ERROR_EXPR:
+        case NO_EXPR:
+        case ATOMIC_EXPR:  return false;
+        case GROUPED_EXPR: *dst = expr->data.group; return i < 1;
+        case ARR_EXPR:
+            if (i >= expr->data.arr.len) return false;
+            *dst = ast->lists[expr->data.arr.items + i];
+            return true;
+        case LAMBDA_EXPR:
+            // (a, b) => c
+            if (i < expr->data.lambda.paramc) {
+                *kind = PARAM_NODE;
+                *dst = expr->data.lambda.params + i;
+            } else {
+                *dst = expr->data.lambda.expr;
+            }
+            return i <= expr->data.lambda.paramc;
+        case UNOP_EXPR:    *dst = expr->data.op.first; return i < 1;
+        case BINOP_EXPR:
+            *dst = i == 0 ? expr->data.op.first : expr->data.op.second;
+            return i < 2;
+        case TERNOP_EXPR:
+            if (i == 0) *dst = expr->data.op.first;
+            else if (i == 1) *dst = expr->data.op.second;
+            else *dst = expr->data.op.third;
+            return i < 3;
+        case SUBSRIPT_EXPR:
+            *dst = i == 0 ? expr->data.subscript.arr : expr->data.subscript.idx;
+            return i < 2;
+        case CALL_EXPR:
+        case CONSTRUCTOR_EXPR:
+            // f(a, b)
+            if (i > expr->data.call.argc) return false;
+            *dst = i == 0 ? expr->data.call.fun : ast->lists[expr->data.call.argv + i - 1];
+            return true;
+        case ACCESS_EXPR: *dst = expr->data.access.obj; return i < 1;
+    }
+    return false;
+}
+
+// Find the child i of stmt.
+// Returns whether there is one.
+bool stmt_child(const AST* ast, const Stmt* stmt, size_t i, NodeKind* kind, uint32_t* dst) {
+    *kind = STMT_NODE;
+    switch (stmt->type) {
+        case ERROR_STMT:
+        case NOP:
+        case ENUM_STMT:
+        case BREAK_STMT:
+        case CONTINUE_STMT: return false;
+        case BLOCK:
+            if (i >= stmt->data.block.len) return false;
+            *dst = ast->lists[stmt->data.block.stmts + i];
+            return true;
+        case EXPR_STMT:
+        case RETURN_STMT:
+            *kind = EXPR_NODE;
+            *dst = stmt->data.expr;
+            return i < 1;
+        case DECL:
+            *kind = i == 0 ? EXPR_NODE : SPEC_NODE;
+            *dst = i == 0 ? stmt->data.decl.val : stmt->data.decl.spec;
+            return i < 2;
+        case TYPEDEF:
+            *kind = SPEC_NODE;
+            *dst = stmt->data.type.val;
+            return i < 1;
+        case IFELSE_STMT:
+            if (i == 0) {
+                *kind = EXPR_NODE;
+                *dst = stmt->data.ifelse.condition;
+            } else {
+                *dst = i == 1 ? stmt->data.ifelse.on_true : stmt->data.ifelse.on_false;
+            }
+            return i < 2 || (i == 2 && stmt->data.ifelse.on_false != NO_NODE);
+        case SWITCH_STMT:
+            // switch (x) { case a: f case b: g }
+            if (i > 2 * (size_t)stmt->data.switchcase.casec) return false;
+            if (i == 0) {
+                *kind = EXPR_NODE;
+                *dst = stmt->data.switchcase.expr;
+            } else if (i % 2) {
+                *kind = EXPR_NODE;
+                *dst = ast->lists[stmt->data.switchcase.casev + i / 2];
+            } else {
+                *dst = ast->lists[stmt->data.switchcase.branchv + i / 2 - 1];
+            }
+            return true;
+        case WHILE_STMT:
+        case DOWHILE_STMT:
+            if (i == 0) *kind = EXPR_NODE;
+            *dst = i == 0 ? stmt->data.whileloop.condition : stmt->data.whileloop.body;
+            return i < 2;
+        case FOR_STMT:
+            // for (a b; c) d
+            if (i == 1 || i == 2) *kind = EXPR_NODE;
+            if (i == 0) *dst = stmt->data.forloop.init;
+            else if (i == 1) *dst = stmt->data.forloop.condition;
+            else if (i == 2) *dst = stmt->data.forloop.expr;
+            else *dst = stmt->data.forloop.body;
+            return i < 4;
+        case FUNCTION_STMT:
+            // fn f(a, b): c { d }
+            if (i < stmt->data.fun.paramc) {
+                *kind = PARAM_NODE;
+                *dst = stmt->data.fun.params + i;
+            } else if (i == stmt->data.fun.paramc) {
+                *kind = SPEC_NODE;
+                *dst = stmt->data.fun.ret;
+            } else {
+                *dst = stmt->data.fun.body;
+            }
+            return i <= stmt->data.fun.paramc + 1;
+        case STRUCT_STMT:
+            if (i >= stmt->data.structdef.paramc) return false;
+            *kind = PARAM_NODE;
+            *dst = stmt->data.structdef.params + i;
+            return true;
+    }
+    return false;
+}
+
+// Find the child i of param.
+// Returns whether there is one.
+bool param_child(const Param* param, size_t i, NodeKind* kind, uint32_t* dst) {
+    *kind = i == 0 ? SPEC_NODE : EXPR_NODE;
+    *dst = i == 0 ? param->type : param->def;
+    return i < 2;
+}
+
+// Find the child i of a node of kind.
+// Returns whether there is one.
+bool node_child(
+    const AST* ast, NodeKind kind, uint32_t id, size_t i, NodeKind* dst_kind, uint32_t* dst
+) {
+    switch (kind) {
+        case SPEC_NODE:  return spec_child(ast, &ast->specs[id], i, dst_kind, dst);
+        case EXPR_NODE:  return expr_child(ast, &ast->exprs[id], i, dst_kind, dst);
+        case STMT_NODE:  return stmt_child(ast, &ast->stmts[id], i, dst_kind, dst);
+        case PARAM_NODE: return param_child(&ast->params[id], i, dst_kind, dst);
+    }
+    return false;
+}
+
+// Visit the next node, before its children if it has any left and after them otherwise.
+// The visit is stored in dst.
+// Returns false when every node was visited after its children or an error occurred.
+bool visit_next(Visitor* visitor, Visit* dst) {
+    for (;;) {
+        if (visitor->failed || visitor->stack.length == 0) return false;
+
+        size_t top = visitor->stack.length - 1;
+        VisitFrame* frame = (VisitFrame*)visitor->stack.c_arr + top;
+
+        NodeKind kind;
+        uint32_t child;
+        bool post = frame->entered;
+        if (post && !frame->skipped &&
+            node_child(visitor->ast, frame->kind, frame->id, frame->next, &kind, &child))
+        {
+            frame->next++;
+            if (push_frame(visitor, kind, child, frame->next - 1)) return false;
+            continue;
+        }
+
+        *dst = (Visit) {
+            .kind = frame->kind,
+            .id = frame->id,
+            .post = post,
+            .depth = top,
+            .index = frame->index,
+            .parent_kind = top ? frame[-1].kind : frame->kind,
+            .parent = top ? frame[-1].id : NO_NODE,
+        };
+        frame->entered = true;
+        if (post) visitor->stack.length--;
+        return true;
+    }
+}
+
+// Skip the children of the node that was just visited before them, which is visited after them
+// next.
+void visit_skip(Visitor* visitor) {
+    if (visitor->stack.length == 0) return;
+    ((VisitFrame*)visitor->stack.c_arr)[visitor->stack.length - 1].skipped = true;
+}
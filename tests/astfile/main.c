@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "astfile.h"
+#include "parser.h"
+#include "printerr.h"
+#include "readfile.h"
+#include "tokenizer.h"
+
+// Check whether tokens x of a and y of b are the same, with the same strings and payloads.
+bool same_token(const Token* x, const Token* y) {
+    if (x->type != y->type || x->pos != y->pos || x->str.len != y->str.len) return false;
+    if (memcmp(x->str.ptr, y->str.ptr, x->str.len) != 0) return false;
+    switch (x->type) {
+        case INT_LITERAL:
+            return x->data.int_literal.value == y->data.int_literal.value &&
+                   x->data.int_literal.width == y->data.int_literal.width;
+        case CHR_LITERAL: return x->data.chr_literal == y->data.chr_literal;
+        case STR_LITERAL:
+            return x->data.str_literal.len == y->data.str_literal.len &&
+                   memcmp(
+                       x->data.str_literal.ptr, y->data.str_literal.ptr,
+                       x->data.str_literal.len + 1
+                   ) == 0;
+        case VAR_NAME: return x->data.var_name == y->data.var_name;
+        default:       return true;
+    }
+}
+
+// Check whether pools a and b of size bytes are the same, empty ones may have no pointer.
+bool same_pool(const void* a, const void* b, size_t size) {
+    return size == 0 || memcmp(a, b, size) == 0;
+}
+
+// Check whether ASTs a and b have the same nodes in the same pools.
+bool same_asts(const AST* a, const AST* b) {
+    if (a->block != b->block || a->specc != b->specc || a->exprc != b->exprc ||
+        a->stmtc != b->stmtc || a->tokenc != b->tokenc || a->paramc != b->paramc ||
+        a->listc != b->listc)
+    {
+        return false;
+    }
+    // the pools are stored byte for byte
+    if (!same_pool(a->specs, b->specs, sizeof(TypeSpec) * a->specc) ||
+        !same_pool(a->exprs, b->exprs, sizeof(Expr) * a->exprc) ||
+        !same_pool(a->stmts, b->stmts, sizeof(Stmt) * a->stmtc) ||
+        !same_pool(a->params, b->params, sizeof(Param) * a->paramc) ||
+        !same_pool(a->lists, b->lists, sizeof(uint32_t) * a->listc))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a->tokenc; i++) {
+        if (!same_token(&a->tokens[i], &b->tokens[i])) return false;
+    }
+    return true;
+}
+
+// Write the len bytes of text to the file filename.
+// Returns whether an error occurred.
+bool write_file(const char* filename, const char* text, size_t len) {
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) return true;
+    bool failed = fwrite(text, 1, len, fp) != len;
+    return fclose(fp) || failed;
+}
+
+// Check whether the AST file of length len at text is rejected after changing its byte at index
+// to chr, or truncating it there if chr is negative.
+const char* check_corrupt(const char* path, const char* text, size_t len, size_t index, int chr) {
+    char* copy = malloc(len);
+    if (copy == NULL) return "failed";
+    memcpy(copy, text, len);
+    if (chr < 0) len = index;
+    else copy[index] = chr;
+
+    bool failed = write_file(path, copy, len);
+    free(copy);
+    if (failed) return "failed";
+
+    errors_muted = true;
+    AST* ast = load_ast(path);
+    errors_muted = false;
+    free_ast_p(ast);
+    return ast ? "accepted" : "rejected";
+}
+
+// Find the path of a temporary file named after the file filename with suffix.
+// Returns NULL if an error occurred.
+char* temp_path(const char* filename, const char* suffix) {
+    const char* dir = getenv("TMPDIR");
+    if (dir == NULL) dir = getenv("TEMP");
+    if (dir == NULL) dir = "/tmp";
+
+    const char* name = strrchr(filename, '/');
+    name = name ? name + 1 : filename;
+    size_t len = strlen(dir) + strlen(name) + strlen(suffix) + 2;
+    char* path = malloc(len);
+    if (path) snprintf(path, len, "%s/%s%s", dir, name, suffix);
+    return path;
+}
+
+// Fill freed memory with garbage, so that bytes left over by earlier allocations show up in the
+// nodes that leave them undefined.
+void dirty_heap(void) {
+    for (size_t size = 16; size <= (1 << 20); size *= 2) {
+        void* block = malloc(size);
+        if (block == NULL) return;
+        memset(block, 0xa5, size);
+        free(block);
+    }
+}
+
+// Check whether parsing the file filename of length len at text again, after dirtying the heap,
+// gives an AST file with the same bytes as the one at path.
+const char* check_deterministic(const char* path, const char* text, size_t len) {
+    char* again_path = temp_path(path, ".again");
+    if (again_path == NULL) return "failed";
+
+    dirty_heap();
+    TokenStream* tokens = tokenize(text, len);
+    AST* ast = parse(tokens);
+    free_token_stream(tokens);
+    bool failed = emit_ast(ast, again_path);
+    free_ast_p(ast);
+
+    FileText first = map_file(path, false);
+    FileText again = map_file(again_path, false);
+    const char* result = "failed";
+    if (!failed && first.text && again.text) {
+        bool same = first.len == again.len && memcmp(first.text, again.text, first.len) == 0;
+        result = same ? "same" : "different";
+    }
+    unmap_file(&first);
+    unmap_file(&again);
+    remove(again_path);
+    free(again_path);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "error: wrong number of command-line arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* filename = argv[1];
+    error_filename = filename;
+
+    FileText file = map_file(filename, false);
+    if (file.text == NULL) return EXIT_FAILURE;
+    set_source_text(file.text, file.len, 4);
+    TokenStream* tokens = tokenize(file.text, file.len);
+    AST* ast = parse(tokens);
+
+    char* path = temp_path(filename, ".ast");
+    if (ast == NULL || path == NULL) goto err_free_ast;
+
+    if (emit_ast(ast, path)) goto err_free_path;
+    printf("emitted again: %s\n", check_deterministic(path, file.text, file.len));
+    AST* loaded = load_ast(path);
+    if (loaded == NULL) goto err_free_path;
+    printf(
+        "specs %zu exprs %zu stmts %zu tokens %zu params %zu lists %zu\n", loaded->specc,
+        loaded->exprc, loaded->stmtc, loaded->tokenc, loaded->paramc, loaded->listc
+    );
+    printf("loaded: %s\n", same_asts(ast, loaded) ? "same" : "different");
+    free_ast_p(loaded);
+
+    FileText saved = map_file(path, false);
+    if (saved.text == NULL) goto err_free_path;
+    printf("magic: %s\n", check_corrupt(path, saved.text, saved.len, 0, 'X'));
+    // the version follows the 8-byte magic
+    printf("version: %s\n", check_corrupt(path, saved.text, saved.len, 8, AST_FILE_VERSION + 1));
+    printf("truncated: %s\n", check_corrupt(path, saved.text, saved.len, saved.len - 1, -1));
+    unmap_file(&saved);
+    remove(path);
+
+    free(path);
+    free_ast_p(ast);
+    free_token_stream(tokens);
+    unmap_file(&file);
+    free_interner();
+    free_source();
+    return EXIT_SUCCESS;
+
+err_free_path:
+    remove(path);
+    free(path);
+err_free_ast:
+    free_ast_p(ast);
+    free_token_stream(tokens);
+    unmap_file(&file);
+    free_interner();
+    free_source();
+    return EXIT_FAILURE;
+}
@@ -3,228 +3,220 @@
 
 #include "parser.h"
 #include "printerr.h"
-#include "readfile.h"
 #include "tokenizer.h"
+#include "visitor.h"
 
 void print_indent(size_t depth) {
     for (size_t i = 0; i < depth; i++) printf("    ");
 }
 
-void print_spec(TypeSpec spec, size_t depth) {
+void print_token(const char* label, Token token) {
+    printf(
+        "%s:%zu:%zu %" PRIstrview "\n", label, source_line(token.pos), source_col(token.pos),
+        STRVIEW_ARG(token.str)
+    );
+}
+
+// Get the symbol of operator op.
+const char* op_str(OpEnum op) {
+    switch (op) {
+        case ERROR_OP: return "";
+
+        case POSTFIX_INC:
+        case PREFIX_INC:  return "++";
+        case POSTFIX_DEC:
+        case PREFIX_DEC:  return "--";
+        case UNARY_PLUS:  return "+";
+        case UNARY_MINUS: return "-";
+        case LOGICAL_NOT: return "!";
+        case BINARY_NOT:  return "~";
+        case DEREFERENCE: return "*";
+        case ADDRESS_OF:  return "&";
+
+        case MULTIPLICATION: return "*";
+        case DIVISION:       return "/";
+        case MODULO:         return "%";
+        case ADDITION:       return "+";
+        case SUBTRACTION:    return "-";
+        case LEFT_SHIFT:     return "<<";
+        case RIGHT_SHIFT:    return ">>";
+
+        case BITWISE_AND: return "&";
+        case BITWISE_XOR: return "^";
+        case BITWISE_OR:  return "|";
+
+        case LESS_THAN:        return "<";
+        case LESS_OR_EQUAL:    return "<=";
+        case GREATER_THAN:     return ">";
+        case GREATER_OR_EQUAL: return ">=";
+        case EQUAL:            return "==";
+        case NOT_EQUAL:        return "!=";
+
+        case LOGICAL_AND: return "&&";
+        case LOGICAL_OR:  return "||";
+
+        case TERNARY: return "?";
+
+        case ASSIGNMENT: return "=";
+    }
+
+    // unreachable
+    return "";
+}
+
+void print_spec(const AST* ast, spec_t id, size_t depth) {
+    const TypeSpec* spec = &ast->specs[id];
     print_indent(depth);
-    printf("type (%d):%zu:%zu", spec.type, spec.line, spec.col);
+    printf("type (%d):%zu:%zu", spec->type, source_line(spec->pos), source_col(spec->pos));
 
-    switch (spec.type) {
+    switch (spec->type) {
         case ERROR_SPEC:    printf(" (error)\n"); break;
         case INFERRED_SPEC: printf(" (inferred)\n"); break;
-        case GROUPED_SPEC:
-            printf(" ()\n");
-            print_spec(*spec.data.group, depth + 1);
-            break;
-        case ATOMIC_SPEC: printf(" %s\n", spec.data.atom.str); break;
-        case ARR_SPEC:
-            printf(" %s[]\n", spec.data.ptr.mutable ? "" : "const");
-            print_spec(*spec.data.ptr.spec, depth + 1);
-            break;
-        case PTR_SPEC:
-            printf(" %s*\n", spec.data.ptr.mutable ? "" : "const");
-            print_spec(*spec.data.ptr.spec, depth + 1);
-            break;
-        case FUN_SPEC:
-            printf(" (%zu?)=>\n", spec.data.fun.optc);
-            for (size_t i = 0; i < spec.data.fun.paramc; i++) {
-                print_spec(spec.data.fun.paramt[i], depth + 1);
-            }
-            print_spec(*spec.data.fun.ret, depth + 1);
+        case GROUPED_SPEC:  printf(" ()\n"); break;
+        case ATOMIC_SPEC:
+            printf(" %" PRIstrview "\n", STRVIEW_ARG(ast->tokens[spec->data.atom].str));
             break;
+        case ARR_SPEC: printf(" %s[]\n", spec->data.ptr.mutable ? "" : "const"); break;
+        case PTR_SPEC: printf(" %s*\n", spec->data.ptr.mutable ? "" : "const"); break;
+        case FUN_SPEC: printf(" (%" PRIu32 "?)=>\n", spec->data.fun.optc); break;
     }
 }
 
-void print_expr(Expr expr, size_t depth) {
+void print_expr(const AST* ast, expr_t id, size_t depth) {
+    const Expr* expr = &ast->exprs[id];
     print_indent(depth);
-    printf("expr (%d):%zu:%zu", expr.type, expr.line, expr.col);
-
-    switch (expr.type) {
-        case ERROR_EXPR: printf(" (error)\n"); break;
-        case NO_EXPR:    printf(" (empty)\n"); break;
-        case GROUPED_EXPR:
-            printf(" ()\n");
-            print_expr(*expr.data.group, depth + 1);
-            break;
-        case ATOMIC_EXPR: printf(" %s\n", expr.data.atom.str); break;
-        case ARR_EXPR:
-            printf(" []\n");
-            for (size_t i = 0; i < expr.data.arr.len; i++) {
-                print_expr(expr.data.arr.items[i], depth + 1);
-            }
-            break;
-        case LAMBDA_EXPR:
-            printf(" ()=>\n");
-            for (size_t i = 0; i < expr.data.lambda.paramc; i++) {
-                print_indent(depth + 1);
-                printf(
-                    "param   :%zu:%zu %s\n", expr.data.lambda.paramv[i].line,
-                    expr.data.lambda.paramv[i].col, expr.data.lambda.paramv[i].str
-                );
-                print_spec(expr.data.lambda.paramt[i], depth + 1);
-                print_expr(expr.data.lambda.paramd[i], depth + 1);
-            }
-            print_expr(*expr.data.lambda.expr, depth + 1);
+    printf("expr (%d):%zu:%zu", expr->type, source_line(expr->pos), source_col(expr->pos));
+
+    switch (expr->type) {
+        case ERROR_EXPR:   printf(" (error)\n"); break;
+        case NO_EXPR:      printf(" (empty)\n"); break;
+        case GROUPED_EXPR: printf(" ()\n"); break;
+        case ATOMIC_EXPR:
+            printf(" %" PRIstrview "\n", STRVIEW_ARG(ast->tokens[expr->data.atom].str));
             break;
+        case ARR_EXPR:    printf(" []\n"); break;
+        case LAMBDA_EXPR: printf(" ()=>\n"); break;
         case UNOP_EXPR:
-            printf(" (%d)%s\n", expr.data.op.type, expr.data.op.token.str);
-            print_expr(*expr.data.op.first, depth + 1);
-            break;
         case BINOP_EXPR:
-            printf(" (%d)%s\n", expr.data.op.type, expr.data.op.token.str);
-            print_expr(*expr.data.op.first, depth + 1);
-            print_expr(*expr.data.op.second, depth + 1);
-            break;
         case TERNOP_EXPR:
-            printf(" (%d)%s\n", expr.data.op.type, expr.data.op.token.str);
-            print_expr(*expr.data.op.first, depth + 1);
-            print_expr(*expr.data.op.second, depth + 1);
-            print_expr(*expr.data.op.third, depth + 1);
-            break;
-        case SUBSRIPT_EXPR:
-            printf(" []\n");
-            print_expr(*expr.data.subscript.arr, depth + 1);
-            print_expr(*expr.data.subscript.idx, depth + 1);
-            break;
-        case CALL_EXPR:
-            printf(" ()\n");
-            print_expr(*expr.data.call.fun, depth + 1);
-            for (size_t i = 0; i < expr.data.call.argc; i++) {
-                print_expr(expr.data.call.argv[i], depth + 1);
-            }
-            break;
-        case CONSTRUCTOR_EXPR:
-            printf(" {}\n");
-            print_expr(*expr.data.call.fun, depth + 1);
-            for (size_t i = 0; i < expr.data.call.argc; i++) {
-                print_expr(expr.data.call.argv[i], depth + 1);
-            }
+            printf(" (%d)%s\n", expr->data.op.type, op_str(expr->data.op.type));
             break;
+        case SUBSRIPT_EXPR:    printf(" []\n"); break;
+        case CALL_EXPR:        printf(" ()\n"); break;
+        case CONSTRUCTOR_EXPR: printf(" {}\n"); break;
         case ACCESS_EXPR:
-            printf(" .%s\n", expr.data.access.memeber.str);
-            print_expr(*expr.data.access.obj, depth + 1);
+            printf(
+                " .%" PRIstrview "\n", STRVIEW_ARG(ast->tokens[expr->data.access.memeber].str)
+            );
             break;
     }
 }
 
-void print_stmt(Stmt stmt, size_t depth) {
+void print_stmt(const AST* ast, stmt_t id, size_t depth) {
+    const Stmt* stmt = &ast->stmts[id];
     print_indent(depth);
-    printf("stmt (%d):%zu:%zu", stmt.type, stmt.line, stmt.col);
+    printf("stmt (%d):%zu:%zu", stmt->type, source_line(stmt->pos), source_col(stmt->pos));
 
-    switch (stmt.type) {
+    switch (stmt->type) {
         case ERROR_STMT: printf(" (error)\n"); break;
         case NOP:        printf(" (nop)\n"); break;
-        case BLOCK:
-            printf(" {}\n");
-            for (size_t i = 0; i < stmt.data.block.len; i++) {
-                print_stmt(stmt.data.block.stmts[i], depth + 1);
-            }
-            break;
-        case EXPR_STMT:
-            printf(" ;\n");
-            print_expr(stmt.data.expr, depth + 1);
-            break;
+        case BLOCK:      printf(" {}\n"); break;
+        case EXPR_STMT:  printf(" ;\n"); break;
         case DECL:
-            printf(" %s %s\n", stmt.data.decl.mutable ? "var" : "const", stmt.data.decl.name.str);
-            print_expr(stmt.data.decl.val, depth + 1);
-            print_spec(stmt.data.decl.spec, depth + 1);
+            printf(
+                " %s %" PRIstrview "\n", stmt->data.decl.mutable ? "var" : "const",
+                STRVIEW_ARG(ast->tokens[stmt->data.decl.name].str)
+            );
             break;
         case TYPEDEF:
-            printf(" type %s\n", stmt.data.type.name.str);
-            print_spec(stmt.data.type.val, depth + 1);
+            printf(" type %" PRIstrview "\n", STRVIEW_ARG(ast->tokens[stmt->data.type.name].str));
             break;
         case IFELSE_STMT:
-            printf(" if%s\n", stmt.data.ifelse.on_false ? " else" : "");
-            print_expr(stmt.data.ifelse.condition, depth + 1);
-            print_stmt(*stmt.data.ifelse.on_true, depth + 1);
-            if (stmt.data.ifelse.on_false) {
-                print_stmt(*stmt.data.ifelse.on_false, depth + 1);
-            }
-            break;
-        case SWITCH_STMT:
-            printf(" switch\n");
-            print_expr(stmt.data.switchcase.expr, depth + 1);
-            for (size_t i = 0; i < stmt.data.switchcase.casec; i++) {
-                if (i == stmt.data.switchcase.defaulti) {
-                    print_indent(depth + 1);
-                    printf("default\n");
-                } else {
-                    print_expr(stmt.data.switchcase.casev[i], depth + 1);
-                }
-                print_stmt(stmt.data.switchcase.branchv[i], depth + 1);
-            }
-            break;
-        case WHILE_STMT:
-            printf(" while\n");
-            print_expr(stmt.data.whileloop.condition, depth + 1);
-            print_stmt(*stmt.data.whileloop.body, depth + 1);
-            break;
-        case DOWHILE_STMT:
-            printf(" do while\n");
-            print_expr(stmt.data.whileloop.condition, depth + 1);
-            print_stmt(*stmt.data.whileloop.body, depth + 1);
-            break;
-        case FOR_STMT:
-            printf(" for\n");
-            print_stmt(*stmt.data.forloop.init, depth + 1);
-            print_expr(stmt.data.forloop.condition, depth + 1);
-            print_expr(stmt.data.forloop.expr, depth + 1);
-            print_stmt(*stmt.data.forloop.body, depth + 1);
+            printf(" if%s\n", stmt->data.ifelse.on_false != NO_NODE ? " else" : "");
             break;
+        case SWITCH_STMT:  printf(" switch\n"); break;
+        case WHILE_STMT:   printf(" while\n"); break;
+        case DOWHILE_STMT: printf(" do while\n"); break;
+        case FOR_STMT:     printf(" for\n"); break;
         case FUNCTION_STMT:
-            printf(" fn %s\n", stmt.data.fun.name.str);
-            for (size_t i = 0; i < stmt.data.fun.paramc; i++) {
-                print_indent(depth + 1);
-                printf(
-                    "param   :%zu:%zu %s\n", stmt.data.fun.paramv[i].line,
-                    stmt.data.fun.paramv[i].col, stmt.data.fun.paramv[i].str
-                );
-                print_spec(stmt.data.fun.paramt[i], depth + 1);
-                print_expr(stmt.data.fun.paramd[i], depth + 1);
-            }
-            print_spec(stmt.data.fun.ret, depth + 1);
-            print_stmt(*stmt.data.fun.body, depth + 1);
+            printf(" fn %" PRIstrview "\n", STRVIEW_ARG(ast->tokens[stmt->data.fun.name].str));
             break;
         case STRUCT_STMT:
-            printf(" struct %s\n", stmt.data.structdef.name.str);
-            for (size_t i = 0; i < stmt.data.structdef.paramc; i++) {
-                print_indent(depth + 1);
-                printf(
-                    "member  :%zu:%zu %s\n", stmt.data.structdef.paramv[i].line,
-                    stmt.data.structdef.paramv[i].col, stmt.data.structdef.paramv[i].str
-                );
-                print_spec(stmt.data.structdef.paramt[i], depth + 1);
-                print_expr(stmt.data.structdef.paramd[i], depth + 1);
-            }
+            printf(
+                " struct %" PRIstrview "\n",
+                STRVIEW_ARG(ast->tokens[stmt->data.structdef.name].str)
+            );
             break;
         case ENUM_STMT:
-            printf(" enum %s\n", stmt.data.enumdef.name.str);
-            for (size_t i = 0; i < stmt.data.enumdef.len; i++) {
+            printf(
+                " enum %" PRIstrview "\n", STRVIEW_ARG(ast->tokens[stmt->data.enumdef.name].str)
+            );
+            for (size_t i = 0; i < stmt->data.enumdef.len; i++) {
                 print_indent(depth + 1);
-                printf(
-                    "value   :%zu:%zu %s\n", stmt.data.enumdef.items[i].line,
-                    stmt.data.enumdef.items[i].col, stmt.data.enumdef.items[i].str
-                );
+                print_token("value   ", ast->tokens[ast->lists[stmt->data.enumdef.items + i]]);
             }
             break;
-        case RETURN_STMT:
-            printf(" return\n");
-            print_expr(stmt.data.expr, depth + 1);
-            break;
+        case RETURN_STMT:   printf(" return\n"); break;
         case BREAK_STMT:    printf(" break\n"); break;
         case CONTINUE_STMT: printf(" continue\n"); break;
     }
 }
 
-void print_ast_p(AST* ast) {
-    for (size_t i = 0; i < ast->data.block.len; i++) {
-        print_stmt(ast->data.block.stmts[i], 0);
+// Check whether visit is of a child of a statement of type.
+bool is_child_of(const AST* ast, const Visit* visit, StmtEnum type) {
+    return visit->parent_kind == STMT_NODE && visit->parent != NO_NODE &&
+           ast->stmts[visit->parent].type == type;
+}
+
+// Check whether visit is of the case of the default branch of a switch, which has none.
+bool is_default_case(const AST* ast, const Visit* visit) {
+    if (!is_child_of(ast, visit, SWITCH_STMT)) return false;
+    // the cases alternate with the branches after the switched expression
+    return visit->index == 2 * (size_t)ast->stmts[visit->parent].data.switchcase.defaulti + 1;
+}
+
+// Print the nodes of ast in the order the visitor reaches them, indented by their depth.
+// Returns whether an error occurred.
+bool print_ast_p(const AST* ast) {
+    // parameters are printed at the depth of their type specifier and default value
+    size_t params = 0;
+
+    Visitor visitor = visitor_create(ast, STMT_NODE, ast->block);
+    for (Visit visit; visit_next(&visitor, &visit);) {
+        if (visit.post) {
+            if (visit.kind == PARAM_NODE) params--;
+            continue;
+        }
+        // the root block is not printed
+        if (visit.depth == 0) continue;
+
+        size_t depth = visit.depth - 1 - params;
+        switch (visit.kind) {
+            case SPEC_NODE: print_spec(ast, visit.id, depth); break;
+            case EXPR_NODE:
+                if (is_default_case(ast, &visit)) {
+                    print_indent(depth);
+                    printf("default\n");
+                    visit_skip(&visitor);
+                    break;
+                }
+                print_expr(ast, visit.id, depth);
+                break;
+            case STMT_NODE: print_stmt(ast, visit.id, depth); break;
+            case PARAM_NODE:
+                print_indent(depth);
+                print_token(
+                    is_child_of(ast, &visit, STRUCT_STMT) ? "member  " : "param   ",
+                    ast->tokens[ast->params[visit.id].name]
+                );
+                params++;
+                break;
+        }
     }
+
+    bool failed = visitor.failed;
+    visitor_destroy(&visitor);
+    return failed;
 }
 
 int main(int argc, char** argv) {
@@ -236,20 +228,29 @@ int main(int argc, char** argv) {
     const char* filename = argv[1];
     error_filename = filename;
 
-    char* program = readfile(filename);
-    Token* tokens = tokenize(program, 4);
-    AST* ast = parse(tokens);
+    // parse from the file directly to exercise the streaming lexer
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fread_error();
+        return EXIT_FAILURE;
+    }
+
+    set_source_file(filename, 4);
+    Lexer lexer = lexer_open(fp);
+    AST* ast = parse_stream(&lexer);
+    // the AST owns its strings, so the lexer and its token strings are not needed anymore
+    fclose(fp);
+    lexer_destroy(&lexer);
     if (ast == NULL) {
-        free(program);
-        free_token_arr(tokens);
-        free_ast_p(ast);
+        free_interner();
+        free_source();
         return EXIT_FAILURE;
     }
 
-    print_ast_p(ast);
+    bool failed = print_ast_p(ast);
 
-    free(program);
-    free_token_arr(tokens);
     free_ast_p(ast);
-    return EXIT_SUCCESS;
+    free_interner();
+    free_source();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "printerr.h"
+#include "readfile.h"
+#include "tokenizer.h"
+
+// Check whether two tokens of streams a and b are the same, with the same payloads.
+bool same_stream_token(
+    const TokenStream* a, const TokenStream* b, size_t i, size_t payload_pos
+) {
+    if (a->kinds[i] != b->kinds[i] || a->offsets[i] != b->offsets[i] || a->lens[i] != b->lens[i]) {
+        return false;
+    }
+    switch (a->kinds[i]) {
+        case LPAREN:
+        case RPAREN:
+        case LBRACKET:
+        case RBRACKET:
+        case LBRACE:
+        case RBRACE:      return a->matches[i] == b->matches[i];
+        case INT_LITERAL:
+            return a->payloads[payload_pos].int_literal == b->payloads[payload_pos].int_literal;
+        case CHR_LITERAL:
+            return a->payloads[payload_pos].chr_literal == b->payloads[payload_pos].chr_literal;
+        case STR_LITERAL:
+            StrRef x = a->payloads[payload_pos].str_literal;
+            StrRef y = b->payloads[payload_pos].str_literal;
+            return x.len == y.len &&
+                   memcmp(a->literals + x.offset, b->literals + y.offset, x.len) == 0;
+        case VAR_NAME:
+            return a->payloads[payload_pos].var_name == b->payloads[payload_pos].var_name;
+        default: return true;
+    }
+}
+
+// Check whether streams a and b have the same tokens.
+bool same_streams(const TokenStream* a, const TokenStream* b) {
+    if (a->len != b->len) return false;
+    for (size_t i = 0, payload_pos = 0; i < a->len; i++) {
+        if (!same_stream_token(a, b, i, payload_pos)) return false;
+        payload_pos += has_payload(a->kinds[i]);
+    }
+    return true;
+}
+
+// Check whether nodes of ASTs a and b and their children are the same.
+bool same_spec(const AST* a, const AST* b, spec_t x, spec_t y);
+bool same_expr(const AST* a, const AST* b, expr_t x, expr_t y);
+bool same_stmt(const AST* a, const AST* b, stmt_t x, stmt_t y);
+
+bool same_token(const AST* a, const AST* b, token_t x, token_t y) {
+    const Token* s = &a->tokens[x];
+    const Token* t = &b->tokens[y];
+    if (s->type != t->type || s->pos != t->pos || s->str.len != t->str.len) return false;
+    if (memcmp(s->str.ptr, t->str.ptr, s->str.len) != 0) return false;
+    switch (s->type) {
+        case INT_LITERAL: return s->data.int_literal.value == t->data.int_literal.value;
+        case CHR_LITERAL: return s->data.chr_literal == t->data.chr_literal;
+        case STR_LITERAL: return strcmp(s->data.str_literal.ptr, t->data.str_literal.ptr) == 0;
+        case VAR_NAME:    return s->data.var_name == t->data.var_name;
+        default:          return true;
+    }
+}
+
+bool same_list(
+    const AST* a, const AST* b, list_t x, list_t y, size_t len,
+    bool (*same_node)(const AST*, const AST*, uint32_t, uint32_t)
+) {
+    for (size_t i = 0; i < len; i++) {
+        if (!same_node(a, b, a->lists[x + i], b->lists[y + i])) return false;
+    }
+    return true;
+}
+
+bool same_params(const AST* a, const AST* b, param_t x, param_t y, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        const Param* s = &a->params[x + i];
+        const Param* t = &b->params[y + i];
+        if (!same_token(a, b, s->name, t->name) || !same_spec(a, b, s->type, t->type) ||
+            !same_expr(a, b, s->def, t->def))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool same_spec(const AST* a, const AST* b, spec_t x, spec_t y) {
+    const TypeSpec* s = &a->specs[x];
+    const TypeSpec* t = &b->specs[y];
+    if (s->type != t->type || s->pos != t->pos) return false;
+    switch (s->type) {
+        case ERROR_SPEC:
+        case INFERRED_SPEC: return true;
+        case GROUPED_SPEC:  return same_spec(a, b, s->data.group, t->data.group);
+        case ATOMIC_SPEC:   return same_token(a, b, s->data.atom, t->data.atom);
+        case ARR_SPEC:
+        case PTR_SPEC:
+            return s->data.ptr.mutable == t->data.ptr.mutable &&
+                   same_spec(a, b, s->data.ptr.spec, t->data.ptr.spec);
+        case FUN_SPEC:
+            return s->data.fun.paramc == t->data.fun.paramc &&
+                   s->data.fun.optc == t->data.fun.optc &&
+                   same_list(
+                       a, b, s->data.fun.paramt, t->data.fun.paramt, s->data.fun.paramc, same_spec
+                   ) &&
+                   same_spec(a, b, s->data.fun.ret, t->data.fun.ret);
+    }
+    return false;
+}
+
+bool same_expr(const AST* a, const AST* b, expr_t x, expr_t y) {
+    const Expr* s = &a->exprs[x];
+    const Expr* t = &b->exprs[y];
+    if (s->type != t->type || s->pos != t->pos) return false;
+    switch (s->type) {
+        case ERROR_EXPR:
+        case NO_EXPR:      return true;
+        case GROUPED_EXPR: return same_expr(a, b, s->data.group, t->data.group);
+        case ATOMIC_EXPR:  return same_token(a, b, s->data.atom, t->data.atom);
+        case ARR_EXPR:
+            return s->data.arr.len == t->data.arr.len &&
+                   same_list(
+                       a, b, s->data.arr.items, t->data.arr.items, s->data.arr.len, same_expr
+                   );
+        case LAMBDA_EXPR:
+            return s->data.lambda.paramc == t->data.lambda.paramc &&
+                   s->data.lambda.optc == t->data.lambda.optc &&
+                   same_params(
+                       a, b, s->data.lambda.params, t->data.lambda.params, s->data.lambda.paramc
+                   ) &&
+                   same_expr(a, b, s->data.lambda.expr, t->data.lambda.expr);
+        case TERNOP_EXPR:
+            if (!same_expr(a, b, s->data.op.third, t->data.op.third)) return false;
+            // fallthrough
+        case BINOP_EXPR:
+            if (!same_expr(a, b, s->data.op.second, t->data.op.second)) return false;
+            // fallthrough
+        case UNOP_EXPR:
+            return s->data.op.type == t->data.op.type &&
+                   same_expr(a, b, s->data.op.first, t->data.op.first);
+        case SUBSRIPT_EXPR:
+            return same_expr(a, b, s->data.subscript.arr, t->data.subscript.arr) &&
+                   same_expr(a, b, s->data.subscript.idx, t->data.subscript.idx);
+        case CALL_EXPR:
+        case CONSTRUCTOR_EXPR:
+            return s->data.call.argc == t->data.call.argc &&
+                   same_expr(a, b, s->data.call.fun, t->data.call.fun) &&
+                   same_list(
+                       a, b, s->data.call.argv, t->data.call.argv, s->data.call.argc, same_expr
+                   );
+        case ACCESS_EXPR:
+            return same_expr(a, b, s->data.access.obj, t->data.access.obj) &&
+                   same_token(a, b, s->data.access.memeber, t->data.access.memeber);
+    }
+    return false;
+}
+
+bool same_stmt(const AST* a, const AST* b, stmt_t x, stmt_t y) {
+    const Stmt* s = &a->stmts[x];
+    const Stmt* t = &b->stmts[y];
+    if (s->type != t->type || s->pos != t->pos) return false;
+    switch (s->type) {
+        case ERROR_STMT:
+        case NOP:
+        case BREAK_STMT:
+        case CONTINUE_STMT: return true;
+        case BLOCK:
+            return s->data.block.len == t->data.block.len &&
+                   same_list(
+                       a, b, s->data.block.stmts, t->data.block.stmts, s->data.block.len, same_stmt
+                   );
+        case EXPR_STMT:
+        case RETURN_STMT:   return same_expr(a, b, s->data.expr, t->data.expr);
+        case DECL:
+            return s->data.decl.mutable == t->data.decl.mutable &&
+                   same_token(a, b, s->data.decl.name, t->data.decl.name) &&
+                   same_spec(a, b, s->data.decl.spec, t->data.decl.spec) &&
+                   same_expr(a, b, s->data.decl.val, t->data.decl.val);
+        case TYPEDEF:
+            return same_token(a, b, s->data.type.name, t->data.type.name) &&
+                   same_spec(a, b, s->data.type.val, t->data.type.val);
+        case IFELSE_STMT:
+            if ((s->data.ifelse.on_false == NO_NODE) != (t->data.ifelse.on_false == NO_NODE)) {
+                return false;
+            }
+            return same_expr(a, b, s->data.ifelse.condition, t->data.ifelse.condition) &&
+                   same_stmt(a, b, s->data.ifelse.on_true, t->data.ifelse.on_true) &&
+                   (s->data.ifelse.on_false == NO_NODE ||
+                    same_stmt(a, b, s->data.ifelse.on_false, t->data.ifelse.on_false));
+        case SWITCH_STMT:
+            return s->data.switchcase.casec == t->data.switchcase.casec &&
+                   s->data.switchcase.defaulti == t->data.switchcase.defaulti &&
+                   same_expr(a, b, s->data.switchcase.expr, t->data.switchcase.expr) &&
+                   same_list(
+                       a, b, s->data.switchcase.casev, t->data.switchcase.casev,
+                       s->data.switchcase.casec, same_expr
+                   ) &&
+                   same_list(
+                       a, b, s->data.switchcase.branchv, t->data.switchcase.branchv,
+                       s->data.switchcase.casec, same_stmt
+                   );
+        case WHILE_STMT:
+        case DOWHILE_STMT:
+            return same_expr(a, b, s->data.whileloop.condition, t->data.whileloop.condition) &&
+                   same_stmt(a, b, s->data.whileloop.body, t->data.whileloop.body);
+        case FOR_STMT:
+            return same_stmt(a, b, s->data.forloop.init, t->data.forloop.init) &&
+                   same_expr(a, b, s->data.forloop.condition, t->data.forloop.condition) &&
+                   same_expr(a, b, s->data.forloop.expr, t->data.forloop.expr) &&
+                   same_stmt(a, b, s->data.forloop.body, t->data.forloop.body);
+        case FUNCTION_STMT:
+            return s->data.fun.paramc == t->data.fun.paramc &&
+                   s->data.fun.optc == t->data.fun.optc &&
+                   same_token(a, b, s->data.fun.name, t->data.fun.name) &&
+                   same_params(a, b, s->data.fun.params, t->data.fun.params, s->data.fun.paramc) &&
+                   same_spec(a, b, s->data.fun.ret, t->data.fun.ret) &&
+                   same_stmt(a, b, s->data.fun.body, t->data.fun.body);
+        case STRUCT_STMT:
+            return s->data.structdef.paramc == t->data.structdef.paramc &&
+                   s->data.structdef.optc == t->data.structdef.optc &&
+                   same_token(a, b, s->data.structdef.name, t->data.structdef.name) &&
+                   same_params(
+                       a, b, s->data.structdef.params, t->data.structdef.params,
+                       s->data.structdef.paramc
+                   );
+        case ENUM_STMT:
+            return s->data.enumdef.len == t->data.enumdef.len &&
+                   same_token(a, b, s->data.enumdef.name, t->data.enumdef.name) &&
+                   same_list(
+                       a, b, s->data.enumdef.items, t->data.enumdef.items, s->data.enumdef.len,
+                       same_token
+                   );
+    }
+    return false;
+}
+
+// Reparse program after replacing the bytes [start, end) of it by the len bytes at insert, and
+// compare the result to parsing the edited program from scratch.
+// Returns a word describing the result.
+const char* check_edit(
+    const char* program, size_t program_len, size_t start, size_t end, const char* insert,
+    size_t len
+) {
+    size_t edited_len = program_len - (end - start) + len;
+    char* edited = malloc(edited_len + 1);
+    if (edited == NULL) return "failed";
+    memcpy(edited, program, start);
+    memcpy(edited + start, insert, len);
+    memcpy(edited + start + len, program + end, program_len - end);
+    edited[edited_len] = '\0';
+
+    TokenStream* tokens = tokenize(program, program_len);
+    AST* ast = parse(tokens);
+    if (ast == NULL) {
+        free_token_stream(tokens);
+        free(edited);
+        return "failed";
+    }
+
+    TokenStream* expected_tokens = tokenize(edited, edited_len);
+    AST* expected = parse(expected_tokens);
+
+    const char* result;
+    bool failed = reparse(&tokens, &ast, edited, edited_len, (TextEdit) { start, end, len });
+    if (failed || expected == NULL) {
+        result = failed && expected == NULL ? "error" : "mismatch";
+    } else {
+        bool same = same_streams(tokens, expected_tokens) &&
+                    same_stmt(ast, expected, ast->block, expected->block);
+        result = same ? "ok" : "mismatch";
+    }
+
+    free_ast_p(expected);
+    free_token_stream(expected_tokens);
+    free_ast_p(ast);
+    free_token_stream(tokens);
+    free(edited);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "error: wrong number of command-line arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    const char* filename = argv[1];
+    error_filename = filename;
+
+    FileText file = map_file(filename, false);
+    if (file.text == NULL) return EXIT_FAILURE;
+    set_source_text(file.text, file.len, 4);
+
+    // edits of every line, most of which are syntax errors
+    errors_muted = true;
+    size_t line = 1;
+    for (size_t start = 0; start < file.len; line++) {
+        const char* lf = memchr(file.text + start, '\n', file.len - start);
+        size_t end = lf ? (size_t)(lf - file.text) + 1 : file.len;
+        const char* text = file.text + start;
+        size_t mid = start + (end - start) / 2;
+
+        printf(
+            "%zu: %s %s %s %s\n", line,
+            check_edit(file.text, file.len, start, end, "", 0),
+            check_edit(file.text, file.len, start, start, text, end - start),
+            check_edit(file.text, file.len, mid, mid, "x", 1),
+            check_edit(file.text, file.len, mid, mid, "\n", 1)
+        );
+        start = end;
+    }
+    errors_muted = false;
+
+    unmap_file(&file);
+    free_interner();
+    free_source();
+    return EXIT_SUCCESS;
+}
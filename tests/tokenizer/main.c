@@ -1,10 +1,73 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "printerr.h"
 #include "readfile.h"
+#include "scan.h"
 #include "tokenizer.h"
 
+// Check whether two tokens of streams a and b are the same, with the same payloads.
+bool same_stream_token(
+    const TokenStream* a, const TokenStream* b, size_t i, size_t payload_pos
+) {
+    if (a->kinds[i] != b->kinds[i] || a->offsets[i] != b->offsets[i] || a->lens[i] != b->lens[i]) {
+        return false;
+    }
+    switch (a->kinds[i]) {
+        case LPAREN:
+        case RPAREN:
+        case LBRACKET:
+        case RBRACKET:
+        case LBRACE:
+        case RBRACE:      return a->matches[i] == b->matches[i];
+        case INT_LITERAL:
+            return a->payloads[payload_pos].int_literal == b->payloads[payload_pos].int_literal;
+        case CHR_LITERAL:
+            return a->payloads[payload_pos].chr_literal == b->payloads[payload_pos].chr_literal;
+        case STR_LITERAL:
+            StrRef x = a->payloads[payload_pos].str_literal;
+            StrRef y = b->payloads[payload_pos].str_literal;
+            return x.len == y.len &&
+                   memcmp(a->literals + x.offset, b->literals + y.offset, x.len) == 0;
+        case VAR_NAME:
+            return a->payloads[payload_pos].var_name == b->payloads[payload_pos].var_name;
+        default: return true;
+    }
+}
+
+// Check whether streams a and b have the same tokens.
+bool same_streams(const TokenStream* a, const TokenStream* b) {
+    if (a->len != b->len) return false;
+    for (size_t i = 0, payload_pos = 0; i < a->len; i++) {
+        if (!same_stream_token(a, b, i, payload_pos)) return false;
+        payload_pos += has_payload(a->kinds[i]);
+    }
+    return true;
+}
+
+// Tokenize text of length len again with the kernels of each other level supported by the cpu.
+// Returns whether the tokens or the number of syntax errors differ from tokens and errors.
+bool check_scan_levels(const char* text, size_t len, const TokenStream* tokens, size_t errors) {
+    bool differ = false;
+    errors_muted = true;
+    ScanLevel levels[] = { SCAN_SSE2, SCAN_AVX2 };
+    for (size_t i = 0; i < sizeof(levels) / sizeof(ScanLevel); i++) {
+        if (scan_select(levels[i]) != levels[i]) continue;
+        syntax_errors = 0;
+        TokenStream* other = tokenize_parallel(text, len, 4);
+        bool same = tokens ? other && same_streams(tokens, other) : other == NULL;
+        if (!same || syntax_errors != errors) {
+            const char* name = scan_level_name(levels[i]);
+            fprintf(stderr, "error: tokens differ with the %s kernels\n", name);
+            differ = true;
+        }
+        free_token_stream(other);
+    }
+    errors_muted = false;
+    return differ;
+}
+
 int main(int argc, char** argv) {
     if (argc != 2) {
         fprintf(stderr, "error: wrong number of command-line arguments\n");
@@ -14,26 +77,47 @@ int main(int argc, char** argv) {
     const char* filename = argv[1];
     error_filename = filename;
 
-    char* program = readfile(filename);
-    Token* tokens = tokenize(program, 4);
-    if (tokens == NULL) {
-        free(program);
-        free_token_arr(tokens);
+    FileText file = map_file(filename, false);
+    set_source_text(file.text, file.len, 4);
+    // stitching must not change the tokens, and neither must the scanning kernels
+    scan_select(SCAN_SCALAR);
+    TokenStream* tokens = tokenize_parallel(file.text, file.len, 4);
+    bool differ = check_scan_levels(file.text, file.len, tokens, syntax_errors);
+    if (tokens == NULL || differ) {
+        unmap_file(&file);
+        free_token_stream(tokens);
+        free_interner();
+        free_source();
         return EXIT_FAILURE;
     }
 
-    for (Token* it = tokens; it->type != EOF_TOKEN; it++) {
-        printf("(%d):%zu:%zu %s", it->type, it->line, it->col, it->str);
+    Lexer lexer = lexer_from_stream(tokens);
+    for (Token token; (token = next_token(&lexer)).type != EOF_TOKEN;) {
+        const Token* it = &token;
+        printf(
+            "(%d):%zu:%zu %" PRIstrview, it->type, source_line(it->pos), source_col(it->pos),
+            STRVIEW_ARG(it->str)
+        );
         switch (it->type) {
-            case INT_LITERAL: printf(" %" PRIliteral "\n", it->data.int_literal); break;
+            case INT_LITERAL:
+                printf(
+                    " %" PRIliteral " (%d)\n", it->data.int_literal.value,
+                    it->data.int_literal.width
+                );
+                break;
             case CHR_LITERAL: printf(" %c\n", it->data.chr_literal); break;
-            case STR_LITERAL: printf(" %s\n", it->data.str_literal); break;
-            case VAR_NAME:    printf(" %s\n", it->data.var_name); break;
+            case STR_LITERAL: printf(" %s\n", it->data.str_literal.ptr); break;
+            case VAR_NAME:
+                printf(" %" PRIstrview "\n", STRVIEW_ARG(symbol_name(it->data.var_name)));
+                break;
             default:          printf("\n"); break;
         }
     }
 
-    free(program);
-    free_token_arr(tokens);
+    lexer_destroy(&lexer);
+    unmap_file(&file);
+    free_token_stream(tokens);
+    free_interner();
+    free_source();
     return EXIT_SUCCESS;
 }
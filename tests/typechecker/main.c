@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "parser.h"
 #include "printerr.h"
@@ -7,27 +8,95 @@
 #include "tokenizer.h"
 #include "typechecker.h"
 
+// Declare the name str in the innermost scope of table.
+// Returns whether an error occurred.
+bool declare(SymbolTable* table, const char* str) {
+    return declare_symbol(table, intern(str, strlen(str)));
+}
+
+// Find the index of the innermost binding of the name str in table, or NO_BINDING.
+uint32_t binding_of(const SymbolTable* table, const char* str) {
+    const Binding* binding = find_binding(table, intern(str, strlen(str)));
+    return binding ? binding - (const Binding*)table->bindings.c_arr : NO_BINDING;
+}
+
+// Check that the scopes of table shadow the names of outer scopes and restore them when closed,
+// with enough names to grow its hash table.
+// Returns the check that failed, or NULL.
+const char* check_scopes(SymbolTable* table) {
+    // { x y { x x z } }
+    if (push_scope(table) || declare(table, "x") || declare(table, "y")) return "declare";
+    if (push_scope(table) || declare(table, "x") || declare(table, "x") || declare(table, "z")) {
+        return "declare";
+    }
+    // the first declaration of a name in a scope is the one found
+    if (binding_of(table, "x") != 2 || binding_of(table, "y") != 1 ||
+        binding_of(table, "z") != 3 || ((Binding*)table->bindings.c_arr)[2].shadowed != 0)
+    {
+        return "shadow";
+    }
+    close_scope(table);
+    if (binding_of(table, "x") != 0 || binding_of(table, "z") != NO_BINDING) return "restore";
+
+    // { x y { n0 n1 ... x } }
+    char name[16];
+    if (push_scope(table)) return "declare";
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        if (declare(table, name)) return "declare";
+    }
+    if (declare(table, "x")) return "declare";
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        if (binding_of(table, name) != 2 + (uint32_t)i) return "grow";
+    }
+    if (binding_of(table, "x") != 202 || binding_of(table, "y") != 1) return "grow";
+    close_scope(table);
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        if (binding_of(table, name) != NO_BINDING) return "restore";
+    }
+    if (binding_of(table, "x") != 0) return "restore";
+
+    close_scope(table);
+    return binding_of(table, "x") != NO_BINDING ? "close" : NULL;
+}
+
 int main(int argc, char** argv) {
     if (argc != 2) {
         fprintf(stderr, "error: wrong number of command-line arguments\n");
         return EXIT_FAILURE;
     }
 
+    SymbolTable table = symbol_table_create();
+    const char* check = check_scopes(&table);
+    free_symbol_table(&table);
+    if (check) {
+        fprintf(stderr, "error: symbol table check '%s' failed\n", check);
+        free_interner();
+        return EXIT_FAILURE;
+    }
+
     const char* filename = argv[1];
     error_filename = filename;
 
-    char* program = readfile(filename);
-    Token* tokens = tokenize(program, 4);
-    AST* ast = parse(tokens);
+    FileText file = map_file(filename, false);
+    set_source_text(file.text, file.len, 4);
+    TokenStream* tokens = tokenize(file.text, file.len);
+    // stitching must not change the AST
+    AST* ast = parse_parallel(tokens, 4);
+    free_token_stream(tokens);
     if (typecheck(ast)) {
-        free(program);
-        free_token_arr(tokens);
+        unmap_file(&file);
+        free_interner();
+        free_source();
         free_ast_p(ast);
         return EXIT_FAILURE;
     }
 
-    free(program);
-    free_token_arr(tokens);
-    free_typed_ast_p(ast);
+    unmap_file(&file);
+    free_interner();
+    free_source();
+    free_ast_p(ast);
     return EXIT_SUCCESS;
 }